@@ -0,0 +1,41 @@
+// data_stats.h
+
+#ifndef DATA_STATS_H
+#define DATA_STATS_H
+
+#include <stdint.h>
+
+/**
+ * @brief Cumulative sample accounting along the acquisition -> FIFO -> SD/BLE path.
+ *
+ * Every counter is an atomic, updated from whichever thread or ISR sees the event, and counts
+ * samples (NeuralData structs) since boot. A session is lossless when all the drop counters
+ * read 0.
+ */
+enum data_stat
+{
+    DATA_STAT_PRODUCED,            // Samples acquired, whether or not they reached the FIFO
+    DATA_STAT_FIFO_DROPPED,        // Lost before the FIFO: ring full for a lossless sink, or no block read pending
+    DATA_STAT_BLE_DROPPED,         // Skipped by the BLE notifier after being run over, or failed to send
+    DATA_STAT_SD_DROPPED,          // Read by the SD writer but not written
+    DATA_STAT_LATE,                // Acquisitions started after their scheduled time
+    DATA_STAT_FIFO_HIGH_WATERMARK, // Largest FIFO fill seen, in samples
+    DATA_STAT_COUNT,
+};
+
+struct data_stats
+{
+    uint32_t produced;
+    uint32_t fifo_dropped;
+    uint32_t ble_dropped;
+    uint32_t sd_dropped;
+    uint32_t late;
+    uint32_t fifo_high_watermark;
+};
+
+void data_stats_add(enum data_stat stat, uint32_t n);
+// Raise a high-watermark counter to value if it is below it
+void data_stats_max(enum data_stat stat, uint32_t value);
+void data_stats_get(struct data_stats *stats);
+
+#endif // DATA_STATS_H
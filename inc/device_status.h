@@ -3,15 +3,25 @@
 #define DEVICE_STATUS_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <zephyr/toolchain.h>
 #define CONFIG_VERSION_LENGTH 8
 
+// Sent as is in the device status notification, little-endian and packed
 typedef struct
 {
     uint8_t battery_level;
     int8_t temperature;
     bool recording_status;
     char configuration[CONFIG_VERSION_LENGTH + 1];
-} DeviceStatus;
+    // Data path counters since boot, in samples, see data_stats.h
+    uint32_t samples_produced;
+    uint32_t fifo_dropped;
+    uint32_t ble_dropped;
+    uint32_t sd_dropped;
+    uint32_t late_acquisitions;
+    uint16_t fifo_high_watermark;
+} __packed DeviceStatus;
 
 // Declare the global variable
 extern DeviceStatus device_status;
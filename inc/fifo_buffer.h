@@ -6,25 +6,133 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
 #include "../inc/neural_data.h"
 
-// Half a second of data to be buffered represents roughly 200 neural data items
-#define FIFO_BUFFER_SIZE 300
+// About two seconds of data at 250 Hz. Must be a power of two so the free-running indices wrap cleanly.
+#define FIFO_BUFFER_SIZE 512
+#define FIFO_BUFFER_MASK (FIFO_BUFFER_SIZE - 1)
+// Largest neural data notification payload, the 247 byte ATT MTU less the 3 byte header
 #define MAX_FIFO_DATA_SIZE 244
+// Keeps the producer and consumer indices on separate lines on cores with a data cache
+#define FIFO_CACHE_LINE 32
+// Sinks reading the ring: SD and BLE, one spare
+#define FIFO_MAX_CONSUMERS 3
 
+BUILD_ASSERT(IS_POWER_OF_TWO(FIFO_BUFFER_SIZE), "FIFO_BUFFER_SIZE must be a power of two");
+
+// What the producer does when a consumer falls a whole ring behind
+enum fifo_overflow_policy
+{
+    FIFO_OVERFLOW_BLOCK,       // New items are dropped until this consumer catches up (lossless sinks)
+    FIFO_OVERFLOW_DROP_OLDEST, // The producer runs over this consumer, which skips to the oldest item still held
+};
+
+/**
+ * @brief One sink's read cursor over the shared ring.
+ *
+ * The producer raises signal once each time the unread count climbs to high_watermark, typically
+ * one full write or packet. fifo_buffer_wait() returns straight away while that much is already
+ * unread, and after a timeout hands over a partial batch of at least low_watermark items, so data
+ * does not sit in the ring when the producer stops. signal can also go in the caller's own k_poll().
+ *
+ * A BLOCK consumer can have a spill tier (spill.h): once the items it holds in the ring reach
+ * overflow_watermark, overflow is raised and the tier copies them out from the spill cursor on.
+ * Once the consumer's head reaches the first item the tier copied, items below the spill cursor
+ * no longer hold the producer back and the consumer reads them from the tier. Until then the
+ * consumer may still be using the ring items before them, and the producer only fills in order.
+ */
+typedef struct
+{
+    atomic_t head __aligned(FIFO_CACHE_LINE); // Items this consumer has read
+    atomic_t spilled;                         // Items moved out of the ring by a spill tier, head while unused
+    atomic_t spill_start;                     // First item the spill tier moved out, spilled counts once head is here
+    atomic_t dropped;                         // Items a DROP_OLDEST consumer was run over for
+    struct k_poll_signal signal;              // Raised when the unread count reaches high_watermark
+    struct k_poll_signal overflow;            // Raised when the ring fill reaches overflow_watermark
+    size_t high_watermark;
+    size_t low_watermark;
+    size_t overflow_watermark;                // 0: no spill tier
+    enum fifo_overflow_policy policy;
+} fifo_consumer_t;
+
+/**
+ * @brief Lock-free single-producer ring of NeuralData with one read cursor per sink.
+ *
+ * tail is only written by the producer and each consumer's head only by that consumer. All of
+ * them count items since init and are never reduced modulo the size, so tail - head is a
+ * consumer's fill level. Every sink reads the same copy of the data.
+ *
+ * The producer only waits on FIFO_OVERFLOW_BLOCK consumers: the free space is set by the slowest
+ * of them. FIFO_OVERFLOW_DROP_OLDEST consumers can be run over, so they only get copies through
+ * read_from_fifo_buffer(), which checks the items were not overwritten while they were copied.
+ *
+ * The reserve/commit and peek/release pairs hand out the ring slots themselves, so the producer
+ * can build items in place and a BLOCK consumer can pass them straight to fs_write() or process
+ * them where they are. A span is at most two runs: the slots up to the end of the ring and,
+ * after a wrap, the rest from its start.
+ */
 typedef struct
 {
-    NeuralData buffer[FIFO_BUFFER_SIZE];
-    size_t head;
-    size_t tail;
-    size_t size;
-    struct k_mutex mutex;
-    struct k_sem data_available; // Semaphore to signal data availability
+    atomic_t tail __aligned(FIFO_CACHE_LINE); // Producer: items written
+    atomic_t reserved;                        // Producer: end of the slots being written, tail while idle
+    fifo_consumer_t *consumers[FIFO_MAX_CONSUMERS];
+    size_t consumer_count;
+    NeuralData buffer[FIFO_BUFFER_SIZE] __aligned(FIFO_CACHE_LINE);
 } fifo_buffer_t;
 
+// Ring slots handed out in place, data[1] is the start of the ring and count[1] is 0 unless the span wraps
+typedef struct
+{
+    NeuralData *data[2];
+    size_t count[2];
+} fifo_write_span_t;
+
+typedef struct
+{
+    const NeuralData *data[2];
+    size_t count[2];
+} fifo_read_span_t;
+
 int init_fifo_buffer(fifo_buffer_t *fifo_buffer);
-size_t read_from_fifo_buffer(fifo_buffer_t *fifo_buffer, NeuralData *data, size_t max_size);
+// Register a sink, reading from the next item written. Call before the producer starts.
+// Returns -EINVAL unless 0 < low_watermark <= high_watermark <= FIFO_BUFFER_SIZE, -ENOMEM when all slots are taken.
+int fifo_buffer_add_consumer(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, enum fifo_overflow_policy policy,
+                             size_t low_watermark, size_t high_watermark);
+// Wait until high_watermark items are unread. Returns the unread count, which is below
+// high_watermark only after a timeout with at least low_watermark items, or -EAGAIN.
+int fifo_buffer_wait(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, k_timeout_t timeout);
+
+// Consumer side, copying, any policy
+size_t read_from_fifo_buffer(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, NeuralData *data,
+                             size_t max_size);
+// Items the consumer has not read yet
+size_t fifo_buffer_available(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer);
+// Producer side, returns how many items fitted
 size_t write_to_fifo_buffer(fifo_buffer_t *fifo_buffer, const NeuralData *data, size_t size);
+// Fill level as the producer sees it, against the slowest BLOCK consumer: items and 0-100 %
+size_t fifo_buffer_fill(fifo_buffer_t *fifo_buffer);
 int get_fifo_fill_percentage(fifo_buffer_t *fifo_buffer);
 
-#endif /* FIFO_BUFFER_H */
\ No newline at end of file
+// Producer side, in place: free slots (at most max, returns the total) in *span, then publish the
+// first n of them, in span order
+size_t fifo_buffer_reserve(fifo_buffer_t *fifo_buffer, size_t max, fifo_write_span_t *span);
+void fifo_buffer_commit(fifo_buffer_t *fifo_buffer, size_t n);
+// Consumer side, in place, BLOCK consumers only: unread items (at most max, returns the total) in
+// *span, then free the first n of them. The items stay valid until released.
+size_t fifo_buffer_peek(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, size_t max, fifo_read_span_t *span);
+void fifo_buffer_release(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, size_t n);
+
+// Spill tier side, BLOCK consumers only. Indices are free-running item counts like head.
+void fifo_buffer_set_overflow_watermark(fifo_consumer_t *consumer, size_t watermark);
+uint32_t fifo_buffer_head(fifo_consumer_t *consumer);
+// Unread items still held in the ring, from the later of head and the spill cursor
+size_t fifo_buffer_ring_fill(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer);
+// Items from index on (at most max) in place. index must not be below the consumer's head.
+size_t fifo_buffer_peek_at(fifo_buffer_t *fifo_buffer, uint32_t index, size_t max, fifo_read_span_t *span);
+// Hand the slots in [start, end) back to the producer once the consumer's head reaches start, the
+// items are kept elsewhere
+void fifo_buffer_set_spilled(fifo_consumer_t *consumer, uint32_t start, uint32_t end);
+
+#endif /* FIFO_BUFFER_H */
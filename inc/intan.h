@@ -4,16 +4,175 @@
 #define INTAN_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <zephyr/kernel.h>
 #include "../inc/neural_data.h"
 #include "../inc/fifo_buffer.h"
+#include "../inc/rhd2232.h"
 
 #define INTAN_THREAD_STACK_SIZE 8192
 
+// Largest block of samples published to the FIFO in one write
+#define INTAN_MAX_BLOCK_FRAMES 16
+
+// Acquisition limits, a frame of 35 words at 20 MHz plus CS gaps fits well inside 1/5000 s
+#define INTAN_MAX_SAMPLE_RATE_HZ 5000
+BUILD_ASSERT(MAX_CHANNELS <= 64, "Channel masks are 64 bits wide");
+#define INTAN_CHANNEL_MASK_ALL (UINT64_MAX >> (64 - MAX_CHANNELS))
+
+// How frames are taken, see intan_set_mode()
+enum intan_acq_mode
+{
+    INTAN_MODE_PER_WORD, // One spi_transceive per word from the workqueue, any board
+    INTAN_MODE_FRAME,    // Frame engine run from the acquisition clock interrupt (SPIM + PPI)
+    INTAN_MODE_HW_TIMED, // TIMER4 starts every frame through PPI, one interrupt per block
+    INTAN_MODE_COUNT,
+};
+
+struct intan_acq_config
+{
+    uint32_t sample_rate_hz; // Frames per second
+    uint64_t channel_mask;   // Bit n enables channel n, 32 * chip + amplifier
+};
+
+// Amplifier bandwidth profiles (Register8-13)
+enum intan_bandwidth
+{
+    INTAN_BW_WIDE,   // 1 Hz - 7.5 kHz
+    INTAN_BW_MEDIUM, // 1 Hz - 1 kHz
+    INTAN_BW_NARROW, // 1 Hz - 300 Hz
+    INTAN_BW_COUNT,
+};
+
+// Latest auxiliary reads taken in the pipeline flush slots, refreshed every few frames
+struct intan_aux_status
+{
+    int32_t temperature_centi_c; // On-chip sensor, hundredths of a degree C
+    uint16_t supply_mv;          // RHD VDD
+    uint16_t aux_in[3];          // AUX1-3 raw ADC counts
+};
+
+// Acquisition clock health, measured against the kernel uptime clock. Drift needs a clock independent
+// of the kernel's, so it is only measured on the hardware-timed path (HFXO against LFXO).
+struct intan_clock_stats
+{
+    uint64_t samples;      // Samples since acquisition (re)started
+    int64_t cumulative_ns; // Lag of the samples behind their index-derived times since the first report
+    int32_t drift_ppb;     // cumulative_ns over the elapsed time, + means the acquisition clock runs slow
+    uint32_t late_frames;  // Frames started late because the alarm was armed in the past (RTC clock only)
+    bool drift_measured;   // cumulative_ns and drift_ppb are meaningful, zero otherwise
+};
+
+// Sample interval deviation histogram: bucket 0 is under 1 us, bucket k covers [2^(k-1), 2^k) us, the last is open-ended
+#define INTAN_JITTER_BUCKETS 12
+
+// Frame timing as the CPU sees it, measured with the cycle counter from the moment each frame is taken.
+// On the hardware-timed path TIMER4 starts the frames, so intervals are those of the block interrupts
+// against block_size periods and handler times are the block interrupt's.
+struct intan_timing_stats
+{
+    uint32_t interval_hist[INTAN_JITTER_BUCKETS]; // |actual - nominal| interval between frames
+    uint32_t interval_min_ns;
+    uint32_t interval_max_ns;
+    uint32_t handler_max_ns;  // Worst frame handler run, timer ISR or workqueue
+    uint32_t coalesced_ticks; // Ticks that found the handler still queued, their frame was never taken
+    uint32_t overrun_ticks;   // Ticks that found the handler still running, their frame was taken late
+};
+
+// Channels the detected chips actually have, valid after intan_init()
+uint64_t intan_available_channels(void);
+
+// ROM identification of one chip, chip indices follow the intan,rhd2232 instance numbers
+int intan_get_chip_info(size_t chip, struct rhd2232_info *info);
+
+// Registers 0-17 as last written to a chip (bandwidth and power included), for the session file header
+#define INTAN_REGISTER_COUNT 18
+int intan_get_registers(size_t chip, uint8_t regs[INTAN_REGISTER_COUNT]);
+
 extern struct k_thread intan_thread_data;
 extern k_thread_stack_t intan_stack[];
 
 int intan_init(fifo_buffer_t *fifo_buffer);
 void intan_thread(void *arg1, void *arg2, void *arg3);
 
+/**
+ * @brief Set how many samples are collected before one FIFO write.
+ *
+ * Must be called before intan_thread() starts sampling. Each block is one RHD2232 sensor
+ * read completed to intan_thread(), so larger blocks cut completions and FIFO locking by
+ * the block factor at the cost of block_size sample periods of added latency.
+ *
+ * Timestamps are reconstructed from the sample index, not read per sample: sample n
+ * (counted from 0 at the start of acquisition) carries
+ *     timestamp = floor((t0_ns + n * 10^9 / sample_rate_hz) / 10^6) - t_thread  [ms]
+ * where t0_ns is the uptime of the first sample and t_thread the uptime at intan_thread()
+ * start, see intan_sample_time_ns(). The acquisition clock holds the exact long-run rate,
+ * so the reconstructed times do not walk off; gaps show up as dropped samples in the FIFO,
+ * never as shifted timestamps. intan_configure() restarts the index, so t0_ns moves to the
+ * first sample after it, once that sample has been decoded.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL frames is 0 or above INTAN_MAX_BLOCK_FRAMES.
+ * @retval -EBUSY sampling is already running.
+ */
+int intan_set_block_size(size_t frames);
+
+/**
+ * @brief Change sample rate and enabled channels.
+ *
+ * Safe to call while sampling: acquisition stops at a block boundary, the amplifier
+ * power registers and the CONVERT table are regenerated from the mask, and sampling
+ * restarts at the new rate with the sample index reset. Disabled channels are not
+ * converted and read as 0 in NeuralData.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL rate is 0 or above INTAN_MAX_SAMPLE_RATE_HZ, or the mask is empty or enables
+ *         channels outside intan_available_channels().
+ * @retval -EIO the power register write was not echoed; the previous config stays active.
+ */
+int intan_configure(const struct intan_acq_config *config);
+void intan_get_config(struct intan_acq_config *config);
+
+/**
+ * @brief Pick how frames are taken, for comparing the acquisition paths.
+ *
+ * intan_init() picks the fastest mode the board has. Like intan_configure(), a change while
+ * sampling stops at a block boundary and restarts with the sample index reset.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL unknown mode.
+ * @retval -ENOTSUP the board has no frame engine (e.g. native_sim), or it failed to load the table.
+ */
+int intan_set_mode(enum intan_acq_mode mode);
+// Mode in use, the per-word path after a frame engine failure
+enum intan_acq_mode intan_get_mode(void);
+
+// 64-bit uptime in ns of sample index of the run whose samples are reaching the FIFO, from the index and the
+// acquisition clock
+int64_t intan_sample_time_ns(uint32_t index);
+void intan_get_clock_stats(struct intan_clock_stats *stats);
+// Since sampling (re)started or the last reset, intan_configure() restarts them too
+void intan_get_timing_stats(struct intan_timing_stats *stats);
+void intan_reset_timing_stats(void);
+
+// Temperature and supply also feed device_status.temperature and battery_level
+void intan_get_aux_status(struct intan_aux_status *status);
+
+/**
+ * @brief Switch amplifier bandwidth or re-run ADC calibration without stopping acquisition.
+ *
+ * The register writes (or CALIBRATE) are queued and go out in the pipeline flush slots of the
+ * next frames, in place of the auxiliary reads. Samples taken while the change lands and settles
+ * carry NEURAL_DATA_FLAG_RECONFIG, plus NEURAL_DATA_FLAG_CALIBRATING for calibration; none are
+ * dropped. A queued update waits for sampling to (re)start. intan_get_registers() reports the
+ * new profile once the update has settled.
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL unknown profile.
+ * @retval -EBUSY another update is still in flight, see intan_update_pending().
+ */
+int intan_set_bandwidth(enum intan_bandwidth profile);
+int intan_calibrate(void);
+bool intan_update_pending(void);
+
 #endif // INTAN_H
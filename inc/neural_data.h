@@ -4,23 +4,27 @@
 
 #include <stdint.h>
 #include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
 
-#define MAX_CHANNELS 16
+// One intan,rhd2232 node per RHD chip on the bus. Every chip gets 32 channel slots (the most a chip
+// delivers on one MISO line), channel n of chip c is channel_data[32 * c + n]; slots the detected
+// variant does not have read as 0.
+#define RHD_CHIP_COUNT MAX(DT_NUM_INST_STATUS_OKAY(intan_rhd2232), 1)
+#define RHD_CHANNELS_PER_CHIP 32
+#define MAX_CHANNELS (RHD_CHIP_COUNT * RHD_CHANNELS_PER_CHIP)
 
-// Structure to hold ONE SAMPLE of neural data (totals 288 bits = 36 bytes)
+// NeuralData.flags
+#define NEURAL_DATA_FLAG_RECONFIG BIT(0)    // Amplifier registers changed or settling, data usable with care
+#define NEURAL_DATA_FLAG_CALIBRATING BIT(1) // ADC calibration overlapped this sample, channel data invalid
+
+// Structure to hold ONE SAMPLE of neural data (76 bytes with one chip, 2 * MAX_CHANNELS + 12). Only
+// channel_data goes to the card and over BLE, the rest moves into block headers, see session_file.h.
 typedef struct
 {
     uint16_t channel_data[MAX_CHANNELS];
     uint32_t timestamp;
+    uint32_t flags;
+    uint32_t index; // Sample index since acquisition (re)started, consecutive samples differ by 1
 } NeuralData;
 
-// Declare the global variable
-typedef struct
-{
-    NeuralData data;
-    bool sent;
-} LatestNeuralData;
-
-extern LatestNeuralData latest_neural_data;
-
 #endif // NEURAL_DATA_H
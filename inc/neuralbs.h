@@ -24,7 +24,10 @@ extern "C"
 #define BT_UUID_NBS_NEURAL_DATA BT_UUID_DECLARE_128(BT_UUID_NBS_NEURAL_DATA_VAL)
 #define BT_UUID_NBS_DEVICE_STATUS BT_UUID_DECLARE_128(BT_UUID_NBS_DEVICE_STATUS_VAL)
 
-    int nbs_send_neural_data_notify(NeuralData *latest_neural_data);
+    // One packet (session_packet_header and its records, see session_file.h) in one notification,
+    // at most MAX_FIFO_DATA_SIZE bytes. -ENOMEM means the link is out of TX buffers and the packet
+    // can be sent again.
+    int nbs_send_neural_data_notify(const void *packet, size_t size);
     int nbs_send_system_status_notify(DeviceStatus *device_status);
 
 #ifdef __cplusplus
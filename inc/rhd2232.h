@@ -0,0 +1,88 @@
+// rhd2232.h
+
+#ifndef RHD2232_H
+#define RHD2232_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+
+/**
+ * @brief RHD2232 sensor driver: the SPI command path and the asynchronous (RTIO) read path.
+ *
+ * Reads submitted with sensor_read() on a SENSOR_DT_READ_IODEV() of the rhd2232 node are queued
+ * by the driver, and each completes with one block of raw frames in a buffer taken from the
+ * caller's RTIO memory pool. The acquisition engine (intan.c) claims the buffer of the oldest
+ * pending read before a block starts and the frames are written straight into it, by the SPIM
+ * on the hardware-timed path, so the consumer gets the buffer the data landed in.
+ *
+ * A buffer is a struct rhd2232_block_header followed by frames * words results. Decode it with
+ * the driver's decoder (SENSOR_CHAN_VOLTAGE, channel_idx = amplifier channel) or directly.
+ */
+
+// Reads the driver holds before further submissions fail with -ENOMEM
+#define RHD2232_MAX_PENDING_READS 8
+// Amplifier channels one chip delivers on MISO A, the RHD2164's upper 32 need DDR on MISO B
+#define RHD2232_MAX_AMPLIFIERS 32
+
+// RHD2000 ROM register 63
+#define RHD2232_CHIP_ID_RHD2132 1
+#define RHD2232_CHIP_ID_RHD2216 2
+#define RHD2232_CHIP_ID_RHD2164 4
+
+// Chip identification from ROM registers 60-63
+struct rhd2232_info
+{
+    uint8_t die_revision;
+    uint8_t unipolar;   // 1: unipolar inputs with a common reference
+    uint8_t amplifiers; // Amplifier count as reported
+    uint8_t chip_id;
+    uint8_t channels;   // Amplifiers usable on a single MISO line
+};
+
+// A frame is one segment per chip, in chip order: the chip's CONVERTs for its enabled channels, lowest
+// first, then flush_words auxiliary commands. Chip c's enabled channels are bits 32c..32c+31 of channel_mask.
+struct rhd2232_block_header
+{
+    uint64_t timestamp_ns;   // Uptime of the first frame
+    int64_t start_ns;        // Uptime of sample index 0 of the run
+    uint32_t first_index;    // Sample index of the first frame
+    uint32_t sample_rate_hz;
+    uint64_t channel_mask;   // Converted channels, 32 * chip + amplifier
+    uint32_t run;            // Acquisition run, changes each time sampling (re)starts
+    uint16_t frames;
+    uint16_t words;          // Commands per frame over all chips
+    uint8_t wire_order;      // Results are big-endian, as clocked in by the SPIM
+    uint8_t chips;
+    uint8_t flush_words;     // Auxiliary commands closing each chip's segment
+    uint8_t reserved;
+};
+
+#define RHD2232_BLOCK_SIZE(frames, words) \
+    (sizeof(struct rhd2232_block_header) + (size_t)(frames) * (words) * sizeof(uint16_t))
+
+static inline const uint16_t *rhd2232_block_results(const uint8_t *buffer)
+{
+    return (const uint16_t *)(buffer + sizeof(struct rhd2232_block_header));
+}
+
+// One 16-bit command, returns the word clocked in with it (the result of the command two before)
+uint16_t rhd2232_command(const struct device *dev, uint16_t command);
+
+// Check the "INTAN" company ROM and read the chip identification.
+// Returns -ENODEV when the company string does not match.
+int rhd2232_read_info(const struct device *dev, struct rhd2232_info *info);
+
+// Part name for a ROM chip ID, "unknown" for IDs outside the RHD2000 family table
+const char *rhd2232_variant_name(uint8_t chip_id);
+
+// Results area of the oldest pending read's buffer for a block of frames * words results,
+// or NULL when no read is pending. ISR safe.
+uint16_t *rhd2232_block_get(const struct device *dev, size_t frames, size_t words);
+
+// Complete the read owning results with a filled block, header->frames may be 0 to hand back a
+// claimed buffer unused. ISR safe.
+int rhd2232_block_put(const struct device *dev, uint16_t *results, const struct rhd2232_block_header *header);
+
+#endif // RHD2232_H
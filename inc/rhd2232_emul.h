@@ -0,0 +1,56 @@
+// rhd2232_emul.h
+
+#ifndef RHD2232_EMUL_H
+#define RHD2232_EMUL_H
+
+#include <stdint.h>
+#include <zephyr/drivers/emul.h>
+
+/**
+ * @brief SPI emulator for the RHD2232, used on native_sim in place of the chip.
+ *
+ * Models the 2-command result pipeline, register writes and their 0xFF echo, READ of the
+ * configuration and ROM registers ("INTAN" in 40-44, chip ID in 60-63), CLEAR, CALIBRATE
+ * (the next nine commands return 0) and CONVERT. Amplifier channels return configurable
+ * synthetic waveforms in simulated time, channels 32-34/48/49 return AUX inputs, supply
+ * voltage and the temperature sensor as the tempS bits of register 3 select it.
+ */
+
+// Emulated RHD2232 on the board devicetree
+#define RHD2232_EMUL EMUL_DT_GET(DT_NODELABEL(rhd2232))
+
+#define RHD2232_EMUL_AMP_CHANNELS 32
+
+enum rhd2232_emul_wave
+{
+    RHD2232_EMUL_WAVE_DC,     // offset only
+    RHD2232_EMUL_WAVE_SINE,   // offset + amplitude * sin(2 pi f t)
+    RHD2232_EMUL_WAVE_SQUARE, // offset +/- amplitude at f
+    RHD2232_EMUL_WAVE_RAMP,   // offset - amplitude .. offset + amplitude sawtooth at f
+    RHD2232_EMUL_WAVE_NOISE,  // offset + uniform noise in +/- amplitude, fixed seed so runs repeat
+};
+
+struct rhd2232_emul_channel
+{
+    enum rhd2232_emul_wave wave;
+    int16_t amplitude; // ADC counts (0.195 uV each)
+    int16_t offset;    // ADC counts
+    uint32_t freq_mhz; // Waveform frequency in mHz
+};
+
+struct rhd2232_emul_stats
+{
+    uint32_t commands;     // 16-bit words clocked in
+    uint32_t converts;     // CONVERT commands executed
+    uint32_t writes;       // Register writes accepted
+    uint32_t calibrations; // CALIBRATE commands
+};
+
+int rhd2232_emul_set_channel(const struct emul *target, uint8_t channel, const struct rhd2232_emul_channel *cfg);
+void rhd2232_emul_set_temperature(const struct emul *target, int32_t centi_c);
+void rhd2232_emul_set_supply(const struct emul *target, uint32_t supply_mv);
+void rhd2232_emul_set_aux(const struct emul *target, uint8_t input, uint16_t value);
+uint8_t rhd2232_emul_get_register(const struct emul *target, uint8_t reg);
+void rhd2232_emul_get_stats(const struct emul *target, struct rhd2232_emul_stats *stats);
+
+#endif // RHD2232_EMUL_H
@@ -0,0 +1,92 @@
+// rhd_frame.h
+
+#ifndef RHD_FRAME_H
+#define RHD_FRAME_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <zephyr/sys/byteorder.h>
+
+// Longest command table a single frame transfer can carry
+#define RHD_FRAME_MAX_WORDS 40
+// Most frames the hardware-timed stream collects before waking the CPU
+#define RHD_FRAME_MAX_BLOCK 16
+
+/**
+ * @brief Frame transfer: the whole RHD command table goes out as one SPIM ArrayList run.
+ *
+ * SPIM1 is driven at register level once the Zephyr SPI driver has configured it.
+ * Each list entry is one 16-bit word; CS is pulsed between words by GPIOTE through PPI,
+ * with TIMER2 providing the CS-high gap and TIMER3 counting words so the run stops
+ * after the last entry. The CPU only starts the run and waits for it to finish.
+ *
+ * In streaming mode TIMER4 starts every frame through PPI and the RX list pointer keeps
+ * advancing through a multi-frame buffer. TIMER1 counts finished frames and raises the
+ * only interrupt, once per block, when the RX buffers are swapped.
+ */
+
+// Called from the block interrupt with raw big-endian results, frames * command count words
+typedef void (*rhd_frame_block_cb_t)(const uint16_t *results, size_t frames);
+
+static inline uint16_t rhd_frame_result(const uint16_t *results, size_t index)
+{
+    return sys_be16_to_cpu(results[index]);
+}
+
+#if defined(CONFIG_SOC_FAMILY_NRF)
+
+// Allocate the TIMER, GPIOTE and PPI resources. Call once after the SPI bus is up.
+int rhd_frame_init(void);
+
+// Load a command table (host byte order). Must be called while disarmed.
+int rhd_frame_load(const uint16_t *commands, size_t count);
+
+// Hand SPIM1 and the CS pin to the frame engine / give them back to the Zephyr SPI driver.
+void rhd_frame_arm(void);
+void rhd_frame_disarm(void);
+
+// Replace one command of one block frame, e.g. to rotate auxiliary commands. Only safe while that
+// frame is off the bus: before rhd_frame_transfer() or from the block callback for the next block.
+void rhd_frame_set_word(size_t frame, size_t index, uint16_t command);
+
+// Run the loaded table once. Results are written in host byte order, one per command.
+int rhd_frame_transfer(uint16_t *results);
+
+// Start/stop hardware-timed acquisition of the loaded table at sample_rate_hz. The HFXO is held while
+// streaming and the period is dithered per block, so frame n starts n / sample_rate_hz after the first
+// to within one 16 MHz tick per frame of a block. first_frame_ns is the uptime the first frame starts
+// at, taken once the crystal runs and the sample clock is started.
+int rhd_frame_stream_start(uint32_t sample_rate_hz, size_t block_frames, rhd_frame_block_cb_t cb,
+                           int64_t *first_frame_ns);
+// Stop after the frame in flight, if any, has finished. Returns the frames of the unfinished block that
+// landed in the current RX buffer, after any block the last frame completed went to the callback.
+size_t rhd_frame_stream_stop(void);
+
+// RX buffer (block_frames * command count words) for a later block, so results are DMA'd straight into
+// a consumer's buffer. Buffers are chosen one block ahead, so the block interrupt can rewind the lists
+// before anything else: call twice before rhd_frame_stream_start(), for the first and second blocks, and
+// once from each block callback, for the block after the one that just started. NULL, or no call, takes
+// one of the engine's own buffers. rhd_frame_clear_rx() drops buffers handed in but not yet taken.
+void rhd_frame_set_rx(uint16_t *buffer);
+void rhd_frame_clear_rx(void);
+
+#else
+
+// No SPIM/PPI (e.g. native_sim): callers fall back to the per-word software path
+static inline int rhd_frame_init(void) { return -ENOTSUP; }
+static inline int rhd_frame_load(const uint16_t *commands, size_t count) { return -ENOTSUP; }
+static inline void rhd_frame_arm(void) {}
+static inline void rhd_frame_disarm(void) {}
+static inline void rhd_frame_set_word(size_t frame, size_t index, uint16_t command) {}
+static inline int rhd_frame_transfer(uint16_t *results) { return -ENOTSUP; }
+static inline int rhd_frame_stream_start(uint32_t sample_rate_hz, size_t block_frames, rhd_frame_block_cb_t cb,
+                                         int64_t *first_frame_ns) { return -ENOTSUP; }
+static inline size_t rhd_frame_stream_stop(void) { return 0; }
+static inline void rhd_frame_set_rx(uint16_t *buffer) {}
+static inline void rhd_frame_clear_rx(void) {}
+
+#endif // CONFIG_SOC_FAMILY_NRF
+
+#endif // RHD_FRAME_H
@@ -3,10 +3,16 @@
 
 #include <stddef.h>
 #include <zephyr/fs/fs.h>
+#include "../inc/neural_data.h"
 
 #define SD_CARD_THREAD_STACK_SIZE 32768
+#define SD_IO_THREAD_STACK_SIZE 4096
+// NeuralData structs per file write, the writer's FIFO high watermark
+#define SD_CARD_WRITE_SAMPLES 128
 extern struct k_thread sd_card_thread_data;
 extern k_thread_stack_t sd_card_stack[];
+extern struct k_thread sd_io_thread_data;
+extern k_thread_stack_t sd_io_stack[];
 
 /**
  * @brief	Print out the contents under SD card root path and write the content to buffer.
@@ -47,6 +53,52 @@ int sd_card_list_files(char const *const path, char *buf, size_t *buf_size);
  */
 int sd_card_open_write_close(char const *const filename, char const *const data, size_t *size);
 
+// Streaming writer latency, since boot
+struct sd_card_stream_stats
+{
+    uint32_t writes;
+    uint32_t write_last_us;
+    uint32_t write_max_us;
+    uint64_t write_total_us;
+    uint32_t sync_max_us;
+    uint32_t segments; // Segment files opened
+};
+
+/**
+ * @brief	Append samples to the session's open segment file.
+ *
+ * @note	Samples are packed into session file blocks (session_file.h) in staging buffers,
+ *		which sd_card_io_thread() seals and writes out while the caller fills the next one;
+ *		the call only waits for the card when every buffer is queued. A block ends early at
+ *		a gap in the sample index or a change of flags. Only one thread may call the
+ *		sd_card_stream functions.
+ *
+ * @note	The segment (data_N.bin in the session folder) is a session header followed by
+ *		blocks, and stays open between blocks. Blocks go into a preallocated segment, synced
+ *		at least every SD_SYNC_INTERVAL_MS. A new segment is started after SD_SEGMENT_MAX_MS,
+ *		once MAX_FILE_SIZE (32 MB, rounded down to whole blocks) is full, after a failed write
+ *		and when the sample index restarts, so its header shows the new acquisition config.
+ *		With a raw log (sd_raw.h) the header and blocks go there instead.
+ *
+ * @note	A segment is synced as soon as it is opened, so one cut off by a reset is found at
+ *		the next boot: sd_card_init() trims it after its last intact block in sequence and
+ *		notes that in recovered.txt in the session folder.
+ *
+ * @param[in]		samples		Samples to append, in FIFO order.
+ * @param[in]		count		Number of samples. All of them are taken; samples lost
+ *					to a failed block write are counted in DATA_STAT_SD_DROPPED.
+ *
+ * @retval	0 on success.
+ * @retval	-ENODEV SD init failed. SD card likely not inserted.
+ */
+int sd_card_stream_write(const NeuralData *samples, size_t count);
+
+// Queue the partly filled block, padded, and an fs_sync of the open segment
+int sd_card_stream_sync(void);
+// Queue the staged data and a close of the segment, the next write starts a new one
+int sd_card_stream_close(void);
+void sd_card_get_stream_stats(struct sd_card_stream_stats *stats);
+
 /**
  * @brief	Read data from file into the buffer.
  *
@@ -128,5 +180,7 @@ int sd_card_close(struct fs_file_t *f_seg_read_entry);
 int sd_card_init(void);
 
 void sd_card_writer_thread(void *arg1, void *arg2, void *arg3);
+// Seals and writes the blocks sd_card_writer_thread() fills
+void sd_card_io_thread(void *arg1, void *arg2, void *arg3);
 
 #endif /* _SD_CARD_H_ */
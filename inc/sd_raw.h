@@ -0,0 +1,94 @@
+// sd_raw.h
+
+#ifndef SD_RAW_H
+#define SD_RAW_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/toolchain.h>
+
+/**
+ * @brief Log-structured recording straight to a reserved SD region with disk_access_write().
+ *
+ * The region is an MBR partition of type SD_RAW_PARTITION_TYPE, which has to be created for it
+ * (fdisk type da), see sd_card_init(). Cards without one record to files. FatFs never touches it, so
+ * there are no FAT or directory updates on the hot path. Layout in 512 byte sectors from
+ * the region start, all fields little-endian:
+ *
+ *   0                            superblock, rewritten once per session
+ *   1 .. SD_RAW_META_SECTORS-1   checkpoint ring, one checkpoint per sector
+ *   SD_RAW_META_SECTORS ..       data blocks of SD_RAW_BLOCK_SECTORS, used circularly
+ *
+ * Data blocks carry a sequence number that runs on across sessions, and block n of the sequence
+ * always lands in slot n % block count. A CRC32 covers each block, the superblock and each
+ * checkpoint. At boot the end of the log is the newest checkpoint plus a short forward scan for
+ * blocks that still carry the expected sequence number; the new session starts there and
+ * overwrites the oldest blocks once the region wraps.
+ *
+ * The log carries bytes, not samples: each session is one byte stream, normally a session file
+ * (see session_file.h) split over as many data blocks as it takes. scripts/raw_extract.py turns a
+ * dump of the region back into one session file per session.
+ */
+#define SD_RAW_SECTOR_SIZE 512
+// MBR partition type of the region, "Non-FS data"
+#define SD_RAW_PARTITION_TYPE 0xDA
+#define SD_RAW_BLOCK_SECTORS 16
+#define SD_RAW_META_SECTORS SD_RAW_BLOCK_SECTORS
+#define SD_RAW_CHECKPOINT_SLOTS (SD_RAW_META_SECTORS - 1)
+// Data blocks between checkpoints, bounds the boot-time scan
+#define SD_RAW_CHECKPOINT_INTERVAL 64
+// Smallest usable region: metadata plus this many data blocks
+#define SD_RAW_MIN_BLOCKS 256
+
+#define SD_RAW_VERSION 2
+#define SD_RAW_MAGIC_SUPER 0x5357524D      // "MRWS"
+#define SD_RAW_MAGIC_CHECKPOINT 0x4357524D // "MRWC"
+#define SD_RAW_MAGIC_BLOCK 0x4257524D      // "MRWB"
+
+struct sd_raw_superblock
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t sector_size;
+    uint32_t region_sectors; // Metadata included
+    uint16_t block_sectors;
+    uint16_t reserved;
+    uint32_t session;        // Latest session started, 1 for the first
+    uint32_t crc;            // CRC32 of the fields above
+} __packed;
+
+struct sd_raw_checkpoint
+{
+    uint32_t magic;
+    uint32_t session;
+    uint32_t sequence; // Next block to be written
+    uint32_t crc;      // CRC32 of the fields above
+} __packed;
+
+struct sd_raw_block_header
+{
+    uint32_t magic;
+    uint32_t session;
+    uint32_t sequence;     // Blocks written since the region was formatted
+    uint32_t offset;       // Bytes the session logged before this block
+    uint16_t count;        // Bytes in this block, the rest of it is zero padding
+    uint16_t reserved;
+    uint32_t crc;          // CRC32 of this header with crc = 0, then the count bytes
+} __packed;
+
+// Open the log on a region of disk, starting a new session after the last block found
+int sd_raw_init(const char *disk, uint32_t first_sector, uint32_t sector_count);
+bool sd_raw_active(void);
+// Session started by sd_raw_init(), what goes in its session file header
+uint32_t sd_raw_session(void);
+// Append to the session's byte stream. Returns the number of blocks written out, one card write each,
+// or -ENODEV. A block whose write fails is lost, its slot is reused by the next block and the stream
+// skips its bytes: *lost is set to the bytes of data in lost blocks, *lost_buffered to the bytes of
+// earlier calls that were waiting in them.
+int sd_raw_write(const char *data, size_t size, size_t *lost, size_t *lost_buffered);
+// Write out a partly filled block and a checkpoint, then flush the card's cache. *lost is set to the
+// bytes of the partly filled block if its write failed.
+int sd_raw_flush(size_t *lost);
+
+#endif // SD_RAW_H
@@ -0,0 +1,103 @@
+// session_file.h
+
+#ifndef SESSION_FILE_H
+#define SESSION_FILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/toolchain.h>
+#include "../inc/neural_data.h"
+#include "../inc/intan.h"
+
+/**
+ * @brief Recording format shared by the SD card segments, the raw log and BLE notifications.
+ *
+ * Samples are stored as records of channel_data only. Timestamp, flags and sample index move into
+ * a header in front of each run of records, and a run only ever holds consecutive sample indices
+ * with the same flags, so record i of a run is sample first_index + i.
+ *
+ * A session file (each data_N.bin, or the session stream of the raw log) is a session header
+ * padded to SESSION_HEADER_SIZE, then blocks of exactly SESSION_BLOCK_SIZE bytes: a block header,
+ * count records, zero padding. Each block carries a CRC32 and a sequence number that runs on
+ * across the segments of a session, so a reader checks integrity and finds gaps block by block
+ * without touching the samples. All fields are little-endian. scripts/session_file.py reads it.
+ *
+ * A BLE notification is a packet header followed by count records, no padding; the link layer
+ * checks integrity.
+ */
+#define SESSION_HEADER_SIZE 512
+#define SESSION_BLOCK_SIZE 8192
+#define SESSION_RECORD_SIZE sizeof(((NeuralData *)0)->channel_data)
+#define SESSION_BLOCK_RECORDS ((SESSION_BLOCK_SIZE - sizeof(struct session_block_header)) / SESSION_RECORD_SIZE)
+#define SESSION_MAX_CHIPS 8
+
+#define SESSION_FILE_VERSION 1
+#define SESSION_MAGIC_HEADER 0x48534D4D // "MMSH"
+#define SESSION_MAGIC_BLOCK 0x424D4D4D  // "MMMB"
+
+struct session_file_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;   // SESSION_HEADER_SIZE, the first block starts here
+    char firmware[32];      // Application version, NUL padded
+    uint32_t session;       // f_session_N folder or raw log session
+    uint32_t segment;       // data_N.bin number, 0 in the raw log
+    uint32_t block_size;    // SESSION_BLOCK_SIZE
+    uint32_t sample_rate_hz;
+    uint64_t channel_mask;  // Enabled channels, bit n is channel_data[n]
+    uint16_t channels;      // channel_data entries per record, MAX_CHANNELS
+    uint16_t record_size;   // SESSION_RECORD_SIZE
+    uint8_t chips;          // RHD chips, registers[] entries in use
+    uint8_t register_count; // INTAN_REGISTER_COUNT
+    uint16_t reserved;
+    int64_t start_ns;       // Uptime of sample index 0, see intan_sample_time_ns()
+    int64_t uptime_ms;      // Uptime when the header was written
+    uint8_t registers[SESSION_MAX_CHIPS][INTAN_REGISTER_COUNT]; // Per chip, from intan_get_registers()
+    uint32_t crc;           // CRC32 of the fields above
+} __packed;
+
+struct session_block_header
+{
+    uint32_t magic;
+    uint32_t sequence;    // Blocks of the session before this one
+    uint32_t first_index; // NeuralData.index of the first record
+    uint32_t timestamp;   // NeuralData.timestamp of the first record, ms
+    uint16_t count;       // Records in the block
+    uint16_t flags;       // NeuralData.flags of every record
+    uint32_t crc;         // CRC32 of this header with crc = 0, then the whole rest of the block
+} __packed;
+
+struct session_packet_header
+{
+    uint32_t first_index;
+    uint32_t timestamp;
+    uint16_t count;
+    uint16_t flags;
+} __packed;
+
+BUILD_ASSERT(sizeof(struct session_file_header) <= SESSION_HEADER_SIZE, "Session header must fit its sector");
+BUILD_ASSERT(RHD_CHIP_COUNT <= SESSION_MAX_CHIPS, "Session header holds the registers of SESSION_MAX_CHIPS chips");
+BUILD_ASSERT(SESSION_BLOCK_RECORDS > 0 && SESSION_BLOCK_RECORDS <= UINT16_MAX, "Block must hold records");
+
+// Fill in the header of a new session file from the current acquisition config, crc included
+void session_file_header_init(struct session_file_header *header, uint32_t session, uint32_t segment);
+
+// Leading samples that can share one block or packet header: consecutive indices, equal flags
+size_t session_run_length(const NeuralData *samples, size_t count);
+// Whether sample continues a run whose last record was previous
+bool session_run_continues(const NeuralData *previous, const NeuralData *sample);
+// Copy the records of count samples to dst, SESSION_RECORD_SIZE bytes each
+void session_copy_records(uint8_t *dst, const NeuralData *samples, size_t count);
+
+// Zero the unused end of a block and set its CRC
+void session_block_seal(uint8_t *block);
+
+// Whether a header read back from a session file is one of this version with a matching CRC
+bool session_file_header_valid(const struct session_file_header *header);
+// Whether a block read back from a session file is sealed and intact. Its crc field is zeroed for
+// the check and restored.
+bool session_block_valid(uint8_t *block);
+
+#endif // SESSION_FILE_H
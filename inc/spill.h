@@ -0,0 +1,37 @@
+// spill.h
+
+#ifndef SPILL_H
+#define SPILL_H
+
+#include <stddef.h>
+#include <zephyr/kernel.h>
+#include "../inc/fifo_buffer.h"
+
+#define SPILL_THREAD_STACK_SIZE 4096
+
+extern struct k_thread spill_thread_data;
+extern k_thread_stack_t spill_stack[];
+
+/**
+ * @brief Overflow tier between the FIFO and the SD writer, a circular log on the spill_partition flash area.
+ *
+ * When the SD writer stalls and the samples it holds in the ring pass a high watermark, the spill
+ * thread copies whole sectors of them, oldest first, to flash and hands their ring slots back to
+ * the producer. The SD writer reads through spill_read()/spill_release(), which return the ring
+ * samples before the log, then the logged samples, then the ring again, so files keep sample order.
+ * Freed sectors are erased in the background ahead of the log.
+ *
+ * Without a spill_partition in the devicetree, or if spill_init() fails, the calls fall through to
+ * the FIFO.
+ */
+int spill_init(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer);
+// arg1: the FIFO, arg2: the SD writer's consumer
+void spill_thread(void *arg1, void *arg2, void *arg3);
+
+// SD writer side: the next samples in order (at most max) in *span, then hand back the first n.
+// Logged samples come in a staging buffer, valid until spill_release(). Logged samples that cannot be
+// read back are skipped and counted as SD drops, that call returns 0.
+size_t spill_read(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, size_t max, fifo_read_span_t *span);
+void spill_release(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, size_t n);
+
+#endif // SPILL_H
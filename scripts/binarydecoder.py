@@ -1,12 +1,14 @@
-import struct
 import csv
 import os
 import argparse
 import glob
 import numpy as np
+from session_file import read_session_file
 
-# Constants from neural_data.h
-MAX_CHANNELS = 16
+# Constants from neural_data.h, the file format is in session_file.py
+MAX_CHANNELS = 32  # 32 per RHD chip on the bus, only used for files without a session header
+FLAG_RECONFIG = 0x1     # NEURAL_DATA_FLAG_RECONFIG
+FLAG_CALIBRATING = 0x2  # NEURAL_DATA_FLAG_CALIBRATING
 ADC_SCALE_FACTOR = 0.195  # typical scale factor RHD2000 in µV/bit
 
 def decode_binary_files(input_folder, output_file):
@@ -14,46 +16,44 @@ def decode_binary_files(input_folder, output_file):
         csv_writer = csv.writer(csv_file)
         
         # Write CSV header
-        header = ['timestamp'] + [f'ch{i+1}' for i in range(MAX_CHANNELS)]
+        header = ['timestamp'] + [f'ch{i+1}' for i in range(MAX_CHANNELS)] + ['flags']
         csv_writer.writerow(header)
         
         # Get all data_xx.bin files in the input folder, sorted numerically
         bin_files = sorted(glob.glob(os.path.join(input_folder, 'data_*.bin')),
                            key=lambda x: int(x.split('_')[-1].split('.')[0]))
-        
+
+        # Written at boot when the firmware trimmed a segment left open by a reset
+        marker = os.path.join(input_folder, 'recovered.txt')
+        if os.path.exists(marker):
+            with open(marker) as f:
+                print(f"Session was recovered after a reset:\n{f.read().rstrip()}")
+
         for bin_file_path in bin_files:
             print(f"Processing {bin_file_path}")
-            with open(bin_file_path, 'rb') as bin_file:
-                # Read and decode binary data
-                while True:
-                    # Read one NeuralData struct (36 bytes: 32 bytes for channel data + 4 bytes for timestamp)
-                    binary_data = bin_file.read(36)
-                    if not binary_data:
-                        break  # End of file
-                    
-                    if len(binary_data) != 36:
-                        print(f"Warning: Incomplete data at the end of {bin_file_path}. Expected 36 bytes, got {len(binary_data)}.")
-                        break
-                    
-                    # Unpack the binary data
-                    channel_data = struct.unpack('<16h', binary_data[:32])  # 16 signed shorts (16-bit), little-endian
-                    timestamp = struct.unpack('<I', binary_data[32:])[0]  # 32-bit unsigned int, little-endian
-                    
-                    # Convert two's complement to signed integers and apply scaling factor
-                    channel_data = [value * ADC_SCALE_FACTOR for value in channel_data]
-                    
-                    # Prepare row data
-                    row = [timestamp] + channel_data
-                    
-                    # Write to CSV
-                    csv_writer.writerow(row)
+            # Session files are checked block by block and timed from the sample index, older files
+            # are bare NeuralData arrays with a millisecond timestamp per sample
+            for sample in read_session_file(bin_file_path, MAX_CHANNELS):
+                # Two's complement values, apply the scaling factor
+                channel_data = [value * ADC_SCALE_FACTOR for value in sample.channels]
+
+                # Prepare row data, timestamp in ms
+                row = [round(sample.time_s * 1000, 3)] + channel_data + [sample.flags]
+
+                # Write to CSV
+                csv_writer.writerow(row)
 
 def main():
     parser = argparse.ArgumentParser(description='Convert multiple binary neural data files to a single CSV.')
     parser.add_argument('input_folder', help='Path to the folder containing input binary files')
     parser.add_argument('output_file', help='Path to the output CSV file')
+    parser.add_argument('--chips', type=int, default=1,
+                        help='RHD chips the firmware was built for (32 channels each), session files record it')
     args = parser.parse_args()
 
+    global MAX_CHANNELS
+    MAX_CHANNELS = 32 * args.chips
+
     if not os.path.exists(args.input_folder):
         print(f"Error: Input folder '{args.input_folder}' does not exist.")
         return
@@ -9,10 +9,11 @@ from datetime import datetime
 import pandas as pd
 import matplotlib.pyplot as plt
 import logging
+from session_file import read_session_file, decode_ble_packets
 from multiprocessing import Pool, cpu_count
 
 # Constants
-MAX_CHANNELS = 16
+MAX_CHANNELS = 32  # 32 per RHD chip on the bus, see neural_data.h; formats in session_file.py
 ADC_SCALE_FACTOR = 0.195  # typical scale factor RHD2000 in µV/bit
 SNIPPET_DURATION = 5  # seconds
 
@@ -53,22 +54,12 @@ def decode_binary_files(input_folder, output_file):
 
         for bin_file_path in bin_files:
             logging.info(f"Processing {bin_file_path}")
-            with open(bin_file_path, 'rb') as bin_file:
-                while True:
-                    binary_data = bin_file.read(36)
-                    if not binary_data or len(binary_data) != 36:
-                        break
+            # Session files are timed from the sample index, older files by their millisecond timestamps
+            for sample in read_session_file(bin_file_path, MAX_CHANNELS):
+                channel_data = [value * ADC_SCALE_FACTOR for value in sample.channels]
 
-                    channel_data = struct.unpack('<16h', binary_data[:32])
-                    timestamp = struct.unpack('<I', binary_data[32:])[0]
-
-                    # Assuming timestamp is in milliseconds; convert to seconds
-                    timestamp_seconds = timestamp / 1000.0
-
-                    channel_data = [value * ADC_SCALE_FACTOR for value in channel_data]
-
-                    row = [timestamp_seconds] + channel_data
-                    all_rows.append(row)
+                row = [sample.time_s] + channel_data
+                all_rows.append(row)
 
         if not all_rows:
             logging.warning(f"No data found in binary files within {input_folder}. Creating failed CSV.")
@@ -104,6 +95,7 @@ def decode_ble_log(input_file, output_file):
     """
     try:
         all_rows = []
+        payloads = []
         with open(input_file, 'r') as infile:
             pattern = r'(\d{4}-\d{2}-\d{2}T\d{2}:\d{2}:\d{2}\.\d{3}Z).*handle: 0x12, value \(0x\): (.*)'
 
@@ -119,23 +111,15 @@ def decode_ble_log(input_file, output_file):
                     data_clean = data.replace('-', '')
 
                     # Convert hex string to bytes
-                    data_bytes = bytes.fromhex(data_clean)
-
-                    if len(data_bytes) < 36:
-                        logging.warning(f"Incomplete data packet in {input_file}: {data}")
-                        continue
-
-                    # Unpack 16 signed short integers (2 bytes each)
-                    channel_data = struct.unpack('<16h', data_bytes[:32])
-
-                    # Convert to microvolts and apply scaling factor
-                    channel_data = [value * ADC_SCALE_FACTOR for value in channel_data]
+                    payloads.append(bytes.fromhex(data_clean))
 
-                    # Extract timestamp from the last 4 bytes (binary timestamp)
-                    ble_timestamp = struct.unpack('<I', data_bytes[32:])[0]
+        # A notification carries a packet header and records, or whole NeuralData samples from older firmware
+        for sample in decode_ble_packets(payloads, MAX_CHANNELS):
+            # Convert to microvolts and apply scaling factor
+            channel_data = [value * ADC_SCALE_FACTOR for value in sample.channels]
 
-                    row = [ble_timestamp] + channel_data
-                    all_rows.append(row)
+            row = [sample.time_s] + channel_data
+            all_rows.append(row)
 
         if not all_rows:
             logging.warning(f"No data found in BLE log file {input_file}. Creating failed CSV.")
@@ -9,10 +9,11 @@ from datetime import datetime
 import pandas as pd
 import matplotlib.pyplot as plt
 import logging
+from session_file import read_session_file, decode_ble_packets
 from multiprocessing import Pool, cpu_count
 
 # Constants
-MAX_CHANNELS = 16
+MAX_CHANNELS = 32  # 32 per RHD chip on the bus, see neural_data.h; formats in session_file.py
 ADC_SCALE_FACTOR = 0.195  # Typical scale factor RHD2000 in µV/bit
 SNIPPET_DURATION = 10  # seconds (updated from 5)
 MAX_ALLOWED_PACKET_LOSS = 100  # updated from 10
@@ -79,17 +80,14 @@ def decode_binary_files(input_folder, output_file):
 
         for bin_file_path in bin_files:
             logging.info(f"Processing {bin_file_path}")
-            with open(bin_file_path, 'rb') as bin_file:
-                file_rows = 0
-                while True:
-                    binary_data = bin_file.read(36)
-                    if not binary_data or len(binary_data) != 36:
-                        break
-
-                    channel_data = struct.unpack('<16h', binary_data[:32])
-                    timestamp = struct.unpack('<I', binary_data[32:])[0]  # Milliseconds
-
-                    # If current timestamp is less than last, assume timestamp reset
+            file_rows = 0
+            for sample in read_session_file(bin_file_path, MAX_CHANNELS):
+                if sample.index is not None:
+                    # Session file: timed from the sample index and the session header, no resets to guess
+                    timestamp_seconds = sample.time_s
+                else:
+                    # Bare NeuralData: if current timestamp is less than last, assume timestamp reset
+                    timestamp = round(sample.time_s * 1000)  # Milliseconds
                     if timestamp < last_timestamp_ms:
                         base_timestamp_ms += last_timestamp_ms
 
@@ -97,15 +95,15 @@ def decode_binary_files(input_folder, output_file):
                     timestamp_seconds = timestamp_total_ms / 1000.0
                     last_timestamp_ms = timestamp_total_ms
 
-                    channel_data = [value * ADC_SCALE_FACTOR for value in channel_data]
+                channel_data = [value * ADC_SCALE_FACTOR for value in sample.channels]
 
-                    row = [timestamp_seconds] + channel_data
-                    all_rows.append(row)
-                    file_rows += 1
+                row = [timestamp_seconds] + channel_data
+                all_rows.append(row)
+                file_rows += 1
 
-                    # Collect first few timestamps for logging
-                    if len(first_timestamps) < 10:
-                        first_timestamps.append(timestamp_seconds)
+                # Collect first few timestamps for logging
+                if len(first_timestamps) < 10:
+                    first_timestamps.append(timestamp_seconds)
 
             logging.info(f"Processed {file_rows} rows from {bin_file_path}")
 
@@ -171,6 +169,7 @@ def decode_ble_log(input_file, output_file):
     """
     try:
         all_rows = []
+        payloads = []
 
         with open(input_file, 'r') as infile:
             # Initialize CSV writer
@@ -196,26 +195,16 @@ def decode_ble_log(input_file, output_file):
                         data_clean = data.replace('-', '')
 
                         # Convert hex string to bytes
-                        data_bytes = bytes.fromhex(data_clean)
-
-                        # Ensure we have exactly 36 bytes (32 for channels + 4 for timestamp)
-                        if len(data_bytes) != 36:
-                            logging.warning(f"Invalid data length: {len(data_bytes)} in line: {line.strip()}")
-                            continue
-
-                        # Unpack 16 signed short integers (each is 2 bytes) from the first 32 bytes
-                        channel_data = struct.unpack('<16h', data_bytes[:32])
-
-                        # Apply scaling factor to convert to µV
-                        channel_data = [value * ADC_SCALE_FACTOR for value in channel_data]
+                        payloads.append(bytes.fromhex(data_clean))
 
-                        # Extract the actual timestamp from the last 4 bytes of the data
-                        ble_timestamp = struct.unpack('<I', data_bytes[32:])[0]
-                        ble_timestamp_seconds = ble_timestamp / 1000.0  # Convert to seconds
+        # A notification carries a packet header and records, or whole NeuralData samples from older firmware
+        for sample in decode_ble_packets(payloads, MAX_CHANNELS):
+            # Apply scaling factor to convert to µV
+            channel_data = [value * ADC_SCALE_FACTOR for value in sample.channels]
 
-                        # Create the row with the timestamp and channel data
-                        row = [ble_timestamp_seconds] + channel_data
-                        all_rows.append(row)
+            # Create the row with the timestamp (seconds) and channel data
+            row = [sample.time_s] + channel_data
+            all_rows.append(row)
 
         if not all_rows:
             logging.warning(f"No data found in BLE log file {input_file}. Creating failed CSV.")
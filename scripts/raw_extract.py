@@ -0,0 +1,125 @@
+import struct
+import os
+import argparse
+import zlib
+import itertools
+
+# Raw SD log format, see inc/sd_raw.h
+SECTOR_SIZE = 512
+REGION_ALIGN_SECTORS = 16  # SD_RAW_BLOCK_SECTORS
+MAGIC_SUPER = 0x5357524D       # "MRWS"
+MAGIC_CHECKPOINT = 0x4357524D  # "MRWC"
+MAGIC_BLOCK = 0x4257524D       # "MRWB"
+VERSION = 2
+SUPERBLOCK = struct.Struct('<IHHIHHII')   # magic, version, sector_size, region_sectors, block_sectors, reserved, session, crc
+BLOCK_HEADER = struct.Struct('<IIIIHHI')  # magic, session, sequence, offset, count, reserved, crc
+
+
+def find_superblock(image, offset_sectors):
+    """Return (offset_sectors, superblock fields). Without an offset, every 16th sector is tried,
+    the firmware starts the region on a block boundary."""
+    sectors = [offset_sectors] if offset_sectors is not None else itertools.count(0, REGION_ALIGN_SECTORS)
+    for sector in sectors:
+        image.seek(sector * SECTOR_SIZE)
+        data = image.read(SECTOR_SIZE)
+        if len(data) < SUPERBLOCK.size:
+            break
+        fields = SUPERBLOCK.unpack_from(data)
+        if fields[0] == MAGIC_SUPER and zlib.crc32(data[:SUPERBLOCK.size - 4]) == fields[7]:
+            return sector, fields
+    return None, None
+
+
+def read_blocks(image, region_start, region_sectors, block_sectors):
+    """Yield (session, sequence, offset, payload) for every block whose CRC checks out."""
+    block_size = block_sectors * SECTOR_SIZE
+    meta_sectors = block_sectors
+    block_count = (region_sectors - meta_sectors) // block_sectors
+    bad = 0
+    for slot in range(block_count):
+        image.seek((region_start + meta_sectors + slot * block_sectors) * SECTOR_SIZE)
+        data = image.read(block_size)
+        if len(data) < BLOCK_HEADER.size:
+            break
+        magic, session, sequence, offset, count, reserved, crc = BLOCK_HEADER.unpack_from(data)
+        if magic != MAGIC_BLOCK:
+            continue
+        payload = data[BLOCK_HEADER.size:BLOCK_HEADER.size + count]
+        header = BLOCK_HEADER.pack(magic, session, sequence, offset, count, reserved, 0)
+        if len(payload) != count or zlib.crc32(payload, zlib.crc32(header)) != crc:
+            bad += 1
+            continue
+        if sequence % block_count != slot:
+            bad += 1
+            continue
+        yield session, sequence, offset, payload
+    if bad:
+        print(f"Warning: {bad} blocks failed their CRC or sit in the wrong slot (torn or stale writes)")
+
+
+def extract(image_path, output_folder, offset_sectors):
+    with open(image_path, 'rb') as image:
+        region_start, super_fields = find_superblock(image, offset_sectors)
+        if super_fields is None:
+            print("Error: no raw log superblock found")
+            return
+        _, version, sector_size, region_sectors, block_sectors, _, last_session, _ = super_fields
+        print(f"Raw log at sector {region_start}: version {version}, {region_sectors} sectors, "
+              f"{block_sectors} sectors per block, last session {last_session}")
+        if version != VERSION:
+            print(f"Error: unsupported raw log version {version}")
+            return
+        if sector_size != SECTOR_SIZE:
+            print(f"Error: unsupported sector size {sector_size}")
+            return
+
+        sessions = {}
+        for session, sequence, offset, payload in read_blocks(image, region_start, region_sectors, block_sectors):
+            sessions.setdefault(session, []).append((sequence, offset, payload))
+
+    for session in sorted(sessions):
+        blocks = sorted(sessions[session])
+        folder = os.path.join(output_folder, f"f_raw_session_{session}")
+        os.makedirs(folder, exist_ok=True)
+
+        # The session's byte stream is a session file (scripts/session_file.py reads it). Gaps from failed
+        # writes are zero filled so its blocks stay at their offsets, the reader skips blank sectors.
+        start = blocks[0][1]
+        if start != 0:
+            # The region wrapped over the start of the session and its header; the file starts on a
+            # sector boundary so its blocks stay aligned
+            print(f"Warning: session {session} starts at byte {start}, its session header was overwritten")
+        start -= start % SECTOR_SIZE
+        stream = bytearray()
+        missing = 0
+        for sequence, offset, payload in blocks:
+            if offset > start + len(stream):
+                missing += offset - start - len(stream)
+                stream += bytes(offset - start - len(stream))
+            stream += payload
+
+        with open(os.path.join(folder, "data_0.bin"), 'wb') as out:
+            out.write(stream)
+        print(f"Session {session}: {len(blocks)} blocks, {len(stream)} bytes from byte {start}, "
+              f"{missing} missing -> {folder}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Extract recording sessions from a raw SD log region into session files.')
+    parser.add_argument('image', help='Card device or image file (e.g. dd if=/dev/sdX of=card.img)')
+    parser.add_argument('output_folder', help='Folder for the f_raw_session_N folders')
+    parser.add_argument('--offset', type=int, default=None,
+                        help='First sector of the raw region, logged at boot; scanned for when omitted')
+    args = parser.parse_args()
+
+    if not os.path.exists(args.image):
+        print(f"Error: Image '{args.image}' does not exist.")
+        return
+
+    os.makedirs(args.output_folder, exist_ok=True)
+    extract(args.image, args.output_folder, args.offset)
+    print("Extraction complete.")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,166 @@
+import struct
+import zlib
+import logging
+from collections import namedtuple
+
+# Recording format of inc/session_file.h: a session header, then fixed-size blocks of records
+# (channel data only) behind a block header with sequence number, first sample index, timestamp,
+# flags and CRC32. BLE notifications carry a packet header and records. Older firmware wrote bare
+# arrays of NeuralData (channel data, 4 bytes timestamp, 4 bytes flags), still read here.
+SECTOR_SIZE = 512
+MAGIC_HEADER = 0x48534D4D  # "MMSH"
+MAGIC_BLOCK = 0x424D4D4D   # "MMMB"
+FILE_HEADER = struct.Struct('<IHH32sIIIIQHHBBHqq')  # up to the register snapshot
+REGISTER_COUNT = 18  # INTAN_REGISTER_COUNT
+MAX_CHIPS = 8        # SESSION_MAX_CHIPS
+FILE_HEADER_SIZE = FILE_HEADER.size + MAX_CHIPS * REGISTER_COUNT + 4  # crc last
+BLOCK_HEADER = struct.Struct('<IIIIHHI')  # magic, sequence, first_index, timestamp, count, flags, crc
+PACKET_HEADER = struct.Struct('<IIHH')    # first_index, timestamp, count, flags
+FLAG_RECONFIG = 0x1     # NEURAL_DATA_FLAG_RECONFIG
+FLAG_CALIBRATING = 0x2  # NEURAL_DATA_FLAG_CALIBRATING
+
+# time_s is seconds of device uptime for session files, NeuralData.timestamp / 1000 otherwise;
+# index is None for legacy data
+Sample = namedtuple('Sample', ['time_s', 'index', 'flags', 'channels'])
+
+
+def legacy_sample_size(max_channels):
+    return 2 * max_channels + 8
+
+
+def parse_header(data):
+    """Session header fields as a dict, or None if data does not start with a valid one."""
+    if len(data) < FILE_HEADER_SIZE:
+        return None
+    fields = FILE_HEADER.unpack_from(data)
+    crc, = struct.unpack_from('<I', data, FILE_HEADER_SIZE - 4)
+    if fields[0] != MAGIC_HEADER or zlib.crc32(data[:FILE_HEADER_SIZE - 4]) != crc:
+        return None
+    (_, version, header_size, firmware, session, segment, block_size, sample_rate_hz, channel_mask,
+     channels, record_size, chips, register_count, _, start_ns, uptime_ms) = fields
+    registers = []
+    for chip in range(min(chips, MAX_CHIPS)):
+        offset = FILE_HEADER.size + chip * REGISTER_COUNT
+        registers.append(list(data[offset:offset + min(register_count, REGISTER_COUNT)]))
+    return {
+        'version': version, 'header_size': header_size, 'firmware': firmware.rstrip(b'\0').decode(errors='replace'),
+        'session': session, 'segment': segment, 'block_size': block_size, 'sample_rate_hz': sample_rate_hz,
+        'channel_mask': channel_mask, 'channels': channels, 'record_size': record_size, 'chips': chips,
+        'start_ns': start_ns, 'uptime_ms': uptime_ms, 'registers': registers,
+    }
+
+
+def read_blocks(data, header):
+    """Yield (header, block) pairs for every block after the session header whose CRC checks out, block
+    being (sequence, first_index, timestamp, flags, count, records). A raw log extract may hold later
+    session headers, each applies to the blocks after it. Blank or damaged sectors are skipped a sector
+    at a time, so reading picks up again after a gap."""
+    bad = 0
+    offset = header['header_size']
+    while offset + BLOCK_HEADER.size <= len(data):
+        magic, sequence, first_index, timestamp, count, flags, crc = BLOCK_HEADER.unpack_from(data, offset)
+        if magic == MAGIC_HEADER:
+            later = parse_header(data[offset:offset + SECTOR_SIZE])
+            if later is not None:
+                header = later
+                offset += header['header_size']
+                continue
+        if magic != MAGIC_BLOCK:
+            offset += SECTOR_SIZE
+            continue
+        block_size = header['block_size']
+        block = bytearray(data[offset:offset + block_size])
+        block[20:24] = b'\0\0\0\0'
+        if len(block) != block_size or zlib.crc32(block) != crc:
+            bad += 1
+            offset += SECTOR_SIZE
+            continue
+        yield header, (sequence, first_index, timestamp, flags, count, data[offset + BLOCK_HEADER.size:offset + block_size])
+        offset += block_size
+    if bad:
+        logging.warning(f"{bad} blocks failed their CRC")
+
+
+def read_session_file(path, max_channels=32):
+    """Samples of one data_N.bin (or raw log extract) in file order. Session files are checked block by
+    block, gaps in the sequence number or sample index are logged; other files are read as bare
+    NeuralData arrays of max_channels channels."""
+    with open(path, 'rb') as f:
+        data = f.read()
+
+    header = parse_header(data)
+    samples = []
+    if header is None:
+        size = legacy_sample_size(max_channels)
+        for offset in range(0, len(data) - size + 1, size):
+            channels = struct.unpack_from(f'<{max_channels}h', data, offset)
+            timestamp, flags = struct.unpack_from('<II', data, offset + 2 * max_channels)
+            samples.append(Sample(timestamp / 1000.0, None, flags, channels))
+        if len(data) % size:
+            logging.warning(f"Incomplete data at the end of {path}, {len(data) % size} bytes left over")
+        return samples
+
+    logging.info(f"{path}: session {header['session']} segment {header['segment']}, firmware {header['firmware']}, "
+                 f"{header['sample_rate_hz']} Hz, mask 0x{header['channel_mask']:x}")
+    current = header
+    next_sequence = next_index = None
+    blocks = 0
+    for header, (sequence, first_index, timestamp, flags, count, records) in read_blocks(data, header):
+        if header is not current:
+            # New config, the sample index restarted
+            logging.info(f"{path}: {header['sample_rate_hz']} Hz, mask 0x{header['channel_mask']:x} from here")
+            current = header
+            next_index = None
+        if next_sequence is not None and sequence != next_sequence:
+            logging.warning(f"{path}: blocks {next_sequence}-{sequence - 1} missing")
+        if next_index is not None and first_index > next_index:
+            logging.warning(f"{path}: samples {next_index}-{first_index - 1} missing")
+        period_ns = 1e9 / header['sample_rate_hz']
+        for i in range(count):
+            values = struct.unpack_from(f'<{header["channels"]}h', records, i * header['record_size'])
+            time_s = (header['start_ns'] + (first_index + i) * period_ns) / 1e9
+            samples.append(Sample(time_s, first_index + i, flags, values))
+        next_sequence = sequence + 1
+        next_index = first_index + count
+        blocks += 1
+    logging.info(f"{path}: {blocks} blocks, {len(samples)} samples")
+    return samples
+
+
+def decode_ble_packets(payloads, max_channels=32):
+    """Samples of a list of neural data notifications. Each is a packet header and records, or from older
+    firmware whole NeuralData structs. Packets only carry the first sample's millisecond timestamp, the
+    others are placed at the sample period measured between packets."""
+    record = 2 * max_channels
+    legacy = legacy_sample_size(max_channels)
+    packets = []
+    samples = []
+    for payload in payloads:
+        if len(payload) >= PACKET_HEADER.size and (len(payload) - PACKET_HEADER.size) % record == 0:
+            first_index, timestamp, count, flags = PACKET_HEADER.unpack_from(payload)
+            if count * record + PACKET_HEADER.size == len(payload):
+                packets.append((first_index, timestamp, flags, payload[PACKET_HEADER.size:]))
+                continue
+        if len(payload) >= legacy and len(payload) % legacy == 0:
+            for offset in range(0, len(payload), legacy):
+                channels = struct.unpack_from(f'<{max_channels}h', payload, offset)
+                timestamp, flags = struct.unpack_from('<II', payload, offset + record)
+                samples.append(Sample(timestamp / 1000.0, None, flags, channels))
+            continue
+        logging.warning(f"Invalid neural data packet of {len(payload)} bytes")
+
+    # Sample period from the first and last packet of each run of increasing indices
+    runs = []
+    for packet in packets:
+        if runs and packet[0] > runs[-1][-1][0]:
+            runs[-1].append(packet)
+        else:
+            runs.append([packet])
+    for run in runs:
+        first, last = run[0], run[-1]
+        period_ms = (last[1] - first[1]) / (last[0] - first[0]) if last[0] > first[0] else 0.0
+        for first_index, timestamp, flags, records in run:
+            for i in range(len(records) // record):
+                channels = struct.unpack_from(f'<{max_channels}h', records, i * record)
+                samples.append(Sample((timestamp + i * period_ms) / 1000.0, first_index + i, flags, channels))
+    return samples
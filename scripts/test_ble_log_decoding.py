@@ -3,9 +3,10 @@ import csv
 import re
 from datetime import datetime
 import logging
+from session_file import decode_ble_packets
 
 # Constants
-MAX_CHANNELS = 16
+MAX_CHANNELS = 32  # 32 per RHD chip on the bus, see neural_data.h; packet format in session_file.py
 ADC_SCALE_FACTOR = 0.195  # typical scale factor RHD2000 in µV/bit
 SNIPPET_DURATION = 5  # seconds
 
@@ -19,6 +20,7 @@ def decode_ble_log(input_file, output_file):
     """
     try:
         all_rows = []
+        payloads = []
 
         with open(input_file, 'r') as infile:
             # Initialize CSV writer
@@ -42,25 +44,16 @@ def decode_ble_log(input_file, output_file):
                         data_clean = data.replace('-', '')
 
                         # Convert hex string to bytes
-                        data_bytes = bytes.fromhex(data_clean)
+                        payloads.append(bytes.fromhex(data_clean))
 
-                        # Ensure we have enough bytes (32 bytes for 16 channels + 4 bytes for timestamp = 36 bytes total)
-                        if len(data_bytes) != 36:
-                            logging.warning(f"Invalid data length: {len(data_bytes)} in line: {line.strip()}")
-                            continue
+                # A notification carries a packet header and records, or whole NeuralData samples from older firmware
+                for sample in decode_ble_packets(payloads, MAX_CHANNELS):
+                    # Apply scaling factor to convert to µV
+                    channel_data = [value * ADC_SCALE_FACTOR for value in sample.channels]
 
-                        # Unpack 16 signed short integers (each is 2 bytes) from the first 32 bytes
-                        channel_data = struct.unpack('<16h', data_bytes[:32])
-
-                        # Apply scaling factor to convert to µV
-                        channel_data = [value * ADC_SCALE_FACTOR for value in channel_data]
-
-                        # Extract the actual timestamp from the last 4 bytes of the data
-                        ble_timestamp = struct.unpack('<I', data_bytes[32:])[0]
-
-                        # Create the row with the timestamp and channel data
-                        row = [ble_timestamp] + channel_data
-                        all_rows.append(row)
+                    # Create the row with the timestamp (ms) and channel data
+                    row = [round(sample.time_s * 1000, 3)] + channel_data
+                    all_rows.append(row)
 
                 # Write all rows to CSV at once (better for performance)
                 csv_writer.writerows(all_rows)
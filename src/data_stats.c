@@ -0,0 +1,33 @@
+// data_stats.c
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include "../inc/data_stats.h"
+
+static atomic_t counters[DATA_STAT_COUNT];
+
+void data_stats_add(enum data_stat stat, uint32_t n)
+{
+    atomic_add(&counters[stat], (atomic_val_t)n);
+}
+
+void data_stats_max(enum data_stat stat, uint32_t value)
+{
+    atomic_val_t current = atomic_get(&counters[stat]);
+
+    // Retry only while another writer raised it in between and it is still below value
+    while ((uint32_t)current < value && !atomic_cas(&counters[stat], current, (atomic_val_t)value))
+    {
+        current = atomic_get(&counters[stat]);
+    }
+}
+
+void data_stats_get(struct data_stats *stats)
+{
+    stats->produced = (uint32_t)atomic_get(&counters[DATA_STAT_PRODUCED]);
+    stats->fifo_dropped = (uint32_t)atomic_get(&counters[DATA_STAT_FIFO_DROPPED]);
+    stats->ble_dropped = (uint32_t)atomic_get(&counters[DATA_STAT_BLE_DROPPED]);
+    stats->sd_dropped = (uint32_t)atomic_get(&counters[DATA_STAT_SD_DROPPED]);
+    stats->late = (uint32_t)atomic_get(&counters[DATA_STAT_LATE]);
+    stats->fifo_high_watermark = (uint32_t)atomic_get(&counters[DATA_STAT_FIFO_HIGH_WATERMARK]);
+}
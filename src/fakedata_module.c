@@ -9,6 +9,7 @@
 #include "../inc/fakedata_module.h"
 #include "../inc/neural_data.h"
 #include "../inc/fifo_buffer.h"
+#include "../inc/data_stats.h"
 
 #define SAMPLE_RATE_HZ 2000
 // 100
@@ -32,6 +33,7 @@ void fakedata_thread(void *arg1, void *arg2, void *arg3)
     fifo_buffer_t *fifo_buffer = (fifo_buffer_t *)arg1;
     NeuralData data;
     uint16_t counter = 0;
+    uint32_t index = 0;
     int64_t start_time = k_uptime_get();
     static int log_counter = 0;
 
@@ -48,6 +50,8 @@ void fakedata_thread(void *arg1, void *arg2, void *arg3)
         }
 
         data.timestamp = (uint32_t)(k_uptime_get() - start_time);
+        data.flags = 0;
+        data.index = index++;
 
         // Generate data for all channels
         for (int i = 0; i < MAX_CHANNELS; i++)
@@ -57,15 +61,13 @@ void fakedata_thread(void *arg1, void *arg2, void *arg3)
 
         // Write the NeuralData struct to the FIFO buffer
         size_t structs_written = write_to_fifo_buffer(fifo_buffer, &data, 1);
+        data_stats_add(DATA_STAT_PRODUCED, 1);
         if (structs_written != 1)
         {
             LOG_ERR("Failed to write neural data to FIFO buffer.");
+            data_stats_add(DATA_STAT_FIFO_DROPPED, 1);
         }
 
-        // Update the global latest_neural_data variable
-        latest_neural_data.data = data;
-        latest_neural_data.sent = false;
-
         if (log_counter++ % 100 == 0)
         {
             LOG_INF("Faked data written to fifo buffer: timestamp %d, value %d",
@@ -8,11 +8,46 @@
 #include <zephyr/logging/log.h>
 #include "../inc/fifo_buffer.h"
 #include "../inc/neural_data.h"
+#include "../inc/data_stats.h"
 
 LOG_MODULE_REGISTER(fifo_buffer, LOG_LEVEL_INF);
-// Only log every 100th operation or when fill percentage changes significantly
+// Only log every 100th read or when fill percentage changes significantly. Consumer side only.
 static int log_counter = 0;
-static float last_fill_percentage = 0;
+static int last_fill_percentage = 0;
+
+static size_t fifo_count(uint32_t tail, uint32_t head)
+{
+    return (size_t)(tail - head);
+}
+
+// First item the consumer still needs from the ring: head, or the spill cursor once the consumer has read
+// up to where a spill tier took over. Read in the reverse order fifo_buffer_set_spilled() writes them, so a
+// new spill cursor is never paired with an older start.
+static uint32_t fifo_ring_head(fifo_consumer_t *consumer)
+{
+    uint32_t spilled = (uint32_t)atomic_get(&consumer->spilled);
+    uint32_t start = (uint32_t)atomic_get(&consumer->spill_start);
+    uint32_t head = (uint32_t)atomic_get(&consumer->head);
+
+    return (int32_t)(head - start) >= 0 && (int32_t)(spilled - head) > 0 ? spilled : head;
+}
+
+// Items the slowest BLOCK consumer holds in the ring, what the producer has to leave alone
+static size_t fifo_backlog(fifo_buffer_t *fifo_buffer, uint32_t tail)
+{
+    size_t backlog = 0;
+
+    for (size_t i = 0; i < fifo_buffer->consumer_count; i++)
+    {
+        fifo_consumer_t *consumer = fifo_buffer->consumers[i];
+
+        if (consumer->policy == FIFO_OVERFLOW_BLOCK)
+        {
+            backlog = MAX(backlog, fifo_count(tail, fifo_ring_head(consumer)));
+        }
+    }
+    return backlog;
+}
 
 int init_fifo_buffer(fifo_buffer_t *fifo_buffer)
 {
@@ -21,123 +56,266 @@ int init_fifo_buffer(fifo_buffer_t *fifo_buffer)
         return -EINVAL; // Invalid argument
     }
 
-    fifo_buffer->head = 0;
-    fifo_buffer->tail = 0;
-    fifo_buffer->size = 0;
+    atomic_set(&fifo_buffer->tail, 0);
+    atomic_set(&fifo_buffer->reserved, 0);
+    fifo_buffer->consumer_count = 0;
+
+    return 0; // Success
+}
 
-    int ret = k_mutex_init(&fifo_buffer->mutex);
-    if (ret != 0)
+int fifo_buffer_add_consumer(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, enum fifo_overflow_policy policy,
+                             size_t low_watermark, size_t high_watermark)
+{
+    if (fifo_buffer == NULL || consumer == NULL || low_watermark == 0 || low_watermark > high_watermark ||
+        high_watermark > FIFO_BUFFER_SIZE)
     {
-        return ret; // Return the error code from mutex initialization
+        return -EINVAL;
     }
+    if (fifo_buffer->consumer_count == FIFO_MAX_CONSUMERS)
+    {
+        return -ENOMEM;
+    }
+
+    k_poll_signal_init(&consumer->signal);
+    k_poll_signal_init(&consumer->overflow);
+    atomic_set(&consumer->head, atomic_get(&fifo_buffer->tail));
+    atomic_set(&consumer->spilled, atomic_get(&fifo_buffer->tail));
+    atomic_set(&consumer->spill_start, atomic_get(&fifo_buffer->tail));
+    atomic_set(&consumer->dropped, 0);
+    consumer->low_watermark = low_watermark;
+    consumer->high_watermark = high_watermark;
+    consumer->overflow_watermark = 0;
+    consumer->policy = policy;
+    fifo_buffer->consumers[fifo_buffer->consumer_count++] = consumer;
+
+    return 0;
+}
 
-    ret = k_sem_init(&fifo_buffer->data_available, 0, 1);
-    if (ret != 0)
+// Slots for n items from free-running index: up to the end of the ring, then from its start
+static void fifo_split(fifo_buffer_t *fifo_buffer, uint32_t index, size_t n, NeuralData *data[2], size_t count[2])
+{
+    size_t start = index & FIFO_BUFFER_MASK;
+
+    data[0] = &fifo_buffer->buffer[start];
+    data[1] = &fifo_buffer->buffer[0];
+    count[0] = MIN(n, FIFO_BUFFER_SIZE - start);
+    count[1] = n - count[0];
+}
+
+static void fifo_log_fill(size_t fill, size_t structs_read)
+{
+    int fill_percentage = (int)((fill * 100) / FIFO_BUFFER_SIZE);
+
+    if (log_counter++ % 100 == 0 || (fill_percentage - last_fill_percentage > 5) || (last_fill_percentage - fill_percentage > 5))
     {
-        return ret; // Return the error code from semaphore initialization
+        LOG_INF("FIFO Buffer fill: %d%% (read %zu structs)", fill_percentage, structs_read);
+        last_fill_percentage = fill_percentage;
     }
+}
 
-    return 0; // Success
+size_t fifo_buffer_reserve(fifo_buffer_t *fifo_buffer, size_t max, fifo_write_span_t *span)
+{
+    uint32_t tail = (uint32_t)atomic_get(&fifo_buffer->tail);
+    // The BLOCK consumers finished with every slot below their heads
+    size_t n = MIN(max, FIFO_BUFFER_SIZE - fifo_backlog(fifo_buffer, tail));
+
+    // Announce the slots before touching them, DROP_OLDEST readers check this after copying
+    atomic_set(&fifo_buffer->reserved, (atomic_val_t)(tail + n));
+
+    fifo_split(fifo_buffer, tail, n, span->data, span->count);
+    return n;
 }
 
-size_t read_from_fifo_buffer(fifo_buffer_t *fifo_buffer, NeuralData *data, size_t max_size)
+void fifo_buffer_commit(fifo_buffer_t *fifo_buffer, size_t n)
 {
-    size_t structs_read = 0;
-    bool was_above_threshold = false;
+    uint32_t tail = (uint32_t)atomic_get(&fifo_buffer->tail) + n;
 
-    int ret = k_mutex_lock(&fifo_buffer->mutex, K_NO_WAIT);
-    if (ret != 0)
+    // Publish the new tail only once the items are complete, so no consumer reads a half-written item
+    atomic_set(&fifo_buffer->tail, (atomic_val_t)tail);
+    atomic_set(&fifo_buffer->reserved, (atomic_val_t)tail);
+
+    // Signal only on crossing the high watermark, not on every write above it
+    size_t backlog = 0;
+    for (size_t i = 0; i < fifo_buffer->consumer_count; i++)
     {
-        LOG_WRN("Failed to acquire mutex, error: %d", ret);
-        k_mutex_unlock(&fifo_buffer->mutex);
-        return 0;
+        fifo_consumer_t *consumer = fifo_buffer->consumers[i];
+        size_t fill = fifo_count(tail, (uint32_t)atomic_get(&consumer->head));
+
+        if (fill >= consumer->high_watermark && fill < consumer->high_watermark + n)
+        {
+            k_poll_signal_raise(&consumer->signal, 0);
+        }
+        if (consumer->policy == FIFO_OVERFLOW_BLOCK)
+        {
+            size_t ring_fill = fifo_count(tail, fifo_ring_head(consumer));
+
+            if (consumer->overflow_watermark != 0 && ring_fill >= consumer->overflow_watermark &&
+                ring_fill < consumer->overflow_watermark + n)
+            {
+                k_poll_signal_raise(&consumer->overflow, 0);
+            }
+            backlog = MAX(backlog, ring_fill);
+        }
     }
+    data_stats_max(DATA_STAT_FIFO_HIGH_WATERMARK, (uint32_t)backlog);
+}
 
-    // Check if the buffer was above 50% before reading
-    was_above_threshold = fifo_buffer->size >= (FIFO_BUFFER_SIZE / 2);
+int fifo_buffer_wait(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, k_timeout_t timeout)
+{
+    struct k_poll_event event =
+        K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &consumer->signal);
+    size_t fill;
 
-    while (structs_read < max_size && fifo_buffer->size > 0)
+    // Reset before looking at the fill, a crossing after the check leaves the signal raised for k_poll()
+    k_poll_signal_reset(&consumer->signal);
+    fill = fifo_buffer_available(fifo_buffer, consumer);
+    if (fill < consumer->high_watermark)
     {
-        *data = fifo_buffer->buffer[fifo_buffer->head]; // get the pointer to the head in the buffer
-        fifo_buffer->head = (fifo_buffer->head + 1) % FIFO_BUFFER_SIZE;
-        fifo_buffer->size--;
-        data++;
-        structs_read++;
+        k_poll(&event, 1, timeout);
+        fill = fifo_buffer_available(fifo_buffer, consumer);
     }
 
-    // In read_from_fifo_buffer and write_to_fifo_buffer:
-    int fill_percentage = (int)((fifo_buffer->size * 100) / FIFO_BUFFER_SIZE);
-    if (log_counter++ % 100 == 0 || (fill_percentage - last_fill_percentage > 5) || (last_fill_percentage - fill_percentage > 5))
+    if (fill < consumer->low_watermark)
     {
-        LOG_INF("FIFO Buffer fill: %d%% (read %zu structs)", fill_percentage, structs_read);
-        last_fill_percentage = fill_percentage;
+        return -EAGAIN;
     }
+    return (int)MIN(fill, FIFO_BUFFER_SIZE);
+}
 
-    // Sem taken in SD card writer thread
-    // if (was_above_threshold && fifo_buffer->size < (FIFO_BUFFER_SIZE / 2))
-    // {
-    //     // Reset the semaphore when falling below 50% threshold
-    //     k_sem_take(&fifo_buffer->data_available, K_NO_WAIT);
-    //     LOG_INF("Buffer fell below 50 percent capacity, reset data availability signal");
-    // }
+size_t fifo_buffer_peek(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, size_t max, fifo_read_span_t *span)
+{
+    __ASSERT(consumer->policy == FIFO_OVERFLOW_BLOCK, "Only BLOCK consumers can read in place");
 
-    k_mutex_unlock(&fifo_buffer->mutex);
+    uint32_t head = (uint32_t)atomic_get(&consumer->head);
+    // The producer completed items before publishing tail, everything below it is readable
+    uint32_t tail = (uint32_t)atomic_get(&fifo_buffer->tail);
+    size_t n = MIN(max, fifo_count(tail, head));
+    NeuralData *data[2];
 
-    return structs_read;
+    fifo_split(fifo_buffer, head, n, data, span->count);
+    span->data[0] = data[0];
+    span->data[1] = data[1];
+    return n;
 }
 
-size_t write_to_fifo_buffer(fifo_buffer_t *fifo_buffer, const NeuralData *data, size_t size)
+void fifo_buffer_release(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, size_t n)
 {
-    size_t structs_written = 0;
-    bool was_below_threshold = false;
+    uint32_t head = (uint32_t)atomic_get(&consumer->head) + n;
+
+    // Publish the new head only when the caller is done with the items, so the producer cannot overwrite them
+    atomic_set(&consumer->head, (atomic_val_t)head);
 
-    int ret = k_mutex_lock(&fifo_buffer->mutex, K_NO_WAIT);
-    if (ret != 0)
+    // Keep an idle spill cursor from falling more than half the index range behind
+    atomic_val_t spilled = atomic_get(&consumer->spilled);
+    if ((int32_t)((uint32_t)spilled - head) < 0)
     {
-        LOG_WRN("Failed to acquire mutex, error: %d", ret);
-        k_mutex_unlock(&fifo_buffer->mutex);
-        return 0;
+        atomic_cas(&consumer->spilled, spilled, (atomic_val_t)head);
     }
 
-    // Check if the buffer was below 50% before writing
-    was_below_threshold = fifo_buffer->size < (FIFO_BUFFER_SIZE / 2);
+    fifo_log_fill(fifo_count((uint32_t)atomic_get(&fifo_buffer->tail), head), n);
+}
 
-    while (structs_written < size && fifo_buffer->size < FIFO_BUFFER_SIZE)
-    {
-        fifo_buffer->buffer[fifo_buffer->tail] = *data;
-        fifo_buffer->tail = (fifo_buffer->tail + 1) % FIFO_BUFFER_SIZE;
-        fifo_buffer->size++;
-        data++;
-        structs_written++;
-    }
+void fifo_buffer_set_overflow_watermark(fifo_consumer_t *consumer, size_t watermark)
+{
+    consumer->overflow_watermark = MIN(watermark, FIFO_BUFFER_SIZE);
+}
 
-    // In read_from_fifo_buffer and write_to_fifo_buffer:
-    int fill_percentage = (int)((fifo_buffer->size * 100) / FIFO_BUFFER_SIZE);
-    if (log_counter++ % 100 == 0 || (fill_percentage - last_fill_percentage > 5) || (last_fill_percentage - fill_percentage > 5))
+uint32_t fifo_buffer_head(fifo_consumer_t *consumer)
+{
+    return (uint32_t)atomic_get(&consumer->head);
+}
+
+size_t fifo_buffer_ring_fill(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer)
+{
+    return fifo_count((uint32_t)atomic_get(&fifo_buffer->tail), fifo_ring_head(consumer));
+}
+
+size_t fifo_buffer_peek_at(fifo_buffer_t *fifo_buffer, uint32_t index, size_t max, fifo_read_span_t *span)
+{
+    uint32_t tail = (uint32_t)atomic_get(&fifo_buffer->tail);
+    size_t n = (int32_t)(tail - index) > 0 ? MIN(max, fifo_count(tail, index)) : 0;
+    NeuralData *data[2];
+
+    fifo_split(fifo_buffer, index, n, data, span->count);
+    span->data[0] = data[0];
+    span->data[1] = data[1];
+    return n;
+}
+
+void fifo_buffer_set_spilled(fifo_consumer_t *consumer, uint32_t start, uint32_t end)
+{
+    // The producer may reuse the slots as soon as end is visible with head at start
+    atomic_set(&consumer->spill_start, (atomic_val_t)start);
+    atomic_set(&consumer->spilled, (atomic_val_t)end);
+}
+
+size_t fifo_buffer_available(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer)
+{
+    return fifo_count((uint32_t)atomic_get(&fifo_buffer->tail), (uint32_t)atomic_get(&consumer->head));
+}
+
+size_t read_from_fifo_buffer(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, NeuralData *data,
+                             size_t max_size)
+{
+    uint32_t head = (uint32_t)atomic_get(&consumer->head);
+    uint32_t tail = (uint32_t)atomic_get(&fifo_buffer->tail);
+    uint32_t reserved = (uint32_t)atomic_get(&fifo_buffer->reserved);
+    bool overrun_check = consumer->policy == FIFO_OVERFLOW_DROP_OLDEST;
+
+    // Run over: skip to the oldest item the producer is not writing
+    if (overrun_check && fifo_count(reserved, head) > FIFO_BUFFER_SIZE)
     {
-        LOG_INF("FIFO Buffer fill: %d%% (wrote %zu structs)", fill_percentage, structs_written);
-        last_fill_percentage = fill_percentage;
+        atomic_add(&consumer->dropped, (atomic_val_t)(fifo_count(reserved, head) - FIFO_BUFFER_SIZE));
+        head = reserved - FIFO_BUFFER_SIZE;
     }
 
-    // if (structs_written < size)
-    // {
-    //     LOG_WRN("FIFO Buffer full, dropped %zu structs", size - structs_written);
-    // }
+    size_t structs_read = MIN(max_size, fifo_count(tail, head));
+    NeuralData *run[2];
+    size_t count[2];
+
+    // At most two runs, the second from the start of the ring after wrapping
+    fifo_split(fifo_buffer, head, structs_read, run, count);
+    memcpy(data, run[0], count[0] * sizeof(NeuralData));
+    memcpy(data + count[0], run[1], count[1] * sizeof(NeuralData));
 
-    // Check if the buffer has reached or exceeded 50% capacity
-    if (fifo_buffer->size >= (FIFO_BUFFER_SIZE / 2))
+    // Items the producer reserved over while they were copied may be torn, drop them
+    reserved = (uint32_t)atomic_get(&fifo_buffer->reserved);
+    if (overrun_check && fifo_count(reserved, head) > FIFO_BUFFER_SIZE)
     {
-        // Signal that data is available only when crossing the 50% threshold
-        k_sem_give(&fifo_buffer->data_available);
-        LOG_INF("Buffer reached 50 percent capacity, signaled data availability");
+        size_t lost = MIN(structs_read, fifo_count(reserved, head) - FIFO_BUFFER_SIZE);
+
+        memmove(data, data + lost, (structs_read - lost) * sizeof(NeuralData));
+        atomic_add(&consumer->dropped, (atomic_val_t)lost);
+        structs_read -= lost;
+        head += lost;
     }
 
-    k_mutex_unlock(&fifo_buffer->mutex);
+    // Publish the new head only after the copies, so the producer cannot overwrite slots still being read
+    atomic_set(&consumer->head, (atomic_val_t)(head + structs_read));
+
+    fifo_log_fill(fifo_count(tail, head + structs_read), structs_read);
+
+    return structs_read;
+}
+
+size_t write_to_fifo_buffer(fifo_buffer_t *fifo_buffer, const NeuralData *data, size_t size)
+{
+    fifo_write_span_t span;
+    size_t structs_written = fifo_buffer_reserve(fifo_buffer, size, &span);
+
+    memcpy(span.data[0], data, span.count[0] * sizeof(NeuralData));
+    memcpy(span.data[1], data + span.count[0], span.count[1] * sizeof(NeuralData));
+    fifo_buffer_commit(fifo_buffer, structs_written);
 
     return structs_written;
 }
 
+size_t fifo_buffer_fill(fifo_buffer_t *fifo_buffer)
+{
+    return fifo_backlog(fifo_buffer, (uint32_t)atomic_get(&fifo_buffer->tail));
+}
+
 int get_fifo_fill_percentage(fifo_buffer_t *fifo_buffer)
 {
-    return (fifo_buffer->size / FIFO_BUFFER_SIZE) * 100;
-}
\ No newline at end of file
+    return (int)((fifo_buffer_fill(fifo_buffer) * 100) / FIFO_BUFFER_SIZE);
+}
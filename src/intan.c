@@ -1,12 +1,21 @@
 // intan.c
 
+#include <string.h>
 #include <zephyr/kernel.h>
 #include <zephyr/drivers/spi.h>
 #include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/counter.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/rtio/rtio.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/timing/timing.h>
 #include "../inc/intan.h"
 #include "../inc/neural_data.h"
 #include "../inc/fifo_buffer.h"
+#include "../inc/data_stats.h"
+#include "../inc/rhd_frame.h"
+#include "../inc/rhd2232.h"
+#include "../inc/device_status.h"
 
 LOG_MODULE_REGISTER(intan_tests, LOG_LEVEL_DBG);
 
@@ -16,7 +25,7 @@ LOG_MODULE_REGISTER(intan_tests, LOG_LEVEL_DBG);
 K_THREAD_STACK_DEFINE(intan_work_q_stack, INTAN_WORK_Q_STACK_SIZE);
 static struct k_work_q intan_work_q;
 
-#define SAMPLE_RATE_HZ 250
+#define RHD_DEFAULT_SAMPLE_RATE_HZ 250
 // 100
 // 250
 // 500
@@ -26,15 +35,59 @@ static struct k_work_q intan_work_q;
 // 1500
 // 2000
 // 2500
-#define CHANNEL_COUNT 16
-#define COMMAND_COUNT (CHANNEL_COUNT + 3)
+#define RHD_DEFAULT_CHANNEL_MASK INTAN_CHANNEL_MASK_ALL
 
-// ADC commands
-static uint16_t RHD_CONVERT[COMMAND_COUNT] = {
-    0x0000, 0x0100, 0x0200, 0x0300, 0x0400, 0x0500, 0x0600, 0x0700,
-    0x0800, 0x0900, 0x0a00, 0x0b00, 0x0c00, 0x0d00, 0x0e00, 0x0f00,
-    0xFF00, 0xFF00, 0xFF00};
-static uint16_t T_result[COMMAND_COUNT];
+// Each result comes back two commands after its CONVERT, the trailing commands flush the pipeline
+#define RHD_PIPELINE_DEPTH 2
+#define RHD_FLUSH_COMMANDS 3
+// Every chip's segment of a frame ends in its own flush commands
+#define RHD_MAX_COMMANDS (MAX_CHANNELS + RHD_CHIP_COUNT * RHD_FLUSH_COMMANDS)
+
+#define RHD_CONVERT_CMD(channel) ((uint16_t)((channel) << 8))
+#define RHD_WRITE_CMD(reg, value) ((uint16_t)(0x8000 | ((reg) << 8) | (value)))
+#define RHD_DUMMY_CMD 0xFF00 // Benchmark and calibration filler, sampling rotates auxiliary commands through these slots
+
+// ADC commands, generated from the channel mask by RHD_build_convert_table(): one segment per chip
+static uint16_t RHD_CONVERT[RHD_MAX_COMMANDS];
+static size_t channel_count;
+static size_t command_count;
+
+// One intan,rhd2232 node per chip, each on its own CS line. Chip 0 carries the sensor read queue and
+// the auxiliary reads that feed DeviceStatus.
+BUILD_ASSERT(RHD_CHANNELS_PER_CHIP == RHD2232_MAX_AMPLIFIERS, "NeuralData chip stride differs from the driver");
+#define RHD_CHIP_NODE(i) DT_INST(i, intan_rhd2232)
+#define RHD_CHIP_DEV(node) DEVICE_DT_GET(node),
+// Listed in instance order, so rhd_devs[0] is RHD_CHIP_NODE(0)
+static const struct device *const rhd_devs[RHD_CHIP_COUNT] = {DT_FOREACH_STATUS_OKAY(intan_rhd2232, RHD_CHIP_DEV)};
+
+struct rhd_chip
+{
+    struct rhd2232_info info;
+    uint32_t available;   // Amplifier channels the detected variant has
+    size_t offset;        // First command of the chip's segment
+    size_t channel_count; // CONVERTs in the segment
+    size_t command_count; // CONVERTs plus flush commands
+};
+
+static struct rhd_chip chips[RHD_CHIP_COUNT];
+static uint64_t available_mask = INTAN_CHANNEL_MASK_ALL; // Narrowed to the detected variants by intan_init()
+static uint16_t T_result[RHD_MAX_COMMANDS];
+
+static struct intan_acq_config acq_config = {
+    .sample_rate_hz = RHD_DEFAULT_SAMPLE_RATE_HZ,
+    .channel_mask = RHD_DEFAULT_CHANNEL_MASK,
+};
+static K_MUTEX_DEFINE(config_lock);
+
+// Send the whole command table as one SPIM transaction instead of one spi_transceive per word
+#define RHD_FRAME_TRANSFER 1
+#define RHD_BENCH_FRAMES 64 // Frames timed per path for the start-up cycle-count comparison
+// Let TIMER4 + PPI start every frame and wake the CPU once per block
+#define RHD_HW_TIMED 1
+// Default samples per block, see intan_set_block_size()
+#define RHD_BLOCK_FRAMES 8
+
+BUILD_ASSERT(INTAN_MAX_BLOCK_FRAMES <= RHD_FRAME_MAX_BLOCK, "Block larger than the frame engine can stream");
 
 #define CALIBRATE 0x5500
 #define CLEAR 0x6A00
@@ -51,261 +104,1727 @@ static uint16_t T_result[COMMAND_COUNT];
 #define Register6 0x8600 // Keep as is
 #define Register7 0x8700 // Keep as is
 
-// Amplifier bandwidth configuration options
-// Option 1: Wide bandwidth (1 Hz - 7.5 kHz)
-// #define Register8 0x882C  // Set RH1 DAC1 to 44 (0x2C)
-// #define Register9 0x8911  // Set RH1 DAC2 to 17 (0x11)
-// #define Register10 0x8A08 // Set RH2 DAC1 to 8 (0x08)
-// #define Register11 0x8B15 // Set RH2 DAC2 to 21 (0x15)
-// #define Register12 0x8C10 // Set RL DAC1 to 16 (0x10)
-// #define Register13 0x8D3C // Set RL DAC2 to 60 (0x3C) and RL DAC3 to 1 (0x01)
-
-// Option 2: Medium bandwidth (1 Hz - 1 kHz)
-// #define Register8 0x8846  // Set RH1 DAC1 to 70 (0x46)
-// #define Register9 0x8902  // Set RH1 DAC2 to 2 (0x02)
-// #define Register10 0x8A1E // Set RH2 DAC1 to 30 (0x1E)
-// #define Register11 0x8B03 // Set RH2 DAC2 to 3 (0x03)
-// #define Register12 0x8C10 // Set RL DAC1 to 16 (0x10)
-// #define Register13 0x8D3C // Set RL DAC2 to 60 (0x3C) and RL DAC3 to 1 (0x01)
-
-// Option 3: Narrow bandwidth (1 Hz - 300 Hz)
-#define Register8 0x8806  // Set RH1 DAC1 to 6 (0x06)
-#define Register9 0x8909  // Set RH1 DAC2 to 9 (0x09)
-#define Register10 0x8A02 // Set RH2 DAC1 to 2 (0x02)
-#define Register11 0x8B0B // Set RH2 DAC2 to 11 (0x0B)
-#define Register12 0x8C10 // Set RL DAC1 to 16 (0x10)
-#define Register13 0x8D3C // Set RL DAC2 to 60 (0x3C) and RL DAC3 to 1 (0x01)
+// Amplifier bandwidth profiles, Register8-13 per intan_bandwidth, switchable at runtime with intan_set_bandwidth()
+#define RHD_BANDWIDTH_REG_COUNT 6
+#define RHD_DEFAULT_BANDWIDTH INTAN_BW_NARROW
+static const uint16_t RHD_BANDWIDTH_PROFILES[INTAN_BW_COUNT][RHD_BANDWIDTH_REG_COUNT] = {
+    // Option 1: Wide bandwidth (1 Hz - 7.5 kHz)
+    [INTAN_BW_WIDE] = {
+        0x882C, // Set RH1 DAC1 to 44 (0x2C)
+        0x8911, // Set RH1 DAC2 to 17 (0x11)
+        0x8A08, // Set RH2 DAC1 to 8 (0x08)
+        0x8B15, // Set RH2 DAC2 to 21 (0x15)
+        0x8C10, // Set RL DAC1 to 16 (0x10)
+        0x8D3C, // Set RL DAC2 to 60 (0x3C) and RL DAC3 to 1 (0x01)
+    },
+    // Option 2: Medium bandwidth (1 Hz - 1 kHz)
+    [INTAN_BW_MEDIUM] = {
+        0x8846, // Set RH1 DAC1 to 70 (0x46)
+        0x8902, // Set RH1 DAC2 to 2 (0x02)
+        0x8A1E, // Set RH2 DAC1 to 30 (0x1E)
+        0x8B03, // Set RH2 DAC2 to 3 (0x03)
+        0x8C10, // Set RL DAC1 to 16 (0x10)
+        0x8D3C, // Set RL DAC2 to 60 (0x3C) and RL DAC3 to 1 (0x01)
+    },
+    // Option 3: Narrow bandwidth (1 Hz - 300 Hz)
+    [INTAN_BW_NARROW] = {
+        0x8806, // Set RH1 DAC1 to 6 (0x06)
+        0x8909, // Set RH1 DAC2 to 9 (0x09)
+        0x8A02, // Set RH2 DAC1 to 2 (0x02)
+        0x8B0B, // Set RH2 DAC2 to 11 (0x0B)
+        0x8C10, // Set RL DAC1 to 16 (0x10)
+        0x8D3C, // Set RL DAC2 to 60 (0x3C) and RL DAC3 to 1 (0x01)
+    },
+};
 
 // Power up/down configuration
-#define Register14 0x8EFF // Power up channels 0-7 (11111111 in binary)
-#define Register15 0x8FFF // Power up channels 8-15 (11111111 in binary)
-#define Register16 0x9000 // Power down channels 16-23 (00000000 in binary)
-#define Register17 0x9100 // Power down channels 24-31 (00000000 in binary)
+// Registers 14-17 hold one amplifier power bit per channel (14: 0-7, 15: 8-15, 16: 16-23, 17: 24-31)
+// and are generated from the channel mask, see RHD_write_power_registers()
+#define RHD_POWER_REG_FIRST 14
+#define RHD_POWER_REG_COUNT 4
+
+BUILD_ASSERT(8 + RHD_BANDWIDTH_REG_COUNT == RHD_POWER_REG_FIRST &&
+                 RHD_POWER_REG_FIRST + RHD_POWER_REG_COUNT == INTAN_REGISTER_COUNT,
+             "Written registers must be 0 to INTAN_REGISTER_COUNT - 1");
+
+// Auxiliary reads in the flush slots ===============================================================================
+// The three commands after the last CONVERT only flush the pipeline, so they carry auxiliary commands instead,
+// rotating over RHD_AUX_PHASES frames. Results cost no extra bus time: the first lands in the last slot of the
+// same frame, the other two in slots 0-1 of the next frame.
+#define RHD_AUX_PHASES 3
+#define RHD_AUX_IN_CHANNEL 32 // AUX1-3 on channels 32-34
+#define RHD_SUPPLY_CHANNEL 48
+#define RHD_TEMP_CHANNEL 49
+
+// Register 3 temperature sensor bits, the sensor needs >= 100 us after each switch so writes and
+// conversions sit in different frames
+#define RHD_REG3 3
+#define RHD_REG3_TEMPEN 0x04
+#define RHD_REG3_TEMPS1 0x08
+#define RHD_REG3_TEMPS2 0x10
+#define RHD_REG3_BASE (Register3 & 0xFF & ~(RHD_REG3_TEMPEN | RHD_REG3_TEMPS1 | RHD_REG3_TEMPS2))
+
+// Supply voltage mapped onto DeviceStatus.battery_level
+#define RHD_BATTERY_EMPTY_MV 3000
+#define RHD_BATTERY_FULL_MV 3600
+
+enum rhd_aux_kind
+{
+    RHD_AUX_NONE,
+    RHD_AUX_TEMP_S1,
+    RHD_AUX_TEMP_S2,
+    RHD_AUX_SUPPLY,
+    RHD_AUX_IN1,
+    RHD_AUX_IN2,
+    RHD_AUX_IN3,
+};
+
+struct rhd_aux_command
+{
+    uint16_t command;
+    uint8_t kind;
+};
+
+static const struct rhd_aux_command RHD_AUX_SCHEDULE[RHD_AUX_PHASES][RHD_FLUSH_COMMANDS] = {
+    {{RHD_WRITE_CMD(RHD_REG3, RHD_REG3_BASE | RHD_REG3_TEMPEN | RHD_REG3_TEMPS1), RHD_AUX_NONE},
+     {RHD_CONVERT_CMD(RHD_SUPPLY_CHANNEL), RHD_AUX_SUPPLY},
+     {RHD_CONVERT_CMD(RHD_AUX_IN_CHANNEL), RHD_AUX_IN1}},
+    {{RHD_CONVERT_CMD(RHD_TEMP_CHANNEL), RHD_AUX_TEMP_S1},
+     {RHD_WRITE_CMD(RHD_REG3, RHD_REG3_BASE | RHD_REG3_TEMPEN | RHD_REG3_TEMPS1 | RHD_REG3_TEMPS2), RHD_AUX_NONE},
+     {RHD_CONVERT_CMD(RHD_AUX_IN_CHANNEL + 1), RHD_AUX_IN2}},
+    {{RHD_CONVERT_CMD(RHD_TEMP_CHANNEL), RHD_AUX_TEMP_S2},
+     {RHD_WRITE_CMD(RHD_REG3, RHD_REG3_BASE | RHD_REG3_TEMPEN), RHD_AUX_NONE},
+     {RHD_CONVERT_CMD(RHD_AUX_IN_CHANNEL + 2), RHD_AUX_IN3}},
+};
 // ================================================================================================================
 
-// SPI configuration
-#define SPIOP SPI_WORD_SET(8) | SPI_TRANSFER_MSB
-struct spi_dt_spec spispec = SPI_DT_SPEC_GET(DT_NODELABEL(rhd2232), SPIOP, 0);
+
+// Finished blocks reach intan_thread as completed sensor reads, each in a buffer from the RTIO pool the frames
+// were written into. RHD_RTIO_READS reads stay submitted, a block finding none pending is dropped.
+#define RHD_RTIO_READS 4
+#define RHD_RTIO_POOL_BLOCK_SIZE 64
+#define RHD_RTIO_BUFFER_BLOCKS \
+    DIV_ROUND_UP(RHD2232_BLOCK_SIZE(INTAN_MAX_BLOCK_FRAMES, RHD_MAX_COMMANDS), RHD_RTIO_POOL_BLOCK_SIZE)
+
+SENSOR_DT_READ_IODEV(intan_iodev, RHD_CHIP_NODE(0), SENSOR_CHAN_VOLTAGE);
+// One buffer per read in flight plus the one being decoded
+RTIO_DEFINE_WITH_MEMPOOL(intan_rtio, RHD_RTIO_READS, RHD_RTIO_READS, (RHD_RTIO_READS + 1) * RHD_RTIO_BUFFER_BLOCKS,
+                         RHD_RTIO_POOL_BLOCK_SIZE, sizeof(uint32_t));
+
+// Acquisition clock for the software-started paths: absolute RTC2 alarms on the LFXO, on a tick grid
+// advanced by Bresenham steps so the long-run rate is exact even when 32768 / rate is not whole.
+// Boards without rtc2 fall back to a k_timer, which is quantised to kernel ticks.
+#define RHD_CLOCK_NODE DT_NODELABEL(rtc2)
+#if DT_NODE_HAS_STATUS(RHD_CLOCK_NODE, okay)
+#define RHD_COUNTER_CLOCK 1
+static const struct device *const rhd_clock = DEVICE_DT_GET(RHD_CLOCK_NODE);
+#else
+#define RHD_COUNTER_CLOCK 0
+#endif
+// Seconds of samples between acquisition clock reports
+#define RHD_CLOCK_REPORT_S 10
+
+struct rhd_clock_schedule
+{
+    uint64_t next_tick; // Absolute counter tick of the next frame, extended past the counter top
+    uint32_t period;    // Whole ticks per frame
+    uint32_t remainder; // Fractional ticks per frame, in 1/sample_rate_hz ticks
+    uint32_t acc;       // Bresenham accumulator
+    bool running;
+};
+
+// Run of the blocks intan_thread decodes, taken from their headers. Blocks of the previous run can still
+// be queued when sampling restarts, they keep its rate and start time.
+struct rhd_decode_run
+{
+    int64_t start_ns;
+    uint32_t sample_rate_hz;
+    uint32_t run;
+    bool valid;
+};
+
+// Acquisition clock against the kernel uptime clock, updated once per published block
+struct rhd_clock_track
+{
+    int64_t window_min;   // Smallest uptime - sample time offset in the current window, strips queueing latency
+    int64_t base_offset;  // window_min of the first window
+    uint32_t window_end;  // Sample index closing the current window
+    uint32_t base_index;  // Sample index of the first window's end
+    bool have_base;
+};
 
 // Timer and thread configuration
 struct k_timer RHD_timer;
+static struct rhd_clock_schedule clock_sched;
+static struct rhd_clock_track clock_track;
+static struct rhd_decode_run decode_run;
+static struct intan_clock_stats clock_stats;
+// Frame timing in cycle counter units, converted with a 16.16 ns-per-cycle factor to keep divisions off the frame path
+static struct intan_timing_stats timing_stats;
+static struct k_spinlock timing_lock;
+static timing_t timing_last; // Previous frame (or block) taken
+static bool timing_have_last;
+static uint32_t timing_ns_per_cycle_q16;
+static uint32_t timing_period_ns;
 K_THREAD_STACK_DEFINE(intan_stack, INTAN_THREAD_STACK_SIZE);
 struct k_thread intan_thread_data;
 
 // Globals
 static int64_t start_time = 0;
 static bool RHD_init = false;
-static struct rhd_work_data
+static bool frame_mode = false;
+static bool frame_available = false; // Frame engine took the command table at init
+static bool hw_timed = false;
+static enum intan_acq_mode acq_mode = INTAN_MODE_PER_WORD;
+static int64_t stream_start_ns = 0; // Uptime of sample 0
+static uint32_t acq_run;            // Run being acquired, stamped into every block header
+static uint32_t sample_index = 0;
+static struct k_work rhd_work;
+
+// Block mode: frames land in the buffer of the oldest pending read, samples are decoded straight into FIFO slots
+static size_t block_size = RHD_BLOCK_FRAMES;
+static size_t block_fill = 0;
+static bool sampling = false;
+static uint16_t *block_results;    // Block being filled, NULL when none is claimed
+static uint16_t *block_queued;     // Hardware-timed path: read buffer of the block after it, NULL when none
+static uint32_t block_first_index; // Sample index of its first frame
+static uint32_t blocks_dropped;    // Blocks that found no read pending
+static atomic_t frames_lost;       // Ticks whose frame was never taken, from the timer ISR
+// Frames of a block with no read to land in, on the software-started paths
+static uint16_t block_scratch[INTAN_MAX_BLOCK_FRAMES * RHD_MAX_COMMANDS];
+
+// Auxiliary reads: frames issued so far (TX side) and the latest decoded values
+static uint32_t aux_tx_index = 0;
+static uint32_t aux_gap_index; // First sample decoded after lost frames, its leading results are not ours
+static uint16_t aux_temp_s1;
+static bool aux_temp_s1_valid;
+static struct intan_aux_status aux_status;
+
+// Register updates ride in the flush slots while sampling continues, one update in flight at a time
+#define RHD_UPDATE_MAX_COMMANDS 8
+// Frames flagged after the last injected command while the amplifiers settle
+#define RHD_UPDATE_SETTLE_FRAMES 2
+// Commands the RHD spends calibrating its ADC after CALIBRATE
+#define RHD_CALIBRATE_COMMANDS 9
+
+BUILD_ASSERT(RHD_BANDWIDTH_REG_COUNT <= RHD_UPDATE_MAX_COMMANDS, "Bandwidth profile does not fit a register update");
+
+enum rhd_update_state
 {
-    struct k_work work;
-    fifo_buffer_t *fifo_buffer;
-} rhd_work;
+    RHD_UPDATE_IDLE,
+    RHD_UPDATE_QUEUED,   // Waiting for the next frame issued
+    RHD_UPDATE_ISSUING,  // Commands going out in the flush slots
+    RHD_UPDATE_SETTLING, // All issued, decode still flagging frames up to last_index
+};
+
+struct rhd_update
+{
+    uint16_t commands[RHD_UPDATE_MAX_COMMANDS];
+    size_t count;
+    size_t next;
+    uint32_t flags;       // NeuralData flags for the affected samples
+    uint32_t first_index; // Frame that carried the first injected command
+    uint32_t last_index;  // Last flagged frame
+    int bandwidth;        // Profile the chips run once the update has settled, -1 for none
+    enum rhd_update_state state;
+};
+
+// Shared between the issuing side (timer ISR, block interrupt or workqueue) and the decode side
+static struct rhd_update reg_update;
+static struct k_spinlock update_lock;
+static enum intan_bandwidth bandwidth = RHD_DEFAULT_BANDWIDTH;
 
 // Function prototypes
 static void spi_init(void);
-static uint16_t spi_trans(uint16_t command);
-static uint16_t spi_trans_wait(uint16_t command);
-static bool spi_check(void);
-static int RHD2232_init(void);
+static uint16_t spi_trans(const struct device *dev, uint16_t command);
+static uint16_t spi_trans_wait(const struct device *dev, uint16_t command);
+static int spi_check(size_t chip);
+static int RHD2232_init(size_t chip);
+static uint32_t RHD_chip_mask(uint64_t channel_mask, size_t chip);
+static void RHD_build_convert_table(uint64_t channel_mask);
+static int RHD_write_chip_power(size_t chip, uint32_t chip_mask);
+static int RHD_write_power_registers(uint64_t channel_mask);
+static void RHD_start_sampling(uint32_t delay_ms);
+static void RHD_stop_sampling(void);
+static void RHD_next_aux(uint16_t *aux);
+static void RHD_aux_patch(size_t frame);
+static bool RHD_update_window(uint32_t index, uint32_t *flags);
+static void RHD_aux_collect(const uint16_t *frame, size_t words, bool wire_order, uint32_t index);
+static void RHD_sample_frame(uint16_t *results);
+static void RHD_benchmark(void);
+static uint32_t RHD_sample_timestamp(uint32_t index);
+static void RHD_decode_frame(const uint16_t *frame, const struct rhd2232_block_header *header, NeuralData *sample);
 static void RHD_handler(struct k_work *work);
+static void RHD_block_ready(const uint16_t *results, size_t frames);
 static void my_timer_handler(struct k_timer *dummy);
+static void RHD_tick(void);
+static void RHD_frame_tick(void);
 extern int intan_init(fifo_buffer_t *fifo_buffer);
 
-// SPI initialization
+// SPI initialization, the driver checks the bus
 static void spi_init(void)
 {
-    if (!spi_is_ready_dt(&spispec))
+    for (size_t c = 0; c < RHD_CHIP_COUNT; c++)
     {
-        LOG_ERR("SPI device is not ready");
-        return;
+        if (!device_is_ready(rhd_devs[c]))
+        {
+            LOG_ERR("SPI device %s is not ready", rhd_devs[c]->name);
+            return;
+        }
     }
-    LOG_INF("SPI device is ready");
+    LOG_INF("SPI device is ready (%d chips)", RHD_CHIP_COUNT);
 }
 
 // SPI transaction function
-static uint16_t spi_trans(uint16_t command)
+static uint16_t spi_trans(const struct device *dev, uint16_t command)
 {
-    uint8_t tx_buffer[2] = {(command >> 8) & 0xFF, command & 0xFF};
-    uint8_t rx_buffer[2];
-    const struct spi_buf tx_buf = {.buf = tx_buffer, .len = sizeof(tx_buffer)};
-    const struct spi_buf rx_buf = {.buf = rx_buffer, .len = sizeof(rx_buffer)};
-    const struct spi_buf_set tx = {.buffers = &tx_buf, .count = 1};
-    const struct spi_buf_set rx = {.buffers = &rx_buf, .count = 1};
-
-    if (spi_transceive_dt(&spispec, &tx, &rx))
-    {
-        LOG_ERR("SPI transaction failed");
-        return 0;
-    }
-    return (rx_buffer[0] << 8) | rx_buffer[1];
+    return rhd2232_command(dev, command);
 }
 
 // SPI transaction with wait
-static uint16_t spi_trans_wait(uint16_t command)
+static uint16_t spi_trans_wait(const struct device *dev, uint16_t command)
 {
-    spi_trans(command);
-    spi_trans(0xC000);        // Dummy read
-    return spi_trans(0xC000); // Another dummy read, returns the result of the original command
+    spi_trans(dev, command);
+    spi_trans(dev, 0xC000);        // Dummy read
+    return spi_trans(dev, 0xC000); // Another dummy read, returns the result of the original command
 }
 
-// SPI check function
-static bool spi_check(void)
+// SPI check function: company ROM, then the variant and its channel count
+static int spi_check(size_t chip)
 {
-    char company[5] = {0};
-    for (int i = 0; i < 5; i++)
+    struct rhd_chip *rhd = &chips[chip];
+    int ret = rhd2232_read_info(rhd_devs[chip], &rhd->info);
+
+    if (ret)
+    {
+        return ret;
+    }
+
+    LOG_INF("Chip %zu: %s (ID %u), die revision %u, %u %s amplifiers", chip, rhd2232_variant_name(rhd->info.chip_id),
+            rhd->info.chip_id, rhd->info.die_revision, rhd->info.amplifiers,
+            rhd->info.unipolar ? "unipolar" : "bipolar");
+    if (rhd->info.amplifiers > rhd->info.channels)
     {
-        uint16_t result = spi_trans_wait(0xC000 | ((i + 40) << 8));
-        company[i] = (char)(result & 0xFF);
-        LOG_INF("ROM Register %d: 0x%04X (ASCII: %c)", i + 40, result, company[i]);
+        LOG_WRN("Chip %zu: only %u channels are read on MISO A", chip, rhd->info.channels);
     }
-    return (strncmp(company, "INTAN", 5) == 0);
+    rhd->available = (uint32_t)BIT64_MASK(rhd->info.channels);
+    return 0;
 }
 
-// RHD initialization function
-static int RHD2232_init(void)
+// RHD initialization function, one chip
+static int RHD2232_init(size_t chip)
 {
-    static const uint16_t Register_config[18] = {Register0, Register1, Register2, Register3, Register4, Register5, Register6, Register7,
-                                                 Register8, Register9, Register10, Register11, Register12, Register13, Register14, Register15,
-                                                 Register16, Register17};
+    const struct device *dev = rhd_devs[chip];
+    uint16_t Register_config[8 + RHD_BANDWIDTH_REG_COUNT] = {Register0, Register1, Register2, Register3,
+                                                             Register4, Register5, Register6, Register7};
+
+    memcpy(&Register_config[8], RHD_BANDWIDTH_PROFILES[bandwidth], sizeof(RHD_BANDWIDTH_PROFILES[bandwidth]));
 
     // Initialize SPI pipeline
     for (int i = 0; i < 12; i++)
     {
-        spi_trans(0xC000);
+        spi_trans(dev, 0xC000);
     }
 
     // Send CLEAR command
-    spi_trans_wait(CLEAR);
+    spi_trans_wait(dev, CLEAR);
 
     // Check SPI communication
-    if (!spi_check())
+    if (spi_check(chip))
     {
-        LOG_ERR("SPI check failed");
+        LOG_ERR("SPI check failed on chip %zu", chip);
         return 1;
     }
 
     // Write to registers
-    for (int i = 0; i < 18; i++)
+    for (int i = 0; i < ARRAY_SIZE(Register_config); i++)
     {
-        uint16_t result = spi_trans_wait(Register_config[i]);
+        uint16_t result = spi_trans_wait(dev, Register_config[i]);
         if ((result & 0xFF00) != 0xFF00 || (result & 0x00FF) != (Register_config[i] & 0x00FF))
         {
-            LOG_ERR("Write failed for register %d", i);
+            LOG_ERR("Write failed for register %d on chip %zu", i, chip);
             return 4;
         }
     }
 
+    // Power up only the channels in the acquisition mask
+    if (RHD_write_chip_power(chip, RHD_chip_mask(acq_config.channel_mask, chip) & chips[chip].available))
+    {
+        return 4;
+    }
+
     // Calibrate
-    spi_trans(CALIBRATE);
+    spi_trans(dev, CALIBRATE);
     for (int j = 0; j < 9; j++)
     {
-        spi_trans(0xFF00);
+        spi_trans(dev, 0xFF00);
     }
-    spi_trans(0xC000);
-    uint16_t calibrate_result = spi_trans(0xC000);
+    spi_trans(dev, 0xC000);
+    uint16_t calibrate_result = spi_trans(dev, 0xC000);
     LOG_INF("CALIBRATE done, calibrate_result: 0x%04X", calibrate_result);
 
-    LOG_INF("RHD2232 initialization complete");
+    LOG_INF("RHD2232 chip %zu initialization complete", chip);
     return 0;
 }
 
-// RHD handler function
-static void RHD_handler(struct k_work *work)
+// Amplifier channels of one chip in a channel mask
+static uint32_t RHD_chip_mask(uint64_t channel_mask, size_t chip)
 {
-    struct rhd_work_data *work_data = CONTAINER_OF(work, struct rhd_work_data, work);
-    fifo_buffer_t *fifo_buffer = work_data->fifo_buffer;
-    NeuralData sample;
+    return (uint32_t)(channel_mask >> (RHD_CHANNELS_PER_CHIP * chip));
+}
 
-    uint64_t stamp = k_uptime_get_32();
+// Generate the CONVERT table for the enabled channels, disabled channels never reach the bus.
+// Each chip gets a segment of its CONVERTs followed by its flush commands.
+static void RHD_build_convert_table(uint64_t channel_mask)
+{
+    channel_count = 0;
+    command_count = 0;
+    for (size_t c = 0; c < RHD_CHIP_COUNT; c++)
+    {
+        uint32_t chip_mask = RHD_chip_mask(channel_mask, c);
+        struct rhd_chip *rhd = &chips[c];
 
-    // Sample all channels
-    for (int i = 0; i < COMMAND_COUNT; i++)
+        rhd->offset = command_count;
+        rhd->channel_count = 0;
+        for (int ch = 0; ch < RHD_CHANNELS_PER_CHIP; ch++)
+        {
+            if (chip_mask & BIT(ch))
+            {
+                RHD_CONVERT[command_count++] = RHD_CONVERT_CMD(ch);
+                rhd->channel_count++;
+            }
+        }
+        for (size_t j = 0; j < RHD_FLUSH_COMMANDS; j++)
+        {
+            RHD_CONVERT[command_count++] = RHD_DUMMY_CMD;
+        }
+        rhd->command_count = rhd->channel_count + RHD_FLUSH_COMMANDS;
+        channel_count += rhd->channel_count;
+    }
+}
+
+// Write Register14-17 of one chip so only masked channels have their amplifiers powered
+static int RHD_write_chip_power(size_t chip, uint32_t chip_mask)
+{
+    for (int i = 0; i < RHD_POWER_REG_COUNT; i++)
     {
-        T_result[i] = spi_trans(RHD_CONVERT[i]);
+        uint16_t command = RHD_WRITE_CMD(RHD_POWER_REG_FIRST + i, (chip_mask >> (8 * i)) & 0xFF);
+        uint16_t result = spi_trans_wait(rhd_devs[chip], command);
+        if ((result & 0xFF00) != 0xFF00 || (result & 0x00FF) != (command & 0x00FF))
+        {
+            LOG_ERR("Write failed for register %d on chip %zu", RHD_POWER_REG_FIRST + i, chip);
+            return -EIO;
+        }
     }
+    return 0;
+}
 
-    // Record channels 2-17 (16 channels) into the sample
-    for (int i = 2; i < 18; i++)
+static int RHD_write_power_registers(uint64_t channel_mask)
+{
+    for (size_t c = 0; c < RHD_CHIP_COUNT; c++)
     {
-        sample.channel_data[i - 2] = T_result[i];
+        int ret = RHD_write_chip_power(c, RHD_chip_mask(channel_mask, c));
+        if (ret)
+        {
+            return ret;
+        }
     }
-    sample.timestamp = (uint32_t)(stamp - start_time);
+    return 0;
+}
+
+// Run one frame of the convert table into results, command_count words in host order
+static void RHD_sample_frame(uint16_t *results)
+{
+    uint16_t aux[RHD_FLUSH_COMMANDS];
+
+    RHD_next_aux(aux);
 
-    // Write the sample to the FIFO buffer
-    if (write_to_fifo_buffer(fifo_buffer, &sample, 1) != 1)
+    if (frame_mode)
     {
-        LOG_ERR("Failed to write neural data to FIFO buffer.");
+        for (size_t j = 0; j < RHD_FLUSH_COMMANDS; j++)
+        {
+            rhd_frame_set_word(0, channel_count + j, aux[j]);
+        }
+        if (rhd_frame_transfer(results) == 0)
+        {
+            return;
+        }
+        // Fall back to the per-word path for good if the frame engine stalls
+        LOG_ERR("Frame transfer failed, reverting to per-word SPI");
+        rhd_frame_disarm();
+        frame_mode = false;
     }
 
-    // Update the global latest_neural_data
-    latest_neural_data.data = sample;
-    latest_neural_data.sent = false;
+    // Every chip runs the same auxiliary commands, so register updates reach all of them
+    for (size_t c = 0; c < RHD_CHIP_COUNT; c++)
+    {
+        const struct rhd_chip *rhd = &chips[c];
+
+        for (size_t i = 0; i < rhd->channel_count; i++)
+        {
+            results[rhd->offset + i] = spi_trans(rhd_devs[c], RHD_CONVERT[rhd->offset + i]);
+        }
+        for (size_t j = 0; j < RHD_FLUSH_COMMANDS; j++)
+        {
+            results[rhd->offset + rhd->channel_count + j] = spi_trans(rhd_devs[c], aux[j]);
+        }
+    }
 }
 
-// Timer handler
-void my_timer_handler(struct k_timer *dummy)
+// Auxiliary commands of the next frame issued, a pending register update takes precedence over the schedule
+static void RHD_next_aux(uint16_t *aux)
+{
+    uint32_t index = aux_tx_index++;
+    const struct rhd_aux_command *schedule = RHD_AUX_SCHEDULE[index % RHD_AUX_PHASES];
+    uint32_t settle = RHD_UPDATE_SETTLE_FRAMES;
+    k_spinlock_key_t key;
+
+    for (size_t j = 0; j < RHD_FLUSH_COMMANDS; j++)
+    {
+        aux[j] = schedule[j].command;
+    }
+
+    key = k_spin_lock(&update_lock);
+    if (reg_update.state == RHD_UPDATE_QUEUED)
+    {
+        reg_update.first_index = index;
+        reg_update.state = RHD_UPDATE_ISSUING;
+    }
+    if (reg_update.state == RHD_UPDATE_ISSUING)
+    {
+        for (size_t j = 0; j < RHD_FLUSH_COMMANDS && reg_update.next < reg_update.count; j++)
+        {
+            aux[j] = reg_update.commands[reg_update.next++];
+            if (aux[j] == CALIBRATE)
+            {
+                // The next nine commands run the calibration, CONVERTs among them return invalid data.
+                // The chip with the shortest segment takes the most frames to get through them.
+                size_t segment = command_count;
+                for (size_t c = 0; c < RHD_CHIP_COUNT; c++)
+                {
+                    segment = MIN(segment, chips[c].command_count);
+                }
+                settle += DIV_ROUND_UP(RHD_CALIBRATE_COMMANDS, segment);
+                while (++j < RHD_FLUSH_COMMANDS)
+                {
+                    aux[j] = RHD_DUMMY_CMD;
+                }
+            }
+        }
+        if (reg_update.next == reg_update.count)
+        {
+            reg_update.last_index = index + settle;
+            reg_update.state = RHD_UPDATE_SETTLING;
+        }
+    }
+    k_spin_unlock(&update_lock, key);
+}
+
+// Load the auxiliary commands of the next frame issued into a block frame of the frame engine
+static void RHD_aux_patch(size_t frame)
 {
-    k_work_submit_to_queue(&intan_work_q, &rhd_work.work);
+    uint16_t aux[RHD_FLUSH_COMMANDS];
+
+    RHD_next_aux(aux);
+    for (size_t j = 0; j < RHD_FLUSH_COMMANDS; j++)
+    {
+        rhd_frame_set_word(frame, channel_count + j, aux[j]);
+    }
 }
 
-int intan_init(fifo_buffer_t *fifo_buffer)
+// Flag a decoded frame against the register update in flight. Returns true while injected
+// commands displace the frame's auxiliary results; the frame carrying the first command
+// is not flagged as its CONVERTs all ran before it.
+static bool RHD_update_window(uint32_t index, uint32_t *flags)
 {
-    LOG_INF("Intan initialization starting...");
-    LOG_INF("spi2 %s", DT_NODE_HAS_STATUS(DT_NODELABEL(spi2), okay) ? "found" : "not found");
-    LOG_INF("RHD2232 %s", DT_NODE_HAS_STATUS(DT_NODELABEL(rhd2232), okay) ? "found" : "not found");
+    bool inside = false;
+    k_spinlock_key_t key = k_spin_lock(&update_lock);
 
-    // Initialize the custom work queue with high priority
-    k_work_queue_init(&intan_work_q);
-    k_work_queue_start(&intan_work_q, intan_work_q_stack,
-                       K_THREAD_STACK_SIZEOF(intan_work_q_stack),
-                       INTAN_WORK_Q_PRIORITY, NULL);
+    if ((reg_update.state == RHD_UPDATE_ISSUING || reg_update.state == RHD_UPDATE_SETTLING) &&
+        index >= reg_update.first_index)
+    {
+        if (reg_update.state == RHD_UPDATE_ISSUING || index <= reg_update.last_index)
+        {
+            inside = true;
+            if (index > reg_update.first_index)
+            {
+                *flags |= reg_update.flags;
+            }
+        }
+        if (reg_update.state == RHD_UPDATE_SETTLING && index >= reg_update.last_index)
+        {
+            // Only now report the new profile, in intan_get_registers() and session headers
+            if (reg_update.bandwidth >= 0)
+            {
+                bandwidth = reg_update.bandwidth;
+            }
+            reg_update.state = RHD_UPDATE_IDLE;
+        }
+    }
+    k_spin_unlock(&update_lock, key);
 
-    // Initialize work and timer
-    k_work_init(&rhd_work.work, RHD_handler);
-    rhd_work.fifo_buffer = fifo_buffer;
-    k_timer_init(&RHD_timer, my_timer_handler, NULL);
+    return inside;
+}
 
-    // Initialize SPI
-    spi_init();
+static uint8_t RHD_battery_level(uint32_t supply_mv)
+{
+    if (supply_mv <= RHD_BATTERY_EMPTY_MV)
+    {
+        return 0;
+    }
+    if (supply_mv >= RHD_BATTERY_FULL_MV)
+    {
+        return 100;
+    }
+    return (supply_mv - RHD_BATTERY_EMPTY_MV) * 100 / (RHD_BATTERY_FULL_MV - RHD_BATTERY_EMPTY_MV);
+}
+
+static void RHD_aux_result(uint32_t index, size_t slot, uint16_t result)
+{
+    int32_t temperature;
+    uint32_t supply_mv;
 
-    // Initialize RHD2232
-    for (int retry_count = 0; retry_count < 5; retry_count++)
+    switch (RHD_AUX_SCHEDULE[index % RHD_AUX_PHASES][slot].kind)
     {
-        if (RHD2232_init() == 0)
+    case RHD_AUX_TEMP_S1:
+        aux_temp_s1 = result;
+        aux_temp_s1_valid = true;
+        break;
+    case RHD_AUX_TEMP_S2:
+        if (!aux_temp_s1_valid)
         {
-            RHD_init = true;
             break;
         }
-        LOG_ERR("RHD2232 init failed (Attempt %d of 5)", retry_count + 1);
-        k_sleep(K_MSEC(1000));
+        // T = (S2 - S1) / 98.9 - 273.15 degC, kept in hundredths
+        temperature = ((int32_t)result - aux_temp_s1) * 10000 / 989 - 27315;
+        aux_status.temperature_centi_c = temperature;
+        device_status.temperature = CLAMP(temperature / 100, INT8_MIN, INT8_MAX);
+        aux_temp_s1_valid = false;
+        break;
+    case RHD_AUX_SUPPLY:
+        // 74.8 uV per LSB
+        supply_mv = (uint32_t)result * 748 / 10000;
+        aux_status.supply_mv = supply_mv;
+        device_status.battery_level = RHD_battery_level(supply_mv);
+        break;
+    case RHD_AUX_IN1:
+    case RHD_AUX_IN2:
+    case RHD_AUX_IN3:
+        aux_status.aux_in[RHD_AUX_SCHEDULE[index % RHD_AUX_PHASES][slot].kind - RHD_AUX_IN1] = result;
+        break;
+    default:
+        break;
     }
+}
 
-    if (!RHD_init)
+// Pick the auxiliary results out of a frame, index is the sample index of that frame
+static void RHD_aux_collect(const uint16_t *frame, size_t words, bool wire_order, uint32_t index)
+{
+    uint16_t last = wire_order ? rhd_frame_result(frame, words - 1) : frame[words - 1];
+
+    RHD_aux_result(index, 0, last);
+    if (index > 0 && index != aux_gap_index)
     {
-        LOG_ERR("Max retries reached. Initialization failed.");
-        return -1;
+        RHD_aux_result(index - 1, 1, wire_order ? rhd_frame_result(frame, 0) : frame[0]);
+        RHD_aux_result(index - 1, 2, wire_order ? rhd_frame_result(frame, 1) : frame[1]);
     }
+}
 
-    LOG_INF("Intan initialization complete");
-    return 0;
+// Compare the per-word and single-transaction paths in CPU cycles
+static void RHD_benchmark(void)
+{
+    timing_t start, end;
+    uint64_t word_cycles, frame_cycles;
+
+    timing_init();
+    timing_start();
+
+    start = timing_counter_get();
+    for (int n = 0; n < RHD_BENCH_FRAMES; n++)
+    {
+        for (size_t c = 0; c < RHD_CHIP_COUNT; c++)
+        {
+            for (size_t i = chips[c].offset; i < chips[c].offset + chips[c].command_count; i++)
+            {
+                T_result[i] = spi_trans(rhd_devs[c], RHD_CONVERT[i]);
+            }
+        }
+    }
+    end = timing_counter_get();
+    word_cycles = timing_cycles_get(&start, &end) / RHD_BENCH_FRAMES;
+    LOG_INF("Per-word SPI: %llu cycles/frame (%llu ns)", word_cycles, timing_cycles_to_ns(word_cycles));
+
+    // Without the frame engine (e.g. native_sim with the RHD2232 emulator) only the per-word path exists
+    if (frame_mode)
+    {
+        rhd_frame_arm();
+        start = timing_counter_get();
+        for (int n = 0; n < RHD_BENCH_FRAMES; n++)
+        {
+            rhd_frame_transfer(T_result);
+        }
+        end = timing_counter_get();
+        frame_cycles = timing_cycles_get(&start, &end) / RHD_BENCH_FRAMES;
+        LOG_INF("Frame transfer: %llu cycles/frame (%llu ns)", frame_cycles, timing_cycles_to_ns(frame_cycles));
+    }
+
+    timing_stop();
 }
 
-// Main intan thread function
-void intan_thread(void *arg1, void *arg2, void *arg3)
+// Uptime in ns of a sample of the run being acquired from its index, exact because the clock holds the
+// long-run rate
+static int64_t RHD_sample_time_ns(uint32_t index)
 {
-    fifo_buffer_t *fifo_buffer = (fifo_buffer_t *)arg1;
-    start_time = k_uptime_get();
+    return stream_start_ns + (int64_t)(((uint64_t)index * NSEC_PER_SEC) / acq_config.sample_rate_hz);
+}
 
-    LOG_INF("Intan thread starting...");
+// The same for a sample of the run being decoded
+static int64_t RHD_decoded_time_ns(uint32_t index)
+{
+    return decode_run.start_ns + (int64_t)(((uint64_t)index * NSEC_PER_SEC) / decode_run.sample_rate_hz);
+}
+
+// Timestamp of a decoded sample from its index, see intan.h for the reconstruction rule
+static uint32_t RHD_sample_timestamp(uint32_t index)
+{
+    return (uint32_t)(RHD_decoded_time_ns(index) / NSEC_PER_MSEC - start_time);
+}
+
+// Compare the acquisition clock with the kernel clock at the last sample of a block. Drift is only
+// measured on the hardware-timed path: TIMER4 runs from the HFXO, the kernel clock from the LFXO.
+// The RTC2 alarms and k_timer run from the same LFXO as the kernel clock, so there the comparison
+// could only ever read zero and just the late frames and frame timing are reported.
+static void RHD_clock_update(uint32_t index)
+{
+    int64_t offset = k_ticks_to_ns_floor64(k_uptime_ticks()) - RHD_decoded_time_ns(index);
+
+    clock_stats.samples = index + 1;
+    clock_stats.drift_measured = hw_timed;
+    clock_track.window_min = MIN(clock_track.window_min, offset);
+    if (index < clock_track.window_end)
+    {
+        return;
+    }
+
+    if (!clock_track.have_base)
+    {
+        clock_track.base_offset = clock_track.window_min;
+        clock_track.base_index = index;
+        clock_track.have_base = true;
+    }
+    else
+    {
+        if (hw_timed)
+        {
+            int64_t elapsed = RHD_decoded_time_ns(index) - RHD_decoded_time_ns(clock_track.base_index);
+
+            // Positive: samples arrive later than the nominal rate predicts, the acquisition clock is slow
+            clock_stats.cumulative_ns = clock_track.window_min - clock_track.base_offset;
+            clock_stats.drift_ppb = (int32_t)(clock_stats.cumulative_ns * 1000000000LL / elapsed);
+            LOG_INF("Acquisition clock: %llu samples, cumulative error %lld us, drift %d ppb against the LFXO",
+                    clock_stats.samples, clock_stats.cumulative_ns / NSEC_PER_USEC, clock_stats.drift_ppb);
+        }
+        else
+        {
+            LOG_INF("Acquisition clock: %llu samples, %u late frames", clock_stats.samples, clock_stats.late_frames);
+        }
+        LOG_INF("Frame timing: interval %u-%u us, worst handler %u us, %u coalesced, %u overrun ticks",
+                timing_stats.interval_min_ns / NSEC_PER_USEC, timing_stats.interval_max_ns / NSEC_PER_USEC,
+                timing_stats.handler_max_ns / NSEC_PER_USEC, timing_stats.coalesced_ticks,
+                timing_stats.overrun_ticks);
+    }
+
+    clock_track.window_min = INT64_MAX;
+    clock_track.window_end = index + decode_run.sample_rate_hz * RHD_CLOCK_REPORT_S;
+}
+
+// Restart the timing statistics, sampling keeps its previous frame as the interval reference
+static void RHD_timing_clear(void)
+{
+    memset(&timing_stats, 0, sizeof(timing_stats));
+    timing_stats.interval_min_ns = UINT32_MAX;
+}
+
+static uint32_t RHD_timing_ns(timing_t *start, timing_t *end)
+{
+    return (uint32_t)((timing_cycles_get(start, end) * timing_ns_per_cycle_q16) >> 16);
+}
+
+// A frame (or a block of frames on the hardware-timed path) was taken at now
+static void RHD_timing_frame(timing_t now, size_t frames)
+{
+    k_spinlock_key_t key = k_spin_lock(&timing_lock);
+
+    if (timing_have_last)
+    {
+        uint32_t interval = RHD_timing_ns(&timing_last, &now);
+        uint32_t nominal = timing_period_ns * frames;
+        uint32_t deviation_us = (interval > nominal ? interval - nominal : nominal - interval) / NSEC_PER_USEC;
+        size_t bucket = deviation_us == 0 ? 0 : 32 - __builtin_clz(deviation_us);
 
-    // Start timer to begin sampling
-    k_timer_start(&RHD_timer, K_SECONDS(3), K_USEC(1000000 / SAMPLE_RATE_HZ));
+        timing_stats.interval_hist[MIN(bucket, INTAN_JITTER_BUCKETS - 1)]++;
+        timing_stats.interval_min_ns = MIN(timing_stats.interval_min_ns, interval);
+        timing_stats.interval_max_ns = MAX(timing_stats.interval_max_ns, interval);
+    }
+    timing_last = now;
+    timing_have_last = true;
+    k_spin_unlock(&timing_lock, key);
+}
+
+// A frame handler that started at start returns
+static void RHD_timing_handler(timing_t *start)
+{
+    timing_t end = timing_counter_get();
+    uint32_t ns = RHD_timing_ns(start, &end);
+    k_spinlock_key_t key = k_spin_lock(&timing_lock);
+
+    timing_stats.handler_max_ns = MAX(timing_stats.handler_max_ns, ns);
+    k_spin_unlock(&timing_lock, key);
+}
+
+// Decode one frame of results into a sample, laid out as the block header describes
+static void RHD_decode_frame(const uint16_t *frame, const struct rhd2232_block_header *header, NeuralData *sample)
+{
+    bool wire_order = header->wire_order;
+    size_t offset = 0;
+    size_t chip0_words = 0;
+
+    // The pipeline delays each result by two commands within each chip's segment, disabled channels read as 0
+    memset(sample->channel_data, 0, sizeof(sample->channel_data));
+    for (size_t c = 0; c < header->chips; c++)
+    {
+        uint32_t mask = RHD_chip_mask(header->channel_mask, c);
+        size_t slot = offset + RHD_PIPELINE_DEPTH;
+
+        while (mask != 0)
+        {
+            int ch = find_lsb_set(mask) - 1;
+
+            sample->channel_data[RHD_CHANNELS_PER_CHIP * c + ch] =
+                wire_order ? rhd_frame_result(frame, slot) : frame[slot];
+            mask &= mask - 1;
+            slot++;
+        }
+        offset = slot - RHD_PIPELINE_DEPTH + header->flush_words;
+        if (c == 0)
+        {
+            chip0_words = offset;
+        }
+    }
+    sample->flags = 0;
+    if (RHD_update_window(sample_index, &sample->flags))
+    {
+        // The temperature pair may straddle the update, start it over
+        aux_temp_s1_valid = false;
+    }
+    else
+    {
+        RHD_aux_collect(frame, chip0_words, wire_order, sample_index);
+    }
+    sample->index = sample_index;
+    sample->timestamp = RHD_sample_timestamp(sample_index++);
+}
+
+// Hand a finished block to the read that owns its buffer, a block in the scratch or frame engine buffers
+// had no read pending and is dropped. frames == 0 returns a claimed buffer unused.
+static void RHD_block_complete(uint16_t *results, size_t frames, bool wire_order)
+{
+    struct rhd2232_block_header header = {
+        .timestamp_ns = RHD_sample_time_ns(block_first_index),
+        .start_ns = stream_start_ns,
+        .first_index = block_first_index,
+        .sample_rate_hz = acq_config.sample_rate_hz,
+        .channel_mask = acq_config.channel_mask,
+        .run = acq_run,
+        .frames = frames,
+        .words = command_count,
+        .wire_order = wire_order,
+        .chips = RHD_CHIP_COUNT,
+        .flush_words = RHD_FLUSH_COMMANDS,
+    };
+
+    if (rhd2232_block_put(rhd_devs[0], results, &header) != 0 && frames > 0)
+    {
+        blocks_dropped++;
+        data_stats_add(DATA_STAT_PRODUCED, frames);
+        data_stats_add(DATA_STAT_FIFO_DROPPED, frames);
+    }
+    block_first_index += frames;
+}
+
+// Claim the buffer the next block is written into
+static uint16_t *RHD_block_claim(void)
+{
+    return rhd2232_block_get(rhd_devs[0], block_size, command_count);
+}
+
+// Hand back claimed buffers no frame has landed in: the block being filled, if it has not started, and the
+// one queued after it
+static void RHD_block_release_queued(void)
+{
+    if (block_results != NULL)
+    {
+        RHD_block_complete(block_results, 0, true);
+        block_results = NULL;
+    }
+    if (block_queued != NULL)
+    {
+        RHD_block_complete(block_queued, 0, true);
+        block_queued = NULL;
+    }
+}
+
+// Frame periods that passed without a frame being taken. The block is closed at the gap and the
+// indices skipped, TX side included, so the loss shows up as missing samples and every later
+// sample keeps the index and timestamp of its own tick.
+static void RHD_frames_lost(uint32_t lost)
+{
+    if (block_results != NULL)
+    {
+        RHD_block_complete(block_results, block_fill, false);
+        block_results = NULL;
+        block_fill = 0;
+    }
+    block_first_index += lost;
+    aux_tx_index += lost;
+}
+
+// RHD handler function, per-word SPI path: one frame per tick, completed once per block
+static void RHD_handler(struct k_work *work)
+{
+    timing_t start = timing_counter_get();
+    uint32_t lost = atomic_clear(&frames_lost);
+
+    RHD_timing_frame(start, 1);
+    if (lost > 0)
+    {
+        RHD_frames_lost(lost);
+    }
+    if (block_fill == 0)
+    {
+        block_results = RHD_block_claim();
+        if (block_results == NULL)
+        {
+            block_results = block_scratch;
+        }
+    }
+
+    // Sample all channels
+    RHD_sample_frame(&block_results[block_fill * command_count]);
+
+    if (++block_fill == block_size)
+    {
+        RHD_block_complete(block_results, block_fill, false);
+        block_results = NULL;
+        block_fill = 0;
+    }
+    RHD_timing_handler(&start);
+}
+
+// Block interrupt from the hardware-timed stream, the only CPU wakeup per block
+static void RHD_block_ready(const uint16_t *results, size_t frames)
+{
+    timing_t start = timing_counter_get();
+
+    RHD_timing_frame(start, frames);
+    // The next block has started, its frame f goes out f sample periods in, rotate in its auxiliary
+    // commands in frame order
+    for (size_t f = 0; f < frames; f++)
+    {
+        RHD_aux_patch(f);
+    }
+
+    // The SPIM wrote this block straight into the read's buffer and already points at the queued one,
+    // claim the read for the block after that
+    RHD_block_complete((uint16_t *)results, frames, true);
+    block_results = block_queued;
+    block_queued = RHD_block_claim();
+    rhd_frame_set_rx(block_queued);
+    RHD_timing_handler(&start);
+}
+
+// First block of a new run: its timing, and decoding state that must not carry over from the last run
+static void RHD_decode_run_begin(const struct rhd2232_block_header *header)
+{
+    decode_run = (struct rhd_decode_run){
+        .start_ns = header->start_ns,
+        .sample_rate_hz = header->sample_rate_hz,
+        .run = header->run,
+        .valid = true,
+    };
+    // Aux results leading the first frame belong to frames of the last run, or to frames never taken
+    aux_gap_index = header->first_index;
+    aux_temp_s1_valid = false;
+    // Late frames are counted by the acquisition side, from the restart on
+    clock_stats = (struct intan_clock_stats){.late_frames = clock_stats.late_frames};
+    memset(&clock_track, 0, sizeof(clock_track));
+    clock_track.window_min = INT64_MAX;
+    clock_track.window_end = decode_run.sample_rate_hz * RHD_CLOCK_REPORT_S;
+}
+
+// Decode a completed read and publish its samples
+static void RHD_consume_block(fifo_buffer_t *fifo_buffer, const uint8_t *buf)
+{
+    const struct rhd2232_block_header *header = (const struct rhd2232_block_header *)buf;
+    const uint16_t *results = rhd2232_block_results(buf);
+    fifo_write_span_t span;
+    NeuralData dropped;
+    size_t reserved;
+    size_t f = 0;
+
+    if (header->frames == 0)
+    {
+        return;
+    }
+
+    data_stats_add(DATA_STAT_PRODUCED, header->frames);
+    if (!decode_run.valid || header->run != decode_run.run)
+    {
+        RHD_decode_run_begin(header);
+    }
+    else if (header->first_index != sample_index)
+    {
+        // Frames lost before this block: the first one's leading aux results belong to a frame never decoded
+        aux_gap_index = header->first_index;
+        aux_temp_s1_valid = false;
+    }
+    sample_index = header->first_index;
+    reserved = fifo_buffer_reserve(fifo_buffer, header->frames, &span);
+    for (size_t run = 0; run < ARRAY_SIZE(span.data); run++)
+    {
+        for (size_t i = 0; i < span.count[run]; i++, f++)
+        {
+            RHD_decode_frame(&results[f * header->words], header, &span.data[run][i]);
+        }
+    }
+    fifo_buffer_commit(fifo_buffer, reserved);
+
+    if (f < header->frames)
+    {
+        // FIFO full: the rest is still decoded for the aux results and update windows, then dropped
+        LOG_ERR("Failed to write neural data to FIFO buffer, dropped %zu of %u samples.", header->frames - f,
+                header->frames);
+        data_stats_add(DATA_STAT_FIFO_DROPPED, header->frames - f);
+        for (; f < header->frames; f++)
+        {
+            RHD_decode_frame(&results[f * header->words], header, &dropped);
+        }
+    }
+
+    RHD_clock_update(sample_index - 1);
+}
+
+// One frame from the timer ISR through the frame engine
+static void RHD_frame_tick(void)
+{
+    if (block_fill == 0)
+    {
+        block_results = RHD_block_claim();
+        if (block_results == NULL)
+        {
+            block_results = block_scratch;
+        }
+    }
+    RHD_aux_patch(0);
+    if (rhd_frame_transfer(&block_results[block_fill * command_count]) != 0)
+    {
+        // Hand the bus back to the SPI driver, the next tick takes the per-word path. The block ends
+        // at the failed frame and its index is skipped; its aux commands already counted on the TX side.
+        rhd_frame_disarm();
+        frame_mode = false;
+        RHD_block_complete(block_results, block_fill, false);
+        block_results = NULL;
+        block_fill = 0;
+        block_first_index++;
+        return;
+    }
+    if (++block_fill == block_size)
+    {
+        RHD_block_complete(block_results, block_fill, false);
+        block_results = NULL;
+        block_fill = 0;
+    }
+}
+
+// One frame period elapsed on the software-started paths
+static void RHD_tick(void)
+{
+    k_spinlock_key_t key;
+    int ret;
+
+    // The frame engine is safe to run from the timer ISR, so the workqueue is not involved at all
+    if (frame_mode)
+    {
+        timing_t start = timing_counter_get();
+
+        RHD_timing_frame(start, 1);
+        RHD_frame_tick();
+        RHD_timing_handler(&start);
+        return;
+    }
+
+    ret = k_work_submit_to_queue(&intan_work_q, &rhd_work);
+    if (ret == 0)
+    {
+        // Still queued from the last tick, this frame is never taken; the handler skips its index
+        atomic_inc(&frames_lost);
+        key = k_spin_lock(&timing_lock);
+        timing_stats.coalesced_ticks++;
+        k_spin_unlock(&timing_lock, key);
+        data_stats_add(DATA_STAT_LATE, 1);
+    }
+    else if (ret == 2)
+    {
+        // Still running, requeued and taken late
+        key = k_spin_lock(&timing_lock);
+        timing_stats.overrun_ticks++;
+        k_spin_unlock(&timing_lock, key);
+    }
+}
+
+// Timer handler, boards without a counter clock
+void my_timer_handler(struct k_timer *dummy)
+{
+    RHD_tick();
+}
+
+#if RHD_COUNTER_CLOCK
+static void RHD_clock_alarm(const struct device *dev, uint8_t chan_id, uint32_t ticks, void *user_data);
+
+// Advance the tick grid by one frame and arm the alarm, a frame already in the past fires at once
+static void RHD_clock_schedule_next(void)
+{
+    struct counter_alarm_cfg alarm = {
+        .callback = RHD_clock_alarm,
+        .flags = COUNTER_ALARM_CFG_ABSOLUTE | COUNTER_ALARM_CFG_EXPIRE_WHEN_LATE,
+    };
+    int ret;
+
+    clock_sched.next_tick += clock_sched.period;
+    clock_sched.acc += clock_sched.remainder;
+    if (clock_sched.acc >= acq_config.sample_rate_hz)
+    {
+        clock_sched.acc -= acq_config.sample_rate_hz;
+        clock_sched.next_tick++;
+    }
+
+    alarm.ticks = (uint32_t)(clock_sched.next_tick % ((uint64_t)counter_get_top_value(rhd_clock) + 1));
+    ret = counter_set_channel_alarm(rhd_clock, 0, &alarm);
+    if (ret == -ETIME)
+    {
+        clock_stats.late_frames++;
+        data_stats_add(DATA_STAT_LATE, 1);
+    }
+    else if (ret)
+    {
+        LOG_ERR("Acquisition clock alarm failed (%d)", ret);
+    }
+}
+
+static void RHD_clock_alarm(const struct device *dev, uint8_t chan_id, uint32_t ticks, void *user_data)
+{
+    if (!clock_sched.running)
+    {
+        return;
+    }
+    RHD_clock_schedule_next();
+    RHD_tick();
+}
+
+// First frame one period after delay_ms from now, stream_start_ns is the uptime of that tick
+static int RHD_clock_start(uint32_t delay_ms)
+{
+    uint32_t freq = counter_get_frequency(rhd_clock);
+    uint64_t delay_ticks = counter_us_to_ticks(rhd_clock, (uint64_t)delay_ms * USEC_PER_MSEC);
+    uint32_t now;
+    int ret;
+
+    ret = counter_get_value(rhd_clock, &now);
+    if (ret)
+    {
+        return ret;
+    }
+
+    clock_sched.period = freq / acq_config.sample_rate_hz;
+    clock_sched.remainder = freq % acq_config.sample_rate_hz;
+    clock_sched.acc = 0;
+    // The first frame lands one period after the delay, so a zero delay never arms an alarm in the past
+    clock_sched.next_tick = now + delay_ticks;
+    clock_sched.running = true;
+    stream_start_ns = k_ticks_to_ns_floor64(k_uptime_ticks()) +
+                      (int64_t)((delay_ticks + clock_sched.period) * NSEC_PER_SEC / freq);
+    RHD_clock_schedule_next();
+
+    LOG_INF("Acquisition clock: %u Hz from %u Hz counter, %u + %u/%u ticks per frame",
+            acq_config.sample_rate_hz, freq, clock_sched.period, clock_sched.remainder, acq_config.sample_rate_hz);
+    return 0;
+}
+
+static void RHD_clock_stop(void)
+{
+    clock_sched.running = false;
+    counter_cancel_channel_alarm(rhd_clock, 0);
+}
+#else
+static int RHD_clock_start(uint32_t delay_ms)
+{
+    return -ENOTSUP;
+}
+
+static void RHD_clock_stop(void)
+{
+}
+#endif // RHD_COUNTER_CLOCK
+
+// Start acquisition at the configured rate, the first sample lands after delay_ms
+static void RHD_start_sampling(uint32_t delay_ms)
+{
+    k_spinlock_key_t key;
+
+    // Decoding state belongs to intan_thread, it starts over when the first block of this run arrives
+    acq_run++;
+    block_fill = 0;
+    block_results = NULL;
+    block_first_index = 0;
+    atomic_clear(&frames_lost);
+    aux_tx_index = 0;
+    sampling = true;
+    clock_stats.late_frames = 0;
+
+    // The cycle counter runs while sampling, timing_start() and timing_stop() nest
+    key = k_spin_lock(&timing_lock);
+    RHD_timing_clear();
+    timing_have_last = false;
+    timing_period_ns = NSEC_PER_SEC / acq_config.sample_rate_hz;
+    timing_ns_per_cycle_q16 = (uint32_t)(((uint64_t)NSEC_PER_SEC << 16) / timing_freq_get());
+    k_spin_unlock(&timing_lock, key);
+    timing_start();
+
+    // Sample indices restart, so an interrupted register update is issued again from the top
+    key = k_spin_lock(&update_lock);
+    if (reg_update.state == RHD_UPDATE_ISSUING || reg_update.state == RHD_UPDATE_SETTLING)
+    {
+        reg_update.next = 0;
+        reg_update.state = RHD_UPDATE_QUEUED;
+    }
+    k_spin_unlock(&update_lock, key);
+
+#if RHD_HW_TIMED
+    // Hardware-timed path: TIMER4 starts frames, the CPU only sees one interrupt per block
+    if (frame_mode && acq_mode == INTAN_MODE_HW_TIMED)
+    {
+        for (size_t f = 0; f < block_size; f++)
+        {
+            RHD_aux_patch(f);
+        }
+        k_sleep(K_MSEC(delay_ms));
+        // Buffers are chosen a block ahead: the first block's and the second's
+        block_results = RHD_block_claim();
+        rhd_frame_set_rx(block_results);
+        block_queued = RHD_block_claim();
+        rhd_frame_set_rx(block_queued);
+        // Sample 0 is timed from the sample clock start, after the HFXO spin-up
+        if (rhd_frame_stream_start(acq_config.sample_rate_hz, block_size, RHD_block_ready, &stream_start_ns) == 0)
+        {
+            hw_timed = true;
+            return;
+        }
+        RHD_block_release_queued();
+        rhd_frame_clear_rx();
+        LOG_WRN("Hardware-timed acquisition unavailable, using the acquisition clock");
+        delay_ms = 0;
+    }
+#endif
+
+    if (RHD_clock_start(delay_ms) == 0)
+    {
+        return;
+    }
+
+    LOG_WRN("Acquisition clock unavailable, using k_timer");
+    stream_start_ns = k_ticks_to_ns_floor64(k_uptime_ticks()) + (int64_t)delay_ms * NSEC_PER_MSEC;
+    k_timer_start(&RHD_timer, K_MSEC(delay_ms), K_USEC(1000000 / acq_config.sample_rate_hz));
+}
+
+// Stop acquisition and complete whatever is left of the current block
+static void RHD_stop_sampling(void)
+{
+    struct k_work_sync sync;
+    size_t stream_frames;
+
+    k_timer_stop(&RHD_timer);
+    RHD_clock_stop();
+    // Returns once the frame in flight has landed, with the frames of the block left unfinished
+    stream_frames = rhd_frame_stream_stop();
+
+    k_work_flush(&rhd_work, &sync);
+
+    if (block_results != NULL)
+    {
+        if (hw_timed)
+        {
+            RHD_block_complete(block_results, stream_frames, true);
+        }
+        else
+        {
+            RHD_block_complete(block_results, block_fill, false);
+        }
+        block_results = NULL;
+    }
+    RHD_block_release_queued();
+    block_fill = 0;
+    hw_timed = false;
+
+    timing_stop();
+    sampling = false;
+}
+
+int intan_configure(const struct intan_acq_config *config)
+{
+    bool was_sampling;
+    int ret = 0;
+
+    if (config == NULL || config->sample_rate_hz == 0 || config->sample_rate_hz > INTAN_MAX_SAMPLE_RATE_HZ ||
+        config->channel_mask == 0 || (config->channel_mask & ~available_mask) != 0)
+    {
+        return -EINVAL;
+    }
+
+    k_mutex_lock(&config_lock, K_FOREVER);
+
+    was_sampling = sampling;
+    if (was_sampling)
+    {
+        RHD_stop_sampling();
+    }
+
+    // Register writes go through the per-word path, so take the bus back from the frame engine
+    if (frame_mode)
+    {
+        rhd_frame_disarm();
+    }
+
+    if (RHD_init && config->channel_mask != acq_config.channel_mask)
+    {
+        ret = RHD_write_power_registers(config->channel_mask);
+    }
+
+    if (ret == 0)
+    {
+        acq_config = *config;
+        RHD_build_convert_table(acq_config.channel_mask);
+        LOG_INF("Acquisition config: %u Hz, channel mask 0x%016llx (%zu channels, %zu commands/frame)",
+                acq_config.sample_rate_hz, (unsigned long long)acq_config.channel_mask, channel_count, command_count);
+    }
+    else
+    {
+        LOG_ERR("Power register update failed, keeping previous configuration");
+    }
+
+    if (frame_mode)
+    {
+        if (rhd_frame_load(RHD_CONVERT, command_count) == 0)
+        {
+            rhd_frame_arm();
+        }
+        else
+        {
+            frame_mode = false;
+        }
+    }
+
+    if (was_sampling)
+    {
+        RHD_start_sampling(0);
+    }
+
+    k_mutex_unlock(&config_lock);
+    return ret;
+}
+
+void intan_get_config(struct intan_acq_config *config)
+{
+    k_mutex_lock(&config_lock, K_FOREVER);
+    *config = acq_config;
+    k_mutex_unlock(&config_lock);
+}
+
+int intan_set_mode(enum intan_acq_mode mode)
+{
+    bool was_sampling;
+    int ret = 0;
+
+    if ((unsigned int)mode >= INTAN_MODE_COUNT)
+    {
+        return -EINVAL;
+    }
+    if (mode != INTAN_MODE_PER_WORD && !frame_available)
+    {
+        return -ENOTSUP;
+    }
+
+    k_mutex_lock(&config_lock, K_FOREVER);
+
+    was_sampling = sampling;
+    if (was_sampling)
+    {
+        RHD_stop_sampling();
+    }
+
+    if (mode == INTAN_MODE_PER_WORD)
+    {
+        // Hand the bus back to the SPI driver
+        rhd_frame_disarm();
+        frame_mode = false;
+    }
+    else if (!frame_mode)
+    {
+        if (rhd_frame_load(RHD_CONVERT, command_count) == 0)
+        {
+            rhd_frame_arm();
+            frame_mode = true;
+        }
+        else
+        {
+            ret = -ENOTSUP;
+        }
+    }
+    if (ret == 0)
+    {
+        acq_mode = mode;
+        LOG_INF("Acquisition mode %d", mode);
+    }
+
+    if (was_sampling)
+    {
+        RHD_start_sampling(0);
+    }
+
+    k_mutex_unlock(&config_lock);
+    return ret;
+}
+
+enum intan_acq_mode intan_get_mode(void)
+{
+    if (!frame_mode)
+    {
+        return INTAN_MODE_PER_WORD;
+    }
+    // The hardware-timed stream falls back to the acquisition clock when it cannot start
+    if (acq_mode == INTAN_MODE_HW_TIMED && sampling && !hw_timed)
+    {
+        return INTAN_MODE_FRAME;
+    }
+    return acq_mode;
+}
+
+static int RHD_queue_update(const uint16_t *commands, size_t count, uint32_t flags, int profile)
+{
+    k_spinlock_key_t key = k_spin_lock(&update_lock);
+
+    if (reg_update.state != RHD_UPDATE_IDLE)
+    {
+        k_spin_unlock(&update_lock, key);
+        return -EBUSY;
+    }
+
+    memcpy(reg_update.commands, commands, count * sizeof(commands[0]));
+    reg_update.count = count;
+    reg_update.next = 0;
+    reg_update.flags = flags;
+    reg_update.bandwidth = profile;
+    reg_update.state = RHD_UPDATE_QUEUED;
+    k_spin_unlock(&update_lock, key);
+
+    return 0;
+}
+
+int intan_set_bandwidth(enum intan_bandwidth profile)
+{
+    int ret;
+
+    if ((unsigned int)profile >= INTAN_BW_COUNT)
+    {
+        return -EINVAL;
+    }
+
+    // The reported profile changes when the update has settled, a full initialization before then
+    // writes the old one and the queued update follows it
+    ret = RHD_queue_update(RHD_BANDWIDTH_PROFILES[profile], RHD_BANDWIDTH_REG_COUNT, NEURAL_DATA_FLAG_RECONFIG,
+                           profile);
+    if (ret == 0)
+    {
+        LOG_INF("Bandwidth profile %d queued", profile);
+    }
+    return ret;
+}
+
+int intan_calibrate(void)
+{
+    static const uint16_t calibrate[] = {CALIBRATE};
+
+    return RHD_queue_update(calibrate, ARRAY_SIZE(calibrate), NEURAL_DATA_FLAG_RECONFIG | NEURAL_DATA_FLAG_CALIBRATING,
+                            -1);
+}
+
+bool intan_update_pending(void)
+{
+    return reg_update.state != RHD_UPDATE_IDLE;
+}
+
+int64_t intan_sample_time_ns(uint32_t index)
+{
+    // Samples reach the FIFO decoded, so they are timed as the run that decoded them
+    return decode_run.valid ? RHD_decoded_time_ns(index) : RHD_sample_time_ns(index);
+}
+
+void intan_get_clock_stats(struct intan_clock_stats *stats)
+{
+    *stats = clock_stats;
+}
+
+void intan_get_timing_stats(struct intan_timing_stats *stats)
+{
+    k_spinlock_key_t key = k_spin_lock(&timing_lock);
+
+    *stats = timing_stats;
+    k_spin_unlock(&timing_lock, key);
+}
+
+void intan_reset_timing_stats(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&timing_lock);
+
+    RHD_timing_clear();
+    k_spin_unlock(&timing_lock, key);
+}
+
+void intan_get_aux_status(struct intan_aux_status *status)
+{
+    *status = aux_status;
+}
+
+uint64_t intan_available_channels(void)
+{
+    return available_mask;
+}
+
+int intan_get_registers(size_t chip, uint8_t regs[INTAN_REGISTER_COUNT])
+{
+    static const uint16_t fixed[] = {Register0, Register1, Register2, Register3,
+                                     Register4, Register5, Register6, Register7};
+    struct intan_acq_config config;
+    uint32_t chip_mask;
+
+    if (chip >= RHD_CHIP_COUNT)
+    {
+        return -EINVAL;
+    }
+    if (!RHD_init)
+    {
+        return -ENODEV;
+    }
+
+    intan_get_config(&config);
+    chip_mask = RHD_chip_mask(config.channel_mask, chip) & chips[chip].available;
+    for (int i = 0; i < ARRAY_SIZE(fixed); i++)
+    {
+        regs[i] = fixed[i] & 0xFF;
+    }
+    for (int i = 0; i < RHD_BANDWIDTH_REG_COUNT; i++)
+    {
+        regs[ARRAY_SIZE(fixed) + i] = RHD_BANDWIDTH_PROFILES[bandwidth][i] & 0xFF;
+    }
+    for (int i = 0; i < RHD_POWER_REG_COUNT; i++)
+    {
+        regs[RHD_POWER_REG_FIRST + i] = (chip_mask >> (8 * i)) & 0xFF;
+    }
+    return 0;
+}
+
+int intan_get_chip_info(size_t chip, struct rhd2232_info *info)
+{
+    if (chip >= RHD_CHIP_COUNT)
+    {
+        return -EINVAL;
+    }
+    if (!RHD_init)
+    {
+        return -ENODEV;
+    }
+    *info = chips[chip].info;
+    return 0;
+}
+
+int intan_set_block_size(size_t frames)
+{
+    if (frames == 0 || frames > INTAN_MAX_BLOCK_FRAMES)
+    {
+        return -EINVAL;
+    }
+    if (sampling)
+    {
+        return -EBUSY;
+    }
+
+    block_size = frames;
+    return 0;
+}
+
+int intan_init(fifo_buffer_t *fifo_buffer)
+{
+    LOG_INF("Intan initialization starting...");
+    LOG_INF("spi2 %s", DT_NODE_HAS_STATUS(DT_NODELABEL(spi2), okay) ? "found" : "not found");
+    LOG_INF("RHD2232 %s, %d chip(s)", DT_NODE_HAS_STATUS(DT_NODELABEL(rhd2232), okay) ? "found" : "not found",
+            RHD_CHIP_COUNT);
+
+    // Initialize the custom work queue with high priority
+    k_work_queue_init(&intan_work_q);
+    k_work_queue_start(&intan_work_q, intan_work_q_stack,
+                       K_THREAD_STACK_SIZEOF(intan_work_q_stack),
+                       INTAN_WORK_Q_PRIORITY, NULL);
+
+    // Initialize work and timer, the cycle counter also times frames while sampling
+    timing_init();
+    k_work_init(&rhd_work, RHD_handler);
+    k_timer_init(&RHD_timer, my_timer_handler, NULL);
+#if RHD_COUNTER_CLOCK
+    if (!device_is_ready(rhd_clock) || counter_start(rhd_clock))
+    {
+        LOG_ERR("Acquisition clock counter not ready");
+    }
+#endif
+
+    // Generate the command table for the default channel mask
+    RHD_build_convert_table(acq_config.channel_mask);
+
+    // Initialize SPI
+    spi_init();
+
+    // Initialize every RHD chip, each detects its variant from ROM
+    for (size_t c = 0; c < RHD_CHIP_COUNT; c++)
+    {
+        RHD_init = false;
+        for (int retry_count = 0; retry_count < 5; retry_count++)
+        {
+            if (RHD2232_init(c) == 0)
+            {
+                RHD_init = true;
+                break;
+            }
+            LOG_ERR("RHD2232 chip %zu init failed (Attempt %d of 5)", c, retry_count + 1);
+            k_sleep(K_MSEC(1000));
+        }
+
+        if (!RHD_init)
+        {
+            LOG_ERR("Max retries reached. Initialization failed.");
+            return -1;
+        }
+    }
+
+    // Size the acquisition to the channels the chips actually have
+    available_mask = 0;
+    for (size_t c = 0; c < RHD_CHIP_COUNT; c++)
+    {
+        available_mask |= (uint64_t)chips[c].available << (RHD_CHANNELS_PER_CHIP * c);
+    }
+    acq_config.channel_mask &= available_mask;
+    if (acq_config.channel_mask == 0)
+    {
+        acq_config.channel_mask = available_mask;
+    }
+    RHD_build_convert_table(acq_config.channel_mask);
+    LOG_INF("%zu channels available, %zu enabled (mask 0x%016llx)", (size_t)__builtin_popcountll(available_mask),
+            channel_count, (unsigned long long)acq_config.channel_mask);
+
+#if RHD_FRAME_TRANSFER
+    // Hand SPIM1 to the frame engine, the per-word path stays as fallback. The engine pulses a single CS
+    // line, so with several chips every word goes through the driver of its chip instead.
+    if (RHD_CHIP_COUNT == 1 && rhd_frame_init() == 0 && rhd_frame_load(RHD_CONVERT, command_count) == 0)
+    {
+        frame_mode = true;
+        frame_available = true;
+        acq_mode = RHD_HW_TIMED ? INTAN_MODE_HW_TIMED : INTAN_MODE_FRAME;
+    }
+    else
+    {
+        LOG_WRN("Frame transfer unavailable, using per-word SPI");
+    }
+#endif
+
+    RHD_benchmark();
+
+    LOG_INF("Intan initialization complete");
+    return 0;
+}
+
+// Main intan thread function
+void intan_thread(void *arg1, void *arg2, void *arg3)
+{
+    fifo_buffer_t *fifo_buffer = (fifo_buffer_t *)arg1;
+    start_time = k_uptime_get();
+
+    LOG_INF("Intan thread starting...");
+
+    LOG_INF("Block acquisition: %zu samples per FIFO write", block_size);
+
+    // Reads are pending before the first block so it already has a buffer to land in
+    for (int i = 0; i < RHD_RTIO_READS; i++)
+    {
+        if (sensor_read(&intan_iodev, &intan_rtio, NULL) != 0)
+        {
+            LOG_ERR("Failed to submit RHD2232 read");
+        }
+    }
+
+    // Start sampling after the initial settling delay
+    k_mutex_lock(&config_lock, K_FOREVER);
+    RHD_start_sampling(3000);
+    k_mutex_unlock(&config_lock);
+
+    // Consume completed reads in order, each buffer goes back to the pool before its read is resubmitted
+    uint32_t dropped_reported = 0;
+    while (true)
+    {
+        struct rtio_cqe *cqe = rtio_cqe_consume_block(&intan_rtio);
+        int result = cqe->result;
+        uint8_t *buf = NULL;
+        uint32_t buf_len = 0;
+
+        if (result == 0)
+        {
+            result = rtio_cqe_get_mempool_buffer(&intan_rtio, cqe, &buf, &buf_len);
+        }
+        rtio_cqe_release(&intan_rtio, cqe);
+
+        if (result == 0)
+        {
+            RHD_consume_block(fifo_buffer, buf);
+            rtio_release_buffer(&intan_rtio, buf, buf_len);
+        }
+        else
+        {
+            LOG_ERR("RHD2232 read failed (%d)", result);
+        }
+
+        if (blocks_dropped != dropped_reported)
+        {
+            LOG_WRN("%u blocks dropped, no read pending", blocks_dropped - dropped_reported);
+            dropped_reported = blocks_dropped;
+        }
+
+        if (sensor_read(&intan_iodev, &intan_rtio, NULL) != 0)
+        {
+            LOG_ERR("Failed to resubmit RHD2232 read");
+        }
+    }
 
     // // Main loop
     // while (true)
     // {
     //     LOG_INF("=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=");
-    //     for (int i = 0; i < COMMAND_COUNT; i++)
+    //     for (size_t i = 0; i < command_count; i++)
     //     {
     //         LOG_INF("Channel [%d]: 0x%04X (decimal: %d)", i, T_result[i], T_result[i]);
     //     }
@@ -1,22 +1,32 @@
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#if defined(CONFIG_BT)
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/gap.h>
 #include <zephyr/bluetooth/gatt.h>
 #include <zephyr/bluetooth/uuid.h>
 #include <zephyr/bluetooth/addr.h>
 #include <zephyr/bluetooth/conn.h>
+#endif
 #include <zephyr/devicetree.h>
 #include <zephyr/sys/reboot.h>
+#include <string.h>
 
+#if defined(CONFIG_BT)
 #include "../inc/neuralbs.h"
+#endif
 #include "../inc/device_status.h"
 #include "../inc/neural_data.h"
 #include "../inc/fifo_buffer.h"
 #include "../inc/fakedata_module.h"
 #include "../inc/sd_card.h"
 #include "../inc/intan.h"
+#include "../inc/data_stats.h"
+#include "../inc/spill.h"
+#include "../inc/session_file.h"
 
+// Bluetooth is left out on native_sim, where the RHD2232 is emulated
+#if defined(CONFIG_BT)
 static struct bt_le_adv_param *adv_param = BT_LE_ADV_PARAM(
 	(BT_LE_ADV_OPT_CONNECTABLE |
 	 BT_LE_ADV_OPT_USE_IDENTITY), /* Connectable advertising and use identity address */
@@ -24,13 +34,16 @@ static struct bt_le_adv_param *adv_param = BT_LE_ADV_PARAM(
 	801,						  /* Max Advertising Interval 500.625ms (801*0.625ms) */
 	NULL);						  /* Set to NULL for undirected advertising */
 
-LOG_MODULE_REGISTER(Marmoset_FMW, LOG_LEVEL_INF);
-
 #define DEVICE_NAME CONFIG_BT_DEVICE_NAME
 #define DEVICE_NAME_LEN (sizeof(DEVICE_NAME) - 1)
+#endif
+
+LOG_MODULE_REGISTER(Marmoset_FMW, LOG_LEVEL_INF);
 
 #define STATUS_NOTIFY_PRIORITY 8
+#define SPILL_THREAD_PRIORITY 2
 #define SD_CARD_THREAD_PRIORITY 3
+#define SD_IO_THREAD_PRIORITY 5
 #define NEURAL_DATA_NOTIFY_PRIORITY 4
 #define FAKEDATA_THREAD_PRIORITY 0
 #define INTAN_THREAD_PRIORITY 0
@@ -39,8 +52,14 @@ LOG_MODULE_REGISTER(Marmoset_FMW, LOG_LEVEL_INF);
 #define SYSTEM_STATUS_NOTIFY_STACK_SIZE 8192
 
 #define SYSTEM_STATUS_NOTIFY_INTERVAL 1 // system status notify interval in seconds
-#define NEURAL_DATA_NOTIFY_INTERVAL 1	// neural data notify interval in milliseconds
+#define NEURAL_DATA_NOTIFY_INTERVAL 1	// neural data notify retry interval in milliseconds, while the link is busy
+
+// Samples per neural data notification, as many records as fit the payload after the packet header
+#define NEURAL_DATA_PER_NOTIFY ((MAX_FIFO_DATA_SIZE - sizeof(struct session_packet_header)) / SESSION_RECORD_SIZE)
+BUILD_ASSERT(sizeof(struct session_packet_header) + SESSION_RECORD_SIZE <= MAX_FIFO_DATA_SIZE,
+			 "A sample does not fit a notification");
 
+#if defined(CONFIG_BT)
 // Define thread stacks
 K_THREAD_STACK_DEFINE(neural_data_notify_stack, NEURAL_DATA_NOTIFY_STACK_SIZE);
 K_THREAD_STACK_DEFINE(status_notify_stack, SYSTEM_STATUS_NOTIFY_STACK_SIZE);
@@ -53,23 +72,23 @@ static K_SEM_DEFINE(ble_conn_sem, 0, 1);
 struct bt_conn *my_conn = NULL;
 static struct bt_gatt_exchange_params exchange_params;
 static void exchange_func(struct bt_conn *conn, uint8_t att_err, struct bt_gatt_exchange_params *params);
+#endif
 
 static fifo_buffer_t fifo_buffer;
+// Each sink reads the shared ring through its own cursor: SD never loses data, BLE gets what the link carries
+static fifo_consumer_t sd_consumer;
+#if defined(CONFIG_BT)
+static fifo_consumer_t ble_consumer;
+#endif
 
-/* Fake latest neural data */
-LatestNeuralData latest_neural_data = {
-	.data = {
-		.channel_data = {0},
-		.timestamp = 0},
-	.sent = true};
-
-// Define and initialize the device status with default values
+// Define and initialize the device status, battery level and temperature are filled in by the RHD auxiliary reads
 DeviceStatus device_status = {
-	.battery_level = 100,
-	.temperature = 25,
+	.battery_level = 0,
+	.temperature = 0,
 	.recording_status = true,
 	.configuration = "v0.0.1"};
 
+#if defined(CONFIG_BT)
 static const struct bt_data ad[] = {
 	BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
 	BT_DATA(BT_DATA_NAME_COMPLETE, DEVICE_NAME, DEVICE_NAME_LEN),
@@ -122,24 +141,86 @@ static void update_mtu(struct bt_conn *conn)
 
 void status_notify_thread(void *p1, void *p2, void *p3)
 {
+	struct data_stats stats;
+
 	while (1)
 	{
+		data_stats_get(&stats);
+		device_status.samples_produced = stats.produced;
+		device_status.fifo_dropped = stats.fifo_dropped;
+		device_status.ble_dropped = stats.ble_dropped;
+		device_status.sd_dropped = stats.sd_dropped;
+		device_status.late_acquisitions = stats.late;
+		device_status.fifo_high_watermark = (uint16_t)MIN(stats.fifo_high_watermark, UINT16_MAX);
 		nbs_send_system_status_notify(&device_status);
 		k_sleep(K_SECONDS(SYSTEM_STATUS_NOTIFY_INTERVAL));
 	}
 }
 
+// Send one run of samples (consecutive indices, same flags) as a packet header and its records
+static void neural_data_notify_run(const NeuralData *samples, size_t count)
+{
+	static uint8_t packet[MAX_FIFO_DATA_SIZE];
+	struct session_packet_header header = {
+		.first_index = samples[0].index,
+		.timestamp = samples[0].timestamp,
+		.count = count,
+		.flags = samples[0].flags,
+	};
+	size_t size = sizeof(header) + count * SESSION_RECORD_SIZE;
+
+	memcpy(packet, &header, sizeof(header));
+	session_copy_records(&packet[sizeof(header)], samples, count);
+
+	// Out of TX buffers: the link is at capacity, hold the packet until it drains.
+	// If that takes a whole ring, the cursor is run over and skips ahead.
+	int err = nbs_send_neural_data_notify(packet, size);
+	while (err == -ENOMEM)
+	{
+		k_sleep(K_MSEC(NEURAL_DATA_NOTIFY_INTERVAL));
+		err = nbs_send_neural_data_notify(packet, size);
+	}
+	// Nobody subscribed (-EACCES) is not a loss
+	if (err && err != -EACCES)
+	{
+		data_stats_add(DATA_STAT_BLE_DROPPED, count);
+	}
+}
+
 void neural_data_notify_thread(void *p1, void *p2, void *p3)
 {
+	fifo_buffer_t *fifo = (fifo_buffer_t *)p1;
+	fifo_consumer_t *consumer = (fifo_consumer_t *)p2;
+	static NeuralData samples[NEURAL_DATA_PER_NOTIFY];
+
 	while (1)
 	{
-		// Check if there's new data to send
-		if (!latest_neural_data.sent)
+		// Woken once a full notification is waiting
+		if (fifo_buffer_wait(fifo, consumer, K_FOREVER) < 0)
 		{
-			nbs_send_neural_data_notify(&latest_neural_data.data);
-			latest_neural_data.sent = true; // Mark as sent
+			continue;
+		}
+
+		while (fifo_buffer_available(fifo, consumer) >= NEURAL_DATA_PER_NOTIFY)
+		{
+			size_t count = read_from_fifo_buffer(fifo, consumer, samples, NEURAL_DATA_PER_NOTIFY);
+
+			// Samples the producer ran over while the link was behind
+			data_stats_add(DATA_STAT_BLE_DROPPED, (uint32_t)atomic_clear(&consumer->dropped));
+			if (count == 0)
+			{
+				break;
+			}
+
+			// Usually one packet, more when the samples span a drop or a flags change
+			for (size_t i = 0; i < count;)
+			{
+				size_t n = session_run_length(&samples[i], count - i);
+
+				neural_data_notify_run(&samples[i], n);
+				i += n;
+			}
 		}
-		k_sleep(K_MSEC(NEURAL_DATA_NOTIFY_INTERVAL));
 	}
 }
 
@@ -230,6 +311,7 @@ struct bt_conn_cb connection_callbacks = {
 	.le_phy_updated = on_le_phy_updated,
 	.le_data_len_updated = on_le_data_len_updated,
 };
+#endif // CONFIG_BT
 
 int main(void)
 {
@@ -239,6 +321,7 @@ int main(void)
 	k_sleep(K_MSEC(100));
 	LOG_INF("Marmoset FMW V0 \n");
 
+#if defined(CONFIG_BT)
 	// Initialize Bluetooth ============================================================
 	err = bt_enable(NULL);
 	if (err)
@@ -272,6 +355,7 @@ int main(void)
 	}
 	LOG_INF("Bluetooth connection established");
 	k_sleep(K_MSEC(100));
+#endif
 
 	// Initialize SD card ============================================================
 	LOG_INF("Initializing SD card...");
@@ -283,7 +367,6 @@ int main(void)
 		return -1;
 	}
 	LOG_INF("SD card initialized");
-	k_sleep(K_MSEC(100));
 
 	// Initialize FIFO buffer ============================================================
 	LOG_INF("Initializing FIFO buffer...");
@@ -294,8 +377,35 @@ int main(void)
 		sys_reboot(SYS_REBOOT_COLD);
 		return -1;
 	}
+	err = fifo_buffer_add_consumer(&fifo_buffer, &sd_consumer, FIFO_OVERFLOW_BLOCK, 1, SD_CARD_WRITE_SAMPLES);
+#if defined(CONFIG_BT)
+	if (!err)
+	{
+		err = fifo_buffer_add_consumer(&fifo_buffer, &ble_consumer, FIFO_OVERFLOW_DROP_OLDEST,
+									   NEURAL_DATA_PER_NOTIFY, NEURAL_DATA_PER_NOTIFY);
+	}
+#endif
+	if (err)
+	{
+		LOG_ERR("FIFO consumer registration failed (err %d)", err);
+		sys_reboot(SYS_REBOOT_COLD);
+		return -1;
+	}
 	LOG_INF("FIFO buffer initialized successfully");
-	k_sleep(K_MSEC(100));
+
+	// Initialize spill log ============================================================
+	bool spill_ready = false;
+	err = spill_init(&fifo_buffer, &sd_consumer);
+	if (err)
+	{
+		// Not fatal, the SD writer then reads the FIFO only and acquisition waits on it
+		LOG_WRN("Spill log unavailable (err %d)", err);
+	}
+	else
+	{
+		spill_ready = true;
+		LOG_INF("Spill log initialized successfully");
+	}
 
 	// Initialize Intan ============================================================
 	err = intan_init(&fifo_buffer);
@@ -306,16 +416,16 @@ int main(void)
 		return -1;
 	}
 	LOG_INF("Intan initialized successfully");
-	k_sleep(K_MSEC(100));
 
 	LOG_INF("=======!!! All systems initialized !!!======= \n");
-	k_sleep(K_MSEC(100));
 
 	// Create threads dynamically ============================================================
+	// Everything they wait on is initialized above, the recording path starts right away
 
+#if defined(CONFIG_BT)
 	k_thread_create(&neural_data_notify_thread_data, neural_data_notify_stack,
 					K_THREAD_STACK_SIZEOF(neural_data_notify_stack),
-					neural_data_notify_thread, NULL, NULL, NULL,
+					neural_data_notify_thread, &fifo_buffer, &ble_consumer, NULL,
 					NEURAL_DATA_NOTIFY_PRIORITY, 0, K_MSEC(500));
 	LOG_INF("Neural data notify thread created");
 
@@ -324,13 +434,29 @@ int main(void)
 					status_notify_thread, NULL, NULL, NULL,
 					STATUS_NOTIFY_PRIORITY, 0, K_MSEC(1000));
 	LOG_INF("Status notify thread created");
+#endif
 
 	k_thread_create(&sd_card_thread_data, sd_card_stack,
 					SD_CARD_THREAD_STACK_SIZE,
-					sd_card_writer_thread, &fifo_buffer, NULL, NULL,
-					SD_CARD_THREAD_PRIORITY, 0, K_MSEC(2000));
+					sd_card_writer_thread, &fifo_buffer, &sd_consumer, NULL,
+					SD_CARD_THREAD_PRIORITY, 0, K_NO_WAIT);
 	LOG_INF("SD card writer thread created");
 
+	k_thread_create(&sd_io_thread_data, sd_io_stack,
+					SD_IO_THREAD_STACK_SIZE,
+					sd_card_io_thread, NULL, NULL, NULL,
+					SD_IO_THREAD_PRIORITY, 0, K_NO_WAIT);
+	LOG_INF("SD card I/O thread created");
+
+	if (spill_ready)
+	{
+		k_thread_create(&spill_thread_data, spill_stack,
+						SPILL_THREAD_STACK_SIZE,
+						spill_thread, &fifo_buffer, &sd_consumer, NULL,
+						SPILL_THREAD_PRIORITY, 0, K_NO_WAIT);
+		LOG_INF("Spill thread created");
+	}
+
 	// k_thread_create(&fakedata_thread_data, fakedata_stack,
 	// 				FAKEDATA_THREAD_STACK_SIZE,
 	// 				fakedata_thread, &fifo_buffer, NULL, NULL,
@@ -340,7 +466,7 @@ int main(void)
 	k_thread_create(&intan_thread_data, intan_stack,
 					INTAN_THREAD_STACK_SIZE,
 					intan_thread, &fifo_buffer, NULL, NULL,
-					INTAN_THREAD_PRIORITY, 0, K_MSEC(2500));
+					INTAN_THREAD_PRIORITY, 0, K_NO_WAIT);
 	LOG_INF("Intan thread created");
 
 	LOG_INF("=======!!! All threads created successfully !!!======= \n");
@@ -19,17 +19,20 @@
 #include "../inc/neuralbs.h"
 #include "../inc/neural_data.h"
 #include "../inc/device_status.h"
+#include "../inc/fifo_buffer.h"
 
 LOG_MODULE_DECLARE(Neural_Bluetooth_Service);
 
 static bool notify_neural_data_enabled;
 static bool notify_device_status_enabled;
+// Newest packet notified, returned by reads of the characteristic
+static uint8_t last_notified[MAX_FIFO_DATA_SIZE];
+static size_t last_notified_size;
 
 static ssize_t read_neural_data(struct bt_conn *conn, const struct bt_gatt_attr *attr,
                                 void *buf, uint16_t len, uint16_t offset)
 {
-    const char *value = (const char *)attr->user_data;
-    return bt_gatt_attr_read(conn, attr, buf, len, offset, value, strlen(value));
+    return bt_gatt_attr_read(conn, attr, buf, len, offset, last_notified, last_notified_size);
 }
 
 /* Implement the configuration change callback function for device status characteristic */
@@ -56,7 +59,7 @@ BT_GATT_SERVICE_DEFINE(
         BT_GATT_PERM_READ | BT_GATT_PERM_NONE,
         read_neural_data,
         NULL,
-        &latest_neural_data.data),
+        NULL),
 
     BT_GATT_CCC(nbs_neural_data_ccc_cfg_changed,
                 BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
@@ -73,16 +76,26 @@ BT_GATT_SERVICE_DEFINE(
                 BT_GATT_PERM_READ | BT_GATT_PERM_WRITE));
 
 /* Send notifications for the neural data characteristic */
-int nbs_send_neural_data_notify(NeuralData *neural_data)
+int nbs_send_neural_data_notify(const void *packet, size_t size)
 {
+    int ret;
+
     if (!notify_neural_data_enabled)
     {
         return -EACCES;
     }
+    if (size == 0 || size > MAX_FIFO_DATA_SIZE)
+    {
+        return -EMSGSIZE;
+    }
 
-    return bt_gatt_notify(NULL, &my_lbs_svc.attrs[1],
-                          neural_data,
-                          sizeof(*neural_data));
+    ret = bt_gatt_notify(NULL, &my_lbs_svc.attrs[1], packet, size);
+    if (ret == 0)
+    {
+        memcpy(last_notified, packet, size);
+        last_notified_size = size;
+    }
+    return ret;
 }
 
 /* Send notifications for the system status characteristic */
@@ -0,0 +1,351 @@
+// rhd2232.c
+
+#define DT_DRV_COMPAT intan_rhd2232
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/drivers/sensor_data_types.h>
+#include <zephyr/drivers/spi.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/rtio/rtio.h>
+#include <zephyr/sys/byteorder.h>
+#include "../inc/rhd2232.h"
+
+LOG_MODULE_REGISTER(rhd2232, LOG_LEVEL_INF);
+
+#define RHD2232_SPIOP (SPI_WORD_SET(8) | SPI_TRANSFER_MSB)
+#define RHD2232_PIPELINE_DEPTH 2
+#define RHD2232_READ_CMD(reg) ((uint16_t)(0xC000 | ((reg) << 8)))
+// Buffers claimed at once: the block being completed and the one the next frames land in
+#define RHD2232_ACTIVE_BLOCKS 2
+
+// Amplifier ADC step, two's complement output (Register4 twoscomp)
+#define RHD2232_NV_PER_LSB 195
+// Decoded voltages use a q31 range of +/- 2^-6 V, the amplifier input range is +/- 6.4 mV
+#define RHD2232_Q31_SHIFT (-6)
+
+struct rhd2232_config
+{
+    struct spi_dt_spec bus;
+};
+
+struct rhd2232_active
+{
+    struct rtio_iodev_sqe *sqe;
+    uint8_t *buf;
+};
+
+struct rhd2232_data
+{
+    struct k_spinlock lock;
+    // Submitted reads waiting for a block, oldest at pending_head
+    struct rtio_iodev_sqe *pending[RHD2232_MAX_PENDING_READS];
+    size_t pending_head;
+    size_t pending_count;
+    struct rhd2232_active active[RHD2232_ACTIVE_BLOCKS];
+};
+
+uint16_t rhd2232_command(const struct device *dev, uint16_t command)
+{
+    const struct rhd2232_config *config = dev->config;
+    uint8_t tx_buffer[2] = {(command >> 8) & 0xFF, command & 0xFF};
+    uint8_t rx_buffer[2];
+    const struct spi_buf tx_buf = {.buf = tx_buffer, .len = sizeof(tx_buffer)};
+    const struct spi_buf rx_buf = {.buf = rx_buffer, .len = sizeof(rx_buffer)};
+    const struct spi_buf_set tx = {.buffers = &tx_buf, .count = 1};
+    const struct spi_buf_set rx = {.buffers = &rx_buf, .count = 1};
+
+    if (spi_transceive_dt(&config->bus, &tx, &rx))
+    {
+        LOG_ERR("SPI transaction failed");
+        return 0;
+    }
+    return (rx_buffer[0] << 8) | rx_buffer[1];
+}
+
+int rhd2232_read_info(const struct device *dev, struct rhd2232_info *info)
+{
+    // "INTAN" in 40-44, then die revision, unipolar, amplifier count and chip ID
+    static const uint8_t rom[] = {40, 41, 42, 43, 44, 60, 61, 62, 63};
+    uint16_t result[ARRAY_SIZE(rom)];
+
+    // Results trail their READ by the pipeline depth, the last READs are repeated to flush it
+    for (size_t i = 0; i < ARRAY_SIZE(rom) + RHD2232_PIPELINE_DEPTH; i++)
+    {
+        uint16_t word = rhd2232_command(dev, RHD2232_READ_CMD(rom[MIN(i, ARRAY_SIZE(rom) - 1)]));
+
+        if (i >= RHD2232_PIPELINE_DEPTH)
+        {
+            result[i - RHD2232_PIPELINE_DEPTH] = word;
+        }
+    }
+
+    for (size_t i = 0; i < 5; i++)
+    {
+        if ((result[i] & 0xFF) != "INTAN"[i])
+        {
+            return -ENODEV;
+        }
+    }
+
+    info->die_revision = result[5] & 0xFF;
+    info->unipolar = result[6] & 0xFF;
+    info->amplifiers = result[7] & 0xFF;
+    info->chip_id = result[8] & 0xFF;
+    info->channels = MIN(info->amplifiers, RHD2232_MAX_AMPLIFIERS);
+    return 0;
+}
+
+const char *rhd2232_variant_name(uint8_t chip_id)
+{
+    switch (chip_id)
+    {
+    case RHD2232_CHIP_ID_RHD2132:
+        return "RHD2132";
+    case RHD2232_CHIP_ID_RHD2216:
+        return "RHD2216";
+    case RHD2232_CHIP_ID_RHD2164:
+        return "RHD2164";
+    default:
+        return "unknown";
+    }
+}
+
+uint16_t *rhd2232_block_get(const struct device *dev, size_t frames, size_t words)
+{
+    struct rhd2232_data *data = dev->data;
+    uint32_t size = RHD2232_BLOCK_SIZE(frames, words);
+    struct rhd2232_active *slot = NULL;
+    struct rtio_iodev_sqe *sqe;
+    uint8_t *buf;
+    uint32_t buf_len;
+    k_spinlock_key_t key;
+    int ret;
+
+    key = k_spin_lock(&data->lock);
+    for (size_t i = 0; i < RHD2232_ACTIVE_BLOCKS; i++)
+    {
+        if (data->active[i].sqe == NULL)
+        {
+            slot = &data->active[i];
+            break;
+        }
+    }
+    if (slot == NULL || data->pending_count == 0)
+    {
+        k_spin_unlock(&data->lock, key);
+        return NULL;
+    }
+    sqe = data->pending[data->pending_head];
+    data->pending_head = (data->pending_head + 1) % RHD2232_MAX_PENDING_READS;
+    data->pending_count--;
+    k_spin_unlock(&data->lock, key);
+
+    ret = rtio_sqe_rx_buf(sqe, size, size, &buf, &buf_len);
+    if (ret)
+    {
+        // Pool exhausted: the consumer is holding too many blocks
+        rtio_iodev_sqe_err(sqe, ret);
+        return NULL;
+    }
+
+    // Only this caller hands out slots, the lock above covers rhd2232_block_put() freeing one
+    slot->buf = buf;
+    slot->sqe = sqe;
+    return (uint16_t *)(buf + sizeof(struct rhd2232_block_header));
+}
+
+int rhd2232_block_put(const struct device *dev, uint16_t *results, const struct rhd2232_block_header *header)
+{
+    struct rhd2232_data *data = dev->data;
+    uint8_t *buf = (uint8_t *)results - sizeof(struct rhd2232_block_header);
+    struct rtio_iodev_sqe *sqe = NULL;
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&data->lock);
+    for (size_t i = 0; i < RHD2232_ACTIVE_BLOCKS; i++)
+    {
+        if (data->active[i].sqe != NULL && data->active[i].buf == buf)
+        {
+            sqe = data->active[i].sqe;
+            data->active[i].sqe = NULL;
+            break;
+        }
+    }
+    k_spin_unlock(&data->lock, key);
+
+    if (sqe == NULL)
+    {
+        return -ENOENT;
+    }
+
+    memcpy(buf, header, sizeof(*header));
+    rtio_iodev_sqe_ok(sqe, 0);
+    return 0;
+}
+
+// Queue a read, it completes with the next block the acquisition engine fills
+static int rhd2232_submit(const struct device *dev, struct rtio_iodev_sqe *iodev_sqe)
+{
+    struct rhd2232_data *data = dev->data;
+    k_spinlock_key_t key;
+
+    key = k_spin_lock(&data->lock);
+    if (data->pending_count == RHD2232_MAX_PENDING_READS)
+    {
+        k_spin_unlock(&data->lock, key);
+        rtio_iodev_sqe_err(iodev_sqe, -ENOMEM);
+        return 0;
+    }
+    data->pending[(data->pending_head + data->pending_count) % RHD2232_MAX_PENDING_READS] = iodev_sqe;
+    data->pending_count++;
+    k_spin_unlock(&data->lock, key);
+
+    return 0;
+}
+
+// Blocks are only produced by the acquisition engine, there is no single-sample fetch
+static int rhd2232_sample_fetch(const struct device *dev, enum sensor_channel chan)
+{
+    return -ENOTSUP;
+}
+
+static int rhd2232_channel_get(const struct device *dev, enum sensor_channel chan, struct sensor_value *val)
+{
+    return -ENOTSUP;
+}
+
+// Decoder ========================================================================================================
+
+// Command slot of channel_idx (32 * chip + amplifier) in a frame, or -1 when it was not converted
+static int rhd2232_decode_slot(const struct rhd2232_block_header *header, size_t channel_idx)
+{
+    size_t chip = channel_idx / RHD2232_MAX_AMPLIFIERS;
+    size_t slot = 0;
+    uint32_t chip_mask;
+
+    if (chip >= header->chips || (header->channel_mask & BIT64(channel_idx)) == 0)
+    {
+        return -1;
+    }
+
+    // Each chip's segment holds its CONVERTs and the flush words, results trail by the chip's own pipeline
+    for (size_t c = 0; c < chip; c++)
+    {
+        chip_mask = (uint32_t)(header->channel_mask >> (RHD2232_MAX_AMPLIFIERS * c));
+        slot += __builtin_popcount(chip_mask) + header->flush_words;
+    }
+    chip_mask = (uint32_t)(header->channel_mask >> (RHD2232_MAX_AMPLIFIERS * chip));
+    return (int)(slot + __builtin_popcount(chip_mask & BIT_MASK(channel_idx % RHD2232_MAX_AMPLIFIERS)) +
+                 RHD2232_PIPELINE_DEPTH);
+}
+
+static int rhd2232_decoder_get_frame_count(const uint8_t *buffer, enum sensor_channel channel, size_t channel_idx,
+                                           uint16_t *frame_count)
+{
+    const struct rhd2232_block_header *header = (const struct rhd2232_block_header *)buffer;
+
+    if (channel != SENSOR_CHAN_VOLTAGE || rhd2232_decode_slot(header, channel_idx) < 0)
+    {
+        return -ENOTSUP;
+    }
+    *frame_count = header->frames;
+    return 0;
+}
+
+static int rhd2232_decoder_get_size_info(enum sensor_channel channel, size_t *base_size, size_t *frame_size)
+{
+    if (channel != SENSOR_CHAN_VOLTAGE)
+    {
+        return -ENOTSUP;
+    }
+    *base_size = sizeof(struct sensor_q31_data);
+    *frame_size = sizeof(struct sensor_q31_sample_data);
+    return 0;
+}
+
+static int rhd2232_decoder_decode(const uint8_t *buffer, enum sensor_channel channel, size_t channel_idx,
+                                  uint32_t *fit, uint16_t max_count, void *data_out)
+{
+    const struct rhd2232_block_header *header = (const struct rhd2232_block_header *)buffer;
+    const uint16_t *results = rhd2232_block_results(buffer);
+    struct sensor_q31_data *out = data_out;
+    uint32_t period_ns;
+    int slot = rhd2232_decode_slot(header, channel_idx);
+    int count = 0;
+
+    if (channel != SENSOR_CHAN_VOLTAGE || slot < 0)
+    {
+        return -ENOTSUP;
+    }
+    if (*fit >= header->frames)
+    {
+        return 0;
+    }
+
+    period_ns = NSEC_PER_SEC / header->sample_rate_hz;
+    out->header.base_timestamp_ns = header->timestamp_ns + (uint64_t)*fit * period_ns;
+    out->shift = RHD2232_Q31_SHIFT;
+
+    while (*fit < header->frames && count < max_count)
+    {
+        uint16_t raw = results[*fit * header->words + slot];
+        int64_t counts = (int16_t)(header->wire_order ? sys_be16_to_cpu(raw) : raw);
+
+        out->readings[count].timestamp_delta = count * period_ns;
+        out->readings[count].value =
+            (q31_t)(counts * RHD2232_NV_PER_LSB * (INT64_C(1) << (31 - RHD2232_Q31_SHIFT)) / NSEC_PER_SEC);
+        count++;
+        (*fit)++;
+    }
+    out->header.reading_count = count;
+
+    return count;
+}
+
+static const struct sensor_decoder_api rhd2232_decoder = {
+    .get_frame_count = rhd2232_decoder_get_frame_count,
+    .get_size_info = rhd2232_decoder_get_size_info,
+    .decode = rhd2232_decoder_decode,
+};
+
+static int rhd2232_get_decoder(const struct device *dev, const struct sensor_decoder_api **decoder)
+{
+    *decoder = &rhd2232_decoder;
+    return 0;
+}
+
+// ================================================================================================================
+
+static const struct sensor_driver_api rhd2232_api = {
+    .sample_fetch = rhd2232_sample_fetch,
+    .channel_get = rhd2232_channel_get,
+    .get_decoder = rhd2232_get_decoder,
+    .submit = rhd2232_submit,
+};
+
+static int rhd2232_init(const struct device *dev)
+{
+    const struct rhd2232_config *config = dev->config;
+
+    // Chip set-up needs the acquisition configuration and is done by intan_init()
+    if (!spi_is_ready_dt(&config->bus))
+    {
+        LOG_ERR("SPI bus %s not ready", config->bus.bus->name);
+        return -ENODEV;
+    }
+    return 0;
+}
+
+#define RHD2232_DEFINE(n)                                                                                   \
+    static struct rhd2232_data rhd2232_data_##n;                                                            \
+    static const struct rhd2232_config rhd2232_config_##n = {                                               \
+        .bus = SPI_DT_SPEC_INST_GET(n, RHD2232_SPIOP, 0),                                                   \
+    };                                                                                                      \
+    SENSOR_DEVICE_DT_INST_DEFINE(n, rhd2232_init, NULL, &rhd2232_data_##n, &rhd2232_config_##n,            \
+                                 POST_KERNEL, CONFIG_SENSOR_INIT_PRIORITY, &rhd2232_api)
+
+DT_INST_FOREACH_STATUS_OKAY(RHD2232_DEFINE)
@@ -0,0 +1,361 @@
+// rhd2232_emul.c
+
+#define DT_DRV_COMPAT intan_rhd2232
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/emul.h>
+#include <zephyr/drivers/spi.h>
+#include <zephyr/drivers/spi_emul.h>
+#include <zephyr/logging/log.h>
+#include "../inc/rhd2232_emul.h"
+
+LOG_MODULE_REGISTER(rhd2232_emul, LOG_LEVEL_INF);
+
+#define RHD_EMUL_REG_COUNT 64
+#define RHD_EMUL_PIPELINE_DEPTH 2
+#define RHD_EMUL_CALIBRATE_COMMANDS 9
+
+// Command encodings (RHD2000 datasheet, SPI command words)
+#define RHD_EMUL_CMD_CALIBRATE 0x5500
+#define RHD_EMUL_CMD_CLEAR 0x6A00
+#define RHD_EMUL_CMD_TYPE(cmd) ((cmd) >> 14)
+#define RHD_EMUL_CMD_CONVERT 0x0
+#define RHD_EMUL_CMD_WRITE 0x2
+#define RHD_EMUL_CMD_READ 0x3
+#define RHD_EMUL_CMD_REG(cmd) (((cmd) >> 8) & 0x3F)
+
+// Non-amplifier ADC channels
+#define RHD_EMUL_AUX_CHANNEL 32
+#define RHD_EMUL_AUX_INPUTS 3
+#define RHD_EMUL_SUPPLY_CHANNEL 48
+#define RHD_EMUL_TEMP_CHANNEL 49
+
+// Register 3 and 4 bits the model honours
+#define RHD_EMUL_REG3_TEMPS1 0x08
+#define RHD_EMUL_REG3_TEMPS2 0x10
+#define RHD_EMUL_REG4_TWOSCOMP 0x40
+
+// Temperature sensor: (S2 - S1) / 98.9 - 273.15 degC, S1 reads an arbitrary baseline
+#define RHD_EMUL_TEMP_BASELINE 12000
+// Supply sensor: 74.8 uV per LSB
+#define RHD_EMUL_SUPPLY_UV_PER_LSB_X10 748
+
+struct rhd2232_emul_data
+{
+    uint8_t regs[RHD_EMUL_REG_COUNT];
+    uint16_t pipeline[RHD_EMUL_PIPELINE_DEPTH]; // Results still in flight, oldest first
+    uint8_t calibrating;                        // Commands left in a CALIBRATE sequence
+    struct rhd2232_emul_channel channels[RHD2232_EMUL_AMP_CHANNELS];
+    uint16_t aux[RHD_EMUL_AUX_INPUTS];
+    int32_t temperature_centi_c;
+    uint32_t supply_mv;
+    uint32_t noise_state;
+    struct rhd2232_emul_stats stats;
+    struct k_spinlock lock;
+};
+
+// ROM: company name, then die revision, unipolar amplifiers, amplifier count and chip ID
+static const uint8_t rhd_emul_rom[][2] = {
+    {40, 'I'}, {41, 'N'}, {42, 'T'}, {43, 'A'}, {44, 'N'},
+    {60, 1}, {61, 1}, {62, RHD2232_EMUL_AMP_CHANNELS}, {63, 1},
+};
+
+static uint32_t rhd_emul_noise(struct rhd2232_emul_data *data)
+{
+    // xorshift32, seeded at init so every run sees the same sequence
+    data->noise_state ^= data->noise_state << 13;
+    data->noise_state ^= data->noise_state >> 17;
+    data->noise_state ^= data->noise_state << 5;
+    return data->noise_state;
+}
+
+static int32_t rhd_emul_waveform(struct rhd2232_emul_data *data, const struct rhd2232_emul_channel *ch)
+{
+    // Waveforms run on simulated uptime, so the sample rate only changes where they are sampled
+    uint64_t t_us = k_ticks_to_us_floor64(k_uptime_ticks());
+    uint32_t period_us = ch->freq_mhz ? (uint32_t)(1000000000ULL / ch->freq_mhz) : 0;
+    uint32_t phase_us = period_us ? (uint32_t)(t_us % period_us) : 0;
+
+    switch (ch->wave)
+    {
+    case RHD2232_EMUL_WAVE_SINE:
+        if (period_us == 0)
+        {
+            return ch->offset;
+        }
+        return ch->offset + (int32_t)(ch->amplitude * sinf(2.0f * (float)M_PI * phase_us / period_us));
+    case RHD2232_EMUL_WAVE_SQUARE:
+        return ch->offset + (phase_us < period_us / 2 ? ch->amplitude : -ch->amplitude);
+    case RHD2232_EMUL_WAVE_RAMP:
+        if (period_us == 0)
+        {
+            return ch->offset;
+        }
+        return ch->offset - ch->amplitude + (int32_t)((2LL * ch->amplitude * phase_us) / period_us);
+    case RHD2232_EMUL_WAVE_NOISE:
+        return ch->offset + (int32_t)(rhd_emul_noise(data) % (2U * ABS(ch->amplitude) + 1)) - ABS(ch->amplitude);
+    case RHD2232_EMUL_WAVE_DC:
+    default:
+        return ch->offset;
+    }
+}
+
+static uint16_t rhd_emul_convert(struct rhd2232_emul_data *data, uint8_t channel)
+{
+    int32_t value;
+
+    data->stats.converts++;
+
+    if (channel < RHD2232_EMUL_AMP_CHANNELS)
+    {
+        value = CLAMP(rhd_emul_waveform(data, &data->channels[channel]), INT16_MIN, INT16_MAX);
+        // Amplifier results follow the twoscomp bit of register 4, offset binary otherwise
+        if (data->regs[4] & RHD_EMUL_REG4_TWOSCOMP)
+        {
+            return (uint16_t)(int16_t)value;
+        }
+        return (uint16_t)(value + 0x8000);
+    }
+    if (channel >= RHD_EMUL_AUX_CHANNEL && channel < RHD_EMUL_AUX_CHANNEL + RHD_EMUL_AUX_INPUTS)
+    {
+        return data->aux[channel - RHD_EMUL_AUX_CHANNEL];
+    }
+    if (channel == RHD_EMUL_SUPPLY_CHANNEL)
+    {
+        return (uint16_t)MIN(data->supply_mv * 10000U / RHD_EMUL_SUPPLY_UV_PER_LSB_X10, UINT16_MAX);
+    }
+    if (channel == RHD_EMUL_TEMP_CHANNEL)
+    {
+        uint8_t sel = data->regs[3] & (RHD_EMUL_REG3_TEMPS1 | RHD_EMUL_REG3_TEMPS2);
+
+        if (sel == (RHD_EMUL_REG3_TEMPS1 | RHD_EMUL_REG3_TEMPS2))
+        {
+            return RHD_EMUL_TEMP_BASELINE + (uint16_t)((data->temperature_centi_c + 27315) * 989 / 10000);
+        }
+        return RHD_EMUL_TEMP_BASELINE;
+    }
+    return 0;
+}
+
+// Execute one command, the result leaves the chip RHD_EMUL_PIPELINE_DEPTH commands later
+static uint16_t rhd_emul_execute(struct rhd2232_emul_data *data, uint16_t cmd)
+{
+    uint8_t reg = RHD_EMUL_CMD_REG(cmd);
+
+    data->stats.commands++;
+
+    if (data->calibrating)
+    {
+        // The ADC is busy calibrating, commands in the sequence are swallowed
+        data->calibrating--;
+        return 0;
+    }
+    if (cmd == RHD_EMUL_CMD_CALIBRATE)
+    {
+        data->stats.calibrations++;
+        data->calibrating = RHD_EMUL_CALIBRATE_COMMANDS;
+        return 0;
+    }
+    if (cmd == RHD_EMUL_CMD_CLEAR)
+    {
+        return 0;
+    }
+
+    switch (RHD_EMUL_CMD_TYPE(cmd))
+    {
+    case RHD_EMUL_CMD_CONVERT:
+        return rhd_emul_convert(data, reg);
+    case RHD_EMUL_CMD_WRITE:
+        // Registers 40-63 are ROM
+        if (reg < 40)
+        {
+            data->regs[reg] = cmd & 0xFF;
+            data->stats.writes++;
+        }
+        return 0xFF00 | (cmd & 0xFF);
+    case RHD_EMUL_CMD_READ:
+        return data->regs[reg];
+    default:
+        return 0;
+    }
+}
+
+static uint16_t rhd_emul_word(struct rhd2232_emul_data *data, uint16_t cmd)
+{
+    uint16_t out = data->pipeline[0];
+
+    data->pipeline[0] = data->pipeline[1];
+    data->pipeline[1] = rhd_emul_execute(data, cmd);
+    return out;
+}
+
+// Byte n of a buffer set, 0 when the set is shorter (or absent)
+static uint8_t rhd_emul_buf_get(const struct spi_buf_set *set, size_t n)
+{
+    for (size_t i = 0; set && i < set->count; i++)
+    {
+        const struct spi_buf *buf = &set->buffers[i];
+
+        if (n < buf->len)
+        {
+            return buf->buf ? ((const uint8_t *)buf->buf)[n] : 0;
+        }
+        n -= buf->len;
+    }
+    return 0;
+}
+
+static void rhd_emul_buf_put(const struct spi_buf_set *set, size_t n, uint8_t value)
+{
+    for (size_t i = 0; set && i < set->count; i++)
+    {
+        const struct spi_buf *buf = &set->buffers[i];
+
+        if (n < buf->len)
+        {
+            if (buf->buf)
+            {
+                ((uint8_t *)buf->buf)[n] = value;
+            }
+            return;
+        }
+        n -= buf->len;
+    }
+}
+
+static size_t rhd_emul_buf_len(const struct spi_buf_set *set)
+{
+    size_t len = 0;
+
+    for (size_t i = 0; set && i < set->count; i++)
+    {
+        len += set->buffers[i].len;
+    }
+    return len;
+}
+
+static int rhd2232_emul_io(const struct emul *target, const struct spi_config *config,
+                           const struct spi_buf_set *tx_bufs, const struct spi_buf_set *rx_bufs)
+{
+    struct rhd2232_emul_data *data = target->data;
+    size_t len = MAX(rhd_emul_buf_len(tx_bufs), rhd_emul_buf_len(rx_bufs));
+    k_spinlock_key_t key;
+
+    // Every 16-bit word is one CS cycle on the real part, MSB first
+    if (SPI_WORD_SIZE_GET(config->operation) != 8 || (len % 2) != 0)
+    {
+        return -EINVAL;
+    }
+
+    key = k_spin_lock(&data->lock);
+    for (size_t n = 0; n < len; n += 2)
+    {
+        uint16_t cmd = (rhd_emul_buf_get(tx_bufs, n) << 8) | rhd_emul_buf_get(tx_bufs, n + 1);
+        uint16_t result = rhd_emul_word(data, cmd);
+
+        rhd_emul_buf_put(rx_bufs, n, result >> 8);
+        rhd_emul_buf_put(rx_bufs, n + 1, result & 0xFF);
+    }
+    k_spin_unlock(&data->lock, key);
+
+    return 0;
+}
+
+static const struct spi_emul_api rhd2232_emul_api = {
+    .io = rhd2232_emul_io,
+};
+
+int rhd2232_emul_set_channel(const struct emul *target, uint8_t channel, const struct rhd2232_emul_channel *cfg)
+{
+    struct rhd2232_emul_data *data = target->data;
+    k_spinlock_key_t key;
+
+    if (channel >= RHD2232_EMUL_AMP_CHANNELS || cfg == NULL)
+    {
+        return -EINVAL;
+    }
+
+    key = k_spin_lock(&data->lock);
+    data->channels[channel] = *cfg;
+    k_spin_unlock(&data->lock, key);
+    return 0;
+}
+
+void rhd2232_emul_set_temperature(const struct emul *target, int32_t centi_c)
+{
+    struct rhd2232_emul_data *data = target->data;
+
+    data->temperature_centi_c = centi_c;
+}
+
+void rhd2232_emul_set_supply(const struct emul *target, uint32_t supply_mv)
+{
+    struct rhd2232_emul_data *data = target->data;
+
+    data->supply_mv = supply_mv;
+}
+
+void rhd2232_emul_set_aux(const struct emul *target, uint8_t input, uint16_t value)
+{
+    struct rhd2232_emul_data *data = target->data;
+
+    if (input < RHD_EMUL_AUX_INPUTS)
+    {
+        data->aux[input] = value;
+    }
+}
+
+uint8_t rhd2232_emul_get_register(const struct emul *target, uint8_t reg)
+{
+    struct rhd2232_emul_data *data = target->data;
+
+    return reg < RHD_EMUL_REG_COUNT ? data->regs[reg] : 0;
+}
+
+void rhd2232_emul_get_stats(const struct emul *target, struct rhd2232_emul_stats *stats)
+{
+    struct rhd2232_emul_data *data = target->data;
+    k_spinlock_key_t key = k_spin_lock(&data->lock);
+
+    *stats = data->stats;
+    k_spin_unlock(&data->lock, key);
+}
+
+static int rhd2232_emul_init(const struct emul *target, const struct device *parent)
+{
+    struct rhd2232_emul_data *data = target->data;
+
+    memset(data->regs, 0, sizeof(data->regs));
+    for (size_t i = 0; i < ARRAY_SIZE(rhd_emul_rom); i++)
+    {
+        data->regs[rhd_emul_rom[i][0]] = rhd_emul_rom[i][1];
+    }
+
+    // Default stimulus: channel n is a 1 mV-ish sine at (n + 1) * 10 Hz so channels are told apart at a glance
+    for (uint8_t ch = 0; ch < RHD2232_EMUL_AMP_CHANNELS; ch++)
+    {
+        data->channels[ch] = (struct rhd2232_emul_channel){
+            .wave = RHD2232_EMUL_WAVE_SINE,
+            .amplitude = 5000,
+            .offset = 0,
+            .freq_mhz = (ch + 1) * 10000,
+        };
+    }
+    data->temperature_centi_c = 3700;
+    data->supply_mv = 3300;
+    data->noise_state = 0x2545F491;
+
+    LOG_INF("RHD2232 emulator on %s", parent->name);
+    return 0;
+}
+
+// The device itself is defined by the rhd2232 sensor driver
+#define RHD2232_EMUL_DEFINE(n)                                                                   \
+    static struct rhd2232_emul_data rhd2232_emul_data_##n;                                       \
+    EMUL_DT_INST_DEFINE(n, rhd2232_emul_init, &rhd2232_emul_data_##n, NULL, &rhd2232_emul_api, NULL)
+
+DT_INST_FOREACH_STATUS_OKAY(RHD2232_EMUL_DEFINE)
@@ -0,0 +1,564 @@
+// rhd_frame.c
+
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/drivers/clock_control/nrf_clock_control.h>
+#include <soc.h>
+#include <hal/nrf_spim.h>
+#include <nrfx_gpiote.h>
+#include <nrfx_timer.h>
+#include <helpers/nrfx_gppi.h>
+#include "../inc/rhd_frame.h"
+
+LOG_MODULE_REGISTER(rhd_frame, LOG_LEVEL_INF);
+
+#define RHD_SPI_NODE DT_NODELABEL(spi1)
+#define RHD_SPIM ((NRF_SPIM_Type *)DT_REG_ADDR(RHD_SPI_NODE))
+#define RHD_CS_PIN NRF_DT_GPIOS_TO_PSEL(RHD_SPI_NODE, cs_gpios)
+
+// CS-high gap between words in 16 MHz ticks (250 ns, RHD2000 needs tCSOFF >= 154 ns)
+#define RHD_CS_GAP_TICKS 4
+// Worst case time per word in 16 MHz ticks: 16 bits at the 20 MHz SPI clock (spi-max-frequency in the
+// overlay), the CS gap and PPI latency, with margin for a driver that clamps SPIM1 to 8 MHz
+#define RHD_WORD_TICKS 40
+// Upper bound on the completion busy-wait, a 40 word frame at 20 MHz takes ~50 us
+#define RHD_FRAME_SPIN_LIMIT 100000
+#define RHD_BLOCK_IRQ_PRIORITY 1
+#define RHD_TIMER_HZ NRFX_MHZ_TO_HZ(16)
+
+static const nrfx_timer_t block_counter = NRFX_TIMER_INSTANCE(1); // Frames completed in the current block
+static const nrfx_timer_t cs_timer = NRFX_TIMER_INSTANCE(2);      // CS-high gap, one-shot per word
+static const nrfx_timer_t word_counter = NRFX_TIMER_INSTANCE(3);  // Gap expiries in the current frame
+static const nrfx_timer_t sample_clock = NRFX_TIMER_INSTANCE(4);  // Frame start period
+static const nrfx_gpiote_t gpiote = NRFX_GPIOTE_INSTANCE(0);
+
+// ArrayList buffers: one 16-bit entry per word, stored big-endian as the RHD expects MSB first.
+// The TX table is repeated once per frame of a block so the list pointer never has to rewind mid-block.
+static uint16_t frame_tx[RHD_FRAME_MAX_WORDS * RHD_FRAME_MAX_BLOCK];
+static uint16_t frame_rx[2][RHD_FRAME_MAX_WORDS * RHD_FRAME_MAX_BLOCK];
+static size_t frame_words;
+
+static uint8_t gpiote_ch;
+static uint8_t ppi_start; // cs_timer COMPARE0 -> CS low, SPIM START
+static uint8_t ppi_end;   // SPIM END -> CS high, cs_timer START
+static uint8_t ppi_count; // cs_timer COMPARE0 -> word_counter COUNT
+static uint8_t ppi_stop;  // word_counter COMPARE0 -> start group DISABLE
+static uint8_t ppi_frame; // sample_clock COMPARE0 -> start group ENABLE, cs_timer START
+static uint8_t ppi_done;  // word_counter COMPARE1 -> block_counter COUNT
+static nrfx_gppi_channel_group_t start_group;
+static bool frame_init_done;
+static bool frame_armed;
+
+// Streaming state, owned by the block interrupt once started
+static rhd_frame_block_cb_t stream_cb;
+static size_t stream_frames;
+static uint16_t *stream_rx;        // Block being filled
+static uint16_t *stream_rx_queued; // Block after it, chosen one block ahead so the interrupt never has to
+// Caller buffers handed in with rhd_frame_set_rx() and not taken yet, NULL entries ask for an internal one
+static uint16_t *stream_rx_given[2];
+static size_t stream_rx_given_count;
+static bool streaming;
+
+// Sample clock: 16 MHz / rate is rarely whole, so the period is dithered between period_base and
+// period_base + 1 once per block to keep the long-run rate exact
+static uint32_t stream_rate;
+static uint32_t period_base;
+static uint32_t period_rem;
+static uint32_t period_acc;
+
+// TIMER4 runs from HFCLK, which is the RC oscillator unless someone holds the crystal
+static struct onoff_client hfxo_cli;
+static bool hfxo_requested;
+
+static void timer_event_handler(nrf_timer_event_t event_type, void *p_context)
+{
+    // The CS, word and sample timers run with interrupts disabled, events are routed through PPI only
+}
+
+// Period of the next block of frames, error against the exact rate stays under one tick per frame
+static uint32_t stream_next_period(void)
+{
+    period_acc += stream_frames * period_rem;
+    if (period_acc >= stream_frames * stream_rate)
+    {
+        period_acc -= stream_frames * stream_rate;
+        return period_base + 1;
+    }
+    return period_base;
+}
+
+// RX buffer for a block: the oldest one the caller handed in, or the internal buffer that is not in use
+static uint16_t *stream_take_rx(const uint16_t *in_use)
+{
+    uint16_t *buffer = NULL;
+
+    if (stream_rx_given_count > 0)
+    {
+        buffer = stream_rx_given[0];
+        stream_rx_given[0] = stream_rx_given[1];
+        stream_rx_given_count--;
+    }
+    if (buffer == NULL)
+    {
+        buffer = in_use == frame_rx[0] ? frame_rx[1] : frame_rx[0];
+    }
+    return buffer;
+}
+
+static void block_event_handler(nrf_timer_event_t event_type, void *p_context)
+{
+    const uint16_t *done = stream_rx;
+
+    if (event_type != NRF_TIMER_EVENT_COMPARE0 || !streaming)
+    {
+        return;
+    }
+
+    // Rewind the lists first: the next frame starts one sample period from the last one, and a list
+    // pointer left at the end of the block would run the DMA past its buffer. The buffer was chosen a
+    // block ago, so nothing here waits on the callback.
+    nrf_spim_tx_buffer_set(RHD_SPIM, (const uint8_t *)frame_tx, sizeof(uint16_t));
+    nrf_spim_rx_buffer_set(RHD_SPIM, (uint8_t *)stream_rx_queued, sizeof(uint16_t));
+    stream_rx = stream_rx_queued;
+
+    // The sample clock is early in its period here, so moving CC0 by one tick cannot skip the compare
+    nrf_timer_cc_set(sample_clock.p_reg, NRF_TIMER_CC_CHANNEL0, stream_next_period());
+
+    // The callback hands in the buffer for the block after the one just started
+    stream_cb(done, stream_frames);
+    stream_rx_queued = stream_take_rx(stream_rx);
+}
+
+static int frame_hfxo_request(void)
+{
+    struct onoff_manager *mgr = z_nrf_clock_control_get_onoff(CLOCK_CONTROL_NRF_SUBSYS_HF);
+    int res;
+    int ret;
+
+    if (hfxo_requested)
+    {
+        return 0;
+    }
+
+    sys_notify_init_spinwait(&hfxo_cli.notify);
+    ret = onoff_request(mgr, &hfxo_cli);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    // Crystal start-up is well under a millisecond
+    do
+    {
+        ret = sys_notify_fetch_result(&hfxo_cli.notify, &res);
+    } while (ret == -EAGAIN);
+
+    hfxo_requested = true;
+    return res;
+}
+
+static void frame_hfxo_release(void)
+{
+    if (hfxo_requested)
+    {
+        onoff_release(z_nrf_clock_control_get_onoff(CLOCK_CONTROL_NRF_SUBSYS_HF));
+        hfxo_requested = false;
+    }
+}
+
+static int frame_timers_init(void)
+{
+    nrfx_timer_config_t timer_cfg = NRFX_TIMER_DEFAULT_CONFIG(RHD_TIMER_HZ);
+
+    if (nrfx_timer_init(&cs_timer, &timer_cfg, timer_event_handler) != NRFX_SUCCESS)
+    {
+        LOG_ERR("CS gap timer init failed");
+        return -EBUSY;
+    }
+    nrfx_timer_extended_compare(&cs_timer, NRF_TIMER_CC_CHANNEL0, RHD_CS_GAP_TICKS,
+                                NRF_TIMER_SHORT_COMPARE0_STOP_MASK | NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK,
+                                false);
+
+    timer_cfg.bit_width = NRF_TIMER_BIT_WIDTH_32;
+    if (nrfx_timer_init(&sample_clock, &timer_cfg, timer_event_handler) != NRFX_SUCCESS)
+    {
+        LOG_ERR("Sample clock init failed");
+        return -EBUSY;
+    }
+
+    timer_cfg.mode = NRF_TIMER_MODE_COUNTER;
+    timer_cfg.bit_width = NRF_TIMER_BIT_WIDTH_16;
+    if (nrfx_timer_init(&word_counter, &timer_cfg, timer_event_handler) != NRFX_SUCCESS)
+    {
+        LOG_ERR("Word counter init failed");
+        return -EBUSY;
+    }
+    nrfx_timer_enable(&word_counter);
+
+    timer_cfg.interrupt_priority = RHD_BLOCK_IRQ_PRIORITY;
+    if (nrfx_timer_init(&block_counter, &timer_cfg, block_event_handler) != NRFX_SUCCESS)
+    {
+        LOG_ERR("Block counter init failed");
+        return -EBUSY;
+    }
+    IRQ_CONNECT(TIMER1_IRQn, RHD_BLOCK_IRQ_PRIORITY, nrfx_timer_1_irq_handler, NULL, 0);
+    nrfx_timer_enable(&block_counter);
+
+    return 0;
+}
+
+static int frame_gpiote_init(void)
+{
+    nrfx_gpiote_output_config_t out_cfg = NRFX_GPIOTE_DEFAULT_OUTPUT_CONFIG;
+    nrfx_gpiote_task_config_t task_cfg = {
+        .polarity = NRF_GPIOTE_POLARITY_TOGGLE,
+        .init_val = NRF_GPIOTE_INITIAL_VALUE_HIGH,
+    };
+
+    if (nrfx_gpiote_channel_alloc(&gpiote, &gpiote_ch) != NRFX_SUCCESS)
+    {
+        LOG_ERR("No free GPIOTE channel for CS");
+        return -ENOMEM;
+    }
+    task_cfg.task_ch = gpiote_ch;
+
+    if (nrfx_gpiote_output_configure(&gpiote, RHD_CS_PIN, &out_cfg, &task_cfg) != NRFX_SUCCESS)
+    {
+        LOG_ERR("CS GPIOTE task configuration failed");
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static int frame_ppi_init(void)
+{
+    if (nrfx_gppi_channel_alloc(&ppi_start) != NRFX_SUCCESS ||
+        nrfx_gppi_channel_alloc(&ppi_end) != NRFX_SUCCESS ||
+        nrfx_gppi_channel_alloc(&ppi_count) != NRFX_SUCCESS ||
+        nrfx_gppi_channel_alloc(&ppi_stop) != NRFX_SUCCESS ||
+        nrfx_gppi_channel_alloc(&ppi_frame) != NRFX_SUCCESS ||
+        nrfx_gppi_channel_alloc(&ppi_done) != NRFX_SUCCESS ||
+        nrfx_gppi_group_alloc(&start_group) != NRFX_SUCCESS)
+    {
+        LOG_ERR("Not enough PPI channels for frame transfer");
+        return -ENOMEM;
+    }
+
+    // Gap elapsed: assert CS and clock out the next list entry
+    nrfx_gppi_channel_endpoints_setup(ppi_start,
+                                      nrfx_timer_compare_event_address_get(&cs_timer, NRF_TIMER_CC_CHANNEL0),
+                                      nrfx_gpiote_clr_task_address_get(&gpiote, RHD_CS_PIN));
+    nrfx_gppi_fork_endpoint_setup(ppi_start, nrf_spim_task_address_get(RHD_SPIM, NRF_SPIM_TASK_START));
+
+    // Word done: release CS and time the gap before the next one
+    nrfx_gppi_channel_endpoints_setup(ppi_end,
+                                      nrf_spim_event_address_get(RHD_SPIM, NRF_SPIM_EVENT_END),
+                                      nrfx_gpiote_set_task_address_get(&gpiote, RHD_CS_PIN));
+    nrfx_gppi_fork_endpoint_setup(ppi_end, nrfx_timer_task_address_get(&cs_timer, NRF_TIMER_TASK_START));
+
+    // Every gap expiry is counted, including the one after the last word which marks completion
+    nrfx_gppi_channel_endpoints_setup(ppi_count,
+                                      nrfx_timer_compare_event_address_get(&cs_timer, NRF_TIMER_CC_CHANNEL0),
+                                      nrfx_timer_task_address_get(&word_counter, NRF_TIMER_TASK_COUNT));
+
+    // Last word started: stop issuing new ones
+    nrfx_gppi_channel_endpoints_setup(ppi_stop,
+                                      nrfx_timer_compare_event_address_get(&word_counter, NRF_TIMER_CC_CHANNEL0),
+                                      nrfx_gppi_task_address_get(nrfx_gppi_group_disable_task_get(start_group)));
+
+    // Sample period elapsed: open the group and start the first gap of a new frame
+    nrfx_gppi_channel_endpoints_setup(ppi_frame,
+                                      nrfx_timer_compare_event_address_get(&sample_clock, NRF_TIMER_CC_CHANNEL0),
+                                      nrfx_gppi_task_address_get(nrfx_gppi_group_enable_task_get(start_group)));
+    nrfx_gppi_fork_endpoint_setup(ppi_frame, nrfx_timer_task_address_get(&cs_timer, NRF_TIMER_TASK_START));
+
+    // Frame finished: count it towards the block
+    nrfx_gppi_channel_endpoints_setup(ppi_done,
+                                      nrfx_timer_compare_event_address_get(&word_counter, NRF_TIMER_CC_CHANNEL1),
+                                      nrfx_timer_task_address_get(&block_counter, NRF_TIMER_TASK_COUNT));
+
+    nrfx_gppi_channels_include_in_group(BIT(ppi_start), start_group);
+
+    return 0;
+}
+
+int rhd_frame_init(void)
+{
+    int ret;
+
+    if (frame_init_done)
+    {
+        return 0;
+    }
+
+    ret = frame_timers_init();
+    if (ret)
+    {
+        return ret;
+    }
+
+    ret = frame_gpiote_init();
+    if (ret)
+    {
+        return ret;
+    }
+
+    ret = frame_ppi_init();
+    if (ret)
+    {
+        return ret;
+    }
+
+    frame_init_done = true;
+    LOG_INF("Frame transfer ready (GPIOTE ch %d, PPI %d/%d/%d/%d/%d/%d)", gpiote_ch,
+            ppi_start, ppi_end, ppi_count, ppi_stop, ppi_frame, ppi_done);
+    return 0;
+}
+
+int rhd_frame_load(const uint16_t *commands, size_t count)
+{
+    if (!frame_init_done || frame_armed)
+    {
+        return -EBUSY;
+    }
+    if (count == 0 || count > RHD_FRAME_MAX_WORDS)
+    {
+        return -EINVAL;
+    }
+
+    for (size_t f = 0; f < RHD_FRAME_MAX_BLOCK; f++)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            frame_tx[f * count + i] = sys_cpu_to_be16(commands[i]);
+        }
+    }
+    frame_words = count;
+
+    // CC0: last word issued, CC1: gap after the last word elapsed, which also rewinds the count
+    nrfx_timer_compare(&word_counter, NRF_TIMER_CC_CHANNEL0, count, false);
+    nrfx_timer_extended_compare(&word_counter, NRF_TIMER_CC_CHANNEL1, count + 1,
+                                NRF_TIMER_SHORT_COMPARE1_CLEAR_MASK, false);
+
+    return 0;
+}
+
+void rhd_frame_arm(void)
+{
+    if (!frame_init_done || frame_armed)
+    {
+        return;
+    }
+
+    // The Zephyr SPIM driver re-enables END interrupts on its next transfer
+    nrf_spim_int_disable(RHD_SPIM, NRF_SPIM_INT_END_MASK);
+    nrf_spim_tx_list_enable(RHD_SPIM);
+    nrf_spim_rx_list_enable(RHD_SPIM);
+
+    nrfx_gpiote_out_task_enable(&gpiote, RHD_CS_PIN);
+    nrfx_gppi_channels_enable(BIT(ppi_end) | BIT(ppi_count) | BIT(ppi_stop));
+
+    frame_armed = true;
+}
+
+void rhd_frame_disarm(void)
+{
+    if (!frame_armed)
+    {
+        return;
+    }
+
+    rhd_frame_stream_stop();
+
+    nrfx_gppi_group_disable(start_group);
+    nrfx_gppi_channels_disable(BIT(ppi_end) | BIT(ppi_count) | BIT(ppi_stop));
+    nrf_timer_task_trigger(cs_timer.p_reg, NRF_TIMER_TASK_STOP);
+    nrf_timer_task_trigger(cs_timer.p_reg, NRF_TIMER_TASK_CLEAR);
+    nrfx_gpiote_out_task_disable(&gpiote, RHD_CS_PIN);
+
+    nrf_spim_tx_list_disable(RHD_SPIM);
+    nrf_spim_rx_list_disable(RHD_SPIM);
+    nrf_spim_event_clear(RHD_SPIM, NRF_SPIM_EVENT_END);
+
+    frame_armed = false;
+}
+
+void rhd_frame_set_word(size_t frame, size_t index, uint16_t command)
+{
+    if (frame >= RHD_FRAME_MAX_BLOCK || index >= frame_words)
+    {
+        return;
+    }
+    frame_tx[frame * frame_words + index] = sys_cpu_to_be16(command);
+}
+
+int rhd_frame_transfer(uint16_t *results)
+{
+    NRF_TIMER_Type *counter = word_counter.p_reg;
+    uint32_t spin = 0;
+
+    if (!frame_armed || streaming)
+    {
+        return -EPERM;
+    }
+
+    nrf_spim_tx_buffer_set(RHD_SPIM, (const uint8_t *)frame_tx, sizeof(uint16_t));
+    nrf_spim_rx_buffer_set(RHD_SPIM, (uint8_t *)frame_rx[0], sizeof(uint16_t));
+
+    nrf_timer_task_trigger(counter, NRF_TIMER_TASK_CLEAR);
+    nrf_timer_event_clear(counter, NRF_TIMER_EVENT_COMPARE1);
+    nrfx_gppi_group_enable(start_group);
+
+    // First gap, then the PPI chain runs the frame without the CPU
+    nrf_timer_task_trigger(cs_timer.p_reg, NRF_TIMER_TASK_START);
+
+    // The frame is shorter than an interrupt round trip, so poll for it
+    while (!nrf_timer_event_check(counter, NRF_TIMER_EVENT_COMPARE1))
+    {
+        if (++spin > RHD_FRAME_SPIN_LIMIT)
+        {
+            nrfx_gppi_group_disable(start_group);
+            LOG_ERR("Frame transfer timed out");
+            return -ETIMEDOUT;
+        }
+    }
+
+    for (size_t i = 0; i < frame_words; i++)
+    {
+        results[i] = sys_be16_to_cpu(frame_rx[0][i]);
+    }
+
+    return 0;
+}
+
+int rhd_frame_stream_start(uint32_t sample_rate_hz, size_t block_frames, rhd_frame_block_cb_t cb,
+                           int64_t *first_frame_ns)
+{
+    uint32_t period_ticks;
+    uint32_t first_period;
+    unsigned int key;
+    int ret;
+
+    if (!frame_armed || streaming)
+    {
+        return -EPERM;
+    }
+    if (sample_rate_hz == 0 || block_frames == 0 || block_frames > RHD_FRAME_MAX_BLOCK || cb == NULL ||
+        first_frame_ns == NULL)
+    {
+        return -EINVAL;
+    }
+
+    period_ticks = RHD_TIMER_HZ / sample_rate_hz;
+    if (period_ticks < frame_words * RHD_WORD_TICKS)
+    {
+        LOG_ERR("%u Hz leaves no room for a %zu word frame", sample_rate_hz, frame_words);
+        return -EINVAL;
+    }
+
+    ret = frame_hfxo_request();
+    if (ret < 0)
+    {
+        LOG_WRN("HFXO request failed (%d), sample clock runs on HFINT", ret);
+    }
+
+    stream_cb = cb;
+    stream_frames = block_frames;
+    stream_rx = stream_take_rx(NULL);
+    stream_rx_queued = stream_take_rx(stream_rx);
+    stream_rate = sample_rate_hz;
+    period_base = period_ticks;
+    period_rem = RHD_TIMER_HZ % sample_rate_hz;
+    period_acc = 0;
+
+    nrf_spim_tx_buffer_set(RHD_SPIM, (const uint8_t *)frame_tx, sizeof(uint16_t));
+    nrf_spim_rx_buffer_set(RHD_SPIM, (uint8_t *)stream_rx, sizeof(uint16_t));
+
+    nrf_timer_task_trigger(word_counter.p_reg, NRF_TIMER_TASK_CLEAR);
+    nrfx_timer_clear(&block_counter);
+    nrfx_timer_extended_compare(&block_counter, NRF_TIMER_CC_CHANNEL0, block_frames,
+                                NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK, true);
+    first_period = stream_next_period();
+    nrfx_timer_extended_compare(&sample_clock, NRF_TIMER_CC_CHANNEL0, first_period,
+                                NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK, false);
+
+    streaming = true;
+    nrfx_gppi_channels_enable(BIT(ppi_frame) | BIT(ppi_done));
+
+    // The crystal is running and the first tick armed: the first frame starts one period from the
+    // enable, read back before the block interrupt can use it
+    key = irq_lock();
+    nrfx_timer_enable(&sample_clock);
+    *first_frame_ns = k_ticks_to_ns_floor64(k_uptime_ticks()) + (int64_t)first_period * NSEC_PER_SEC / RHD_TIMER_HZ;
+    irq_unlock(key);
+
+    LOG_INF("Hardware-timed acquisition: %u Hz, %zu frames per block", sample_rate_hz, block_frames);
+    return 0;
+}
+
+void rhd_frame_set_rx(uint16_t *buffer)
+{
+    if (stream_rx_given_count < ARRAY_SIZE(stream_rx_given))
+    {
+        stream_rx_given[stream_rx_given_count++] = buffer;
+    }
+}
+
+void rhd_frame_clear_rx(void)
+{
+    stream_rx_given_count = 0;
+}
+
+size_t rhd_frame_stream_stop(void)
+{
+    uint32_t spin = 0;
+    unsigned int key;
+    size_t frames;
+
+    if (!streaming)
+    {
+        return 0;
+    }
+
+    // No new frames: stop the sample clock and its PPI link
+    nrfx_timer_disable(&sample_clock);
+    nrfx_gppi_channels_disable(BIT(ppi_frame));
+
+    // A frame started just before counts its first word after one CS gap. Let it run to the gap after
+    // its last word (word counter CC1, which rewinds the count) so it is neither cut short nor lost;
+    // a block it completes is handed over by the block interrupt as usual.
+    k_busy_wait(1);
+    nrf_timer_task_trigger(word_counter.p_reg, NRF_TIMER_TASK_CAPTURE2);
+    while (nrf_timer_cc_get(word_counter.p_reg, NRF_TIMER_CC_CHANNEL2) != 0)
+    {
+        if (++spin > RHD_FRAME_SPIN_LIMIT)
+        {
+            LOG_ERR("Frame in flight did not finish");
+            nrfx_gppi_group_disable(start_group);
+            break;
+        }
+        nrf_timer_task_trigger(word_counter.p_reg, NRF_TIMER_TASK_CAPTURE2);
+    }
+
+    key = irq_lock();
+    nrfx_gppi_channels_disable(BIT(ppi_done));
+    nrfx_timer_compare_int_disable(&block_counter, NRF_TIMER_CC_CHANNEL0);
+    nrf_timer_task_trigger(block_counter.p_reg, NRF_TIMER_TASK_CAPTURE1);
+    frames = nrf_timer_cc_get(block_counter.p_reg, NRF_TIMER_CC_CHANNEL1);
+    if (nrf_timer_event_check(block_counter.p_reg, NRF_TIMER_EVENT_COMPARE0))
+    {
+        // The last frame filled the block and the counter rewound, but its interrupt never ran
+        frames = stream_frames;
+        nrf_timer_event_clear(block_counter.p_reg, NRF_TIMER_EVENT_COMPARE0);
+    }
+    streaming = false;
+    stream_rx_given_count = 0;
+    irq_unlock(key);
+
+    frame_hfxo_release();
+    return frames;
+}
@@ -8,18 +8,28 @@
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/devicetree.h>
 #include <zephyr/debug/stack.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/settings/settings.h>
 #include <stdio.h>
 
 #include <zephyr/logging/log.h>
 #include "../inc/neural_data.h"
 #include "../inc/sd_card.h"
 #include "../inc/fifo_buffer.h"
+#include "../inc/data_stats.h"
+#include "../inc/spill.h"
+#include "../inc/sd_raw.h"
+#include "../inc/session_file.h"
 
 LOG_MODULE_REGISTER(sd_card, LOG_LEVEL_DBG); // different in sample code, was CONFIG_MODULE_SD_CARD_LOG_LEVEL, for module specific Kconfig files
 
 #define SD_ROOT_PATH "/SD:/"
 #define PATH_MAX_LEN 260
 #define K_SEM_OPER_TIMEOUT_MS 1000
+#define SD_READY_TIMEOUT_MS 1000 // Longest wait for the card to come out of power-up
+#define SD_READY_POLL_MS 5
+#define SD_RECOVERY_MARKER "recovered.txt" // In a session folder whose last segment was trimmed at boot
 
 K_SEM_DEFINE(m_sem_sd_oper_ongoing, 1, 1);
 
@@ -35,9 +45,26 @@ static struct fs_mount_t mnt_pt = {
 static char current_data_folder[PATH_MAX_LEN + 1];
 
 #define WRITE_INTERVAL_MS 500
-#define MAX_FILE_SIZE (76128) // 76 KB - equivalent to 2.4 seconds recording (including timestamps)
+// 32 MB segments: a whole number of clusters at any FAT or exFAT cluster size, and well past what
+// SD_SEGMENT_MAX_MS holds at the highest rate, so segments rotate on time rather than on size
+#define MAX_FILE_SIZE (32UL * 1024 * 1024)
 // #define WRITE_BUFFER_SIZE (25376) // 25 KB write buffer (0.8 second of recording)
-#define MAX_NEURAL_DATA_PER_WRITE 128 // 128 NeuralData structs per write
+#define MAX_NEURAL_DATA_PER_WRITE SD_CARD_WRITE_SAMPLES // 128 NeuralData structs per write
+#define SD_FLUSH_TIMEOUT_MS 1000      // A partial write goes out after this long without a full one
+#define SD_SYNC_INTERVAL_MS 1000      // Longest an appended write waits for fs_sync
+#define SD_SEGMENT_MAX_MS 60000       // A segment is closed after this long even below MAX_FILE_SIZE
+#define SD_SECTOR_SIZE 512
+// Staging buffers of one session file block each: one filling while the others are queued or in flight to the card
+#define SD_IO_BUFFERS 3
+// Segment size, the session header plus MAX_FILE_SIZE rounded down to whole blocks
+#define SD_SEGMENT_SIZE \
+    (SESSION_HEADER_SIZE + ((MAX_FILE_SIZE - SESSION_HEADER_SIZE) / SESSION_BLOCK_SIZE) * SESSION_BLOCK_SIZE)
+
+BUILD_ASSERT(SESSION_HEADER_SIZE % SD_SECTOR_SIZE == 0 && SESSION_BLOCK_SIZE % SD_SECTOR_SIZE == 0,
+             "Session files must be written in whole sectors");
+BUILD_ASSERT(SD_SEGMENT_SIZE >= SESSION_HEADER_SIZE + SESSION_BLOCK_SIZE, "MAX_FILE_SIZE must hold one block");
+BUILD_ASSERT((MAX_FILE_SIZE & (MAX_FILE_SIZE - 1)) == 0 && MAX_FILE_SIZE >= 1024 * 1024,
+             "MAX_FILE_SIZE must be a power of two in megabytes, so it is a cluster multiple");
 
 K_THREAD_STACK_DEFINE(sd_card_stack, SD_CARD_THREAD_STACK_SIZE);
 struct k_thread sd_card_thread_data; // Declare the thread data structure for the fakedata thread
@@ -225,6 +252,517 @@ int sd_card_open_write_close(char const *const filename, char const *const data,
     return 0;
 }
 
+// Streaming writer: one segment file stays open between appends. Appends are packed into session file
+// blocks that go out in whole sectors at sector-aligned offsets of a preallocated segment, so FatFs never
+// reads back a partial sector or walks the FAT to extend the file.
+static struct fs_file_t stream_file;
+static bool stream_open;
+static uint32_t stream_session; // f_session_N folder number
+static uint32_t stream_segment;
+static bool stream_header_due;  // Raw log: write a session header before the next block
+static uint16_t stream_raw_pending; // Raw log: records of the last block, its tail may still be buffered
+static size_t stream_size;
+static size_t stream_unsynced;
+static int64_t stream_opened_ms;
+static int64_t stream_synced_ms;
+static struct sd_card_stream_stats stream_stats;
+static struct k_spinlock stream_stats_lock; // The writer thread reads them while the I/O thread holds the SD semaphore
+
+// Staging buffers between the writer thread, which fills them, and the I/O thread, which seals and
+// writes them out. The writer only waits for the card when all SD_IO_BUFFERS are queued.
+struct sd_io_buffer
+{
+    uint8_t data[SESSION_BLOCK_SIZE] __aligned(4); // Session file block, none when its count is 0
+    bool sync;  // Sync (files) or flush (raw log) after writing
+    bool close; // Close the segment after writing
+};
+
+static struct sd_io_buffer sd_io_buffers[SD_IO_BUFFERS];
+K_MSGQ_DEFINE(sd_io_free, sizeof(struct sd_io_buffer *), SD_IO_BUFFERS, 4);
+K_MSGQ_DEFINE(sd_io_full, sizeof(struct sd_io_buffer *), SD_IO_BUFFERS, 4);
+static struct sd_io_buffer *stream_fill; // Being filled by the writer thread, NULL when none is held
+static uint32_t stream_sequence;         // Writer thread: blocks started in the session
+static NeuralData stream_last;           // Writer thread: last sample packed into stream_fill
+static uint8_t stream_header[SESSION_HEADER_SIZE] __aligned(4);
+
+K_THREAD_STACK_DEFINE(sd_io_stack, SD_IO_THREAD_STACK_SIZE);
+struct k_thread sd_io_thread_data;
+
+static uint32_t sd_card_elapsed_us(uint32_t start_cycles)
+{
+    return k_cyc_to_us_floor32(k_cycle_get_32() - start_cycles);
+}
+
+static void sd_card_stream_account(uint32_t us)
+{
+    k_spinlock_key_t key = k_spin_lock(&stream_stats_lock);
+
+    stream_stats.writes++;
+    stream_stats.write_last_us = us;
+    stream_stats.write_max_us = MAX(stream_stats.write_max_us, us);
+    stream_stats.write_total_us += us;
+    k_spin_unlock(&stream_stats_lock, key);
+}
+
+BUILD_ASSERT(FF_USE_EXPAND, "Segment preallocation needs f_expand(), enable CONFIG_FS_FATFS_EXTRA_NATIVE_API");
+
+// Allocate size bytes to a new empty file up front as one contiguous run of clusters, so appends do not
+// walk the FAT. Without such a run the file is left empty and grows as it is written, rather than
+// zero-filling a cluster chain on the spot.
+static void sd_card_preallocate(struct fs_file_t *file, size_t size)
+{
+    FRESULT res = f_expand((FIL *)file->filep, size, 1);
+
+    if (res != FR_OK)
+    {
+        LOG_WRN("No contiguous space for %zu bytes (FatFs %d), appending", size, res);
+    }
+}
+
+static int sd_card_stream_sync_locked(void)
+{
+    uint32_t start = k_cycle_get_32();
+    k_spinlock_key_t key;
+    uint32_t us;
+    int ret;
+
+    ret = fs_sync(&stream_file);
+    if (ret)
+    {
+        LOG_ERR("Sync stream segment failed: %d", ret);
+        return ret;
+    }
+    us = sd_card_elapsed_us(start);
+    key = k_spin_lock(&stream_stats_lock);
+    stream_stats.sync_max_us = MAX(stream_stats.sync_max_us, us);
+    k_spin_unlock(&stream_stats_lock, key);
+    stream_unsynced = 0;
+    stream_synced_ms = k_uptime_get();
+    return 0;
+}
+
+static int sd_card_stream_close_locked(void)
+{
+    int ret;
+
+    if (!stream_open)
+    {
+        return 0;
+    }
+
+    // Give back the preallocated space that was not used
+    stream_open = false;
+    ret = fs_truncate(&stream_file, stream_size);
+    if (ret)
+    {
+        LOG_ERR("Truncate stream segment failed: %d", ret);
+    }
+    ret = fs_close(&stream_file);
+    if (ret)
+    {
+        LOG_ERR("Close stream segment failed: %d", ret);
+        return ret;
+    }
+    LOG_INF("Closed segment %u, %zu bytes", stream_segment - 1, stream_size);
+    return 0;
+}
+
+// Session header of the next segment, or of the raw log stream, in stream_header
+static void sd_card_stream_header(uint32_t session, uint32_t segment)
+{
+    memset(stream_header, 0, sizeof(stream_header));
+    session_file_header_init((struct session_file_header *)stream_header, session, segment);
+}
+
+static int sd_card_stream_open_locked(void)
+{
+    k_spinlock_key_t key;
+    int ret;
+
+    if (snprintf(abs_path_name, sizeof(abs_path_name), "%s/data_%u.bin", current_data_folder, stream_segment) >=
+        sizeof(abs_path_name))
+    {
+        LOG_ERR("Filename is too long");
+        return -ENAMETOOLONG;
+    }
+
+    fs_file_t_init(&stream_file);
+    ret = fs_open(&stream_file, abs_path_name, FS_O_CREATE | FS_O_WRITE);
+    if (ret)
+    {
+        LOG_ERR("Create stream segment failed: %d", ret);
+        return ret;
+    }
+    sd_card_preallocate(&stream_file, MAX_FILE_SIZE);
+    sd_card_stream_header(stream_session, stream_segment);
+    ret = fs_write(&stream_file, stream_header, SESSION_HEADER_SIZE);
+    if (ret != SESSION_HEADER_SIZE)
+    {
+        ret = ret < 0 ? ret : -EIO;
+        LOG_ERR("Write stream segment header failed: %d", ret);
+        fs_close(&stream_file);
+        return ret;
+    }
+
+    LOG_INF("Streaming to %s", abs_path_name);
+    stream_segment++;
+    key = k_spin_lock(&stream_stats_lock);
+    stream_stats.segments++;
+    k_spin_unlock(&stream_stats_lock, key);
+    stream_open = true;
+    stream_size = SESSION_HEADER_SIZE;
+    stream_unsynced = SESSION_HEADER_SIZE;
+    stream_opened_ms = k_uptime_get();
+    stream_synced_ms = stream_opened_ms;
+
+    // Commit the directory entry and the preallocated size now, so a reset before the first
+    // interval sync still leaves a segment that sd_card_recover_session() can trim
+    sd_card_stream_sync_locked();
+    return 0;
+}
+
+// Write out a sealed block, a partly filled one goes out padded so the segment stays sector aligned
+static int sd_card_stream_flush_locked(const uint8_t *block)
+{
+    const struct session_block_header *header = (const struct session_block_header *)block;
+    uint32_t start;
+    uint32_t us;
+    int ret;
+
+    if (stream_open &&
+        (stream_size + SESSION_BLOCK_SIZE > SD_SEGMENT_SIZE || k_uptime_get() - stream_opened_ms >= SD_SEGMENT_MAX_MS))
+    {
+        sd_card_stream_close_locked();
+    }
+    if (!stream_open)
+    {
+        ret = sd_card_stream_open_locked();
+        if (ret)
+        {
+            goto drop;
+        }
+    }
+
+    start = k_cycle_get_32();
+    ret = fs_write(&stream_file, block, SESSION_BLOCK_SIZE);
+    if (ret != SESSION_BLOCK_SIZE)
+    {
+        // Leave the segment as it is, the next write starts a new one
+        ret = ret < 0 ? ret : -EIO;
+        LOG_ERR("Write stream segment failed: %d", ret);
+        sd_card_stream_close_locked();
+        goto drop;
+    }
+    us = sd_card_elapsed_us(start);
+
+    stream_size += SESSION_BLOCK_SIZE;
+    stream_unsynced += SESSION_BLOCK_SIZE;
+    sd_card_stream_account(us);
+
+    if (k_uptime_get() - stream_synced_ms >= SD_SYNC_INTERVAL_MS)
+    {
+        // A failed sync is retried at the next interval
+        sd_card_stream_sync_locked();
+    }
+    return 0;
+
+drop:
+    data_stats_add(DATA_STAT_SD_DROPPED, header->count);
+    return ret;
+}
+
+// A session block with any bytes in a lost raw block fails its CRC, its records are dropped
+static void sd_card_raw_lost_pending(size_t lost_buffered)
+{
+    if (lost_buffered > 0)
+    {
+        data_stats_add(DATA_STAT_SD_DROPPED, stream_raw_pending);
+        stream_raw_pending = 0;
+    }
+}
+
+// Append a sealed block to the raw log, after a session header at the start of the session or after a close
+static void sd_card_raw_write_locked(const uint8_t *block)
+{
+    const struct session_block_header *header = (const struct session_block_header *)block;
+    size_t lost, lost_buffered;
+    uint32_t start;
+    uint32_t us;
+    int blocks;
+
+    if (stream_header_due)
+    {
+        sd_card_stream_header(sd_raw_session(), 0);
+        sd_raw_write((const char *)stream_header, SESSION_HEADER_SIZE, &lost, &lost_buffered);
+        sd_card_raw_lost_pending(lost_buffered);
+        if (lost > 0)
+        {
+            LOG_WRN("Raw log session header write failed");
+        }
+        stream_header_due = false;
+    }
+
+    start = k_cycle_get_32();
+    blocks = sd_raw_write((const char *)block, SESSION_BLOCK_SIZE, &lost, &lost_buffered);
+    if (blocks < 0)
+    {
+        data_stats_add(DATA_STAT_SD_DROPPED, header->count);
+        return;
+    }
+    us = sd_card_elapsed_us(start);
+
+    // The previous block is lost with a raw block that held its tail, this one with any of its own
+    sd_card_raw_lost_pending(lost_buffered);
+    if (lost > 0)
+    {
+        data_stats_add(DATA_STAT_SD_DROPPED, header->count);
+    }
+    stream_raw_pending = lost > 0 ? 0 : header->count;
+
+    // Each raw block is one card write, timed together with the copy that filled it
+    for (int i = 0; i < blocks; i++)
+    {
+        sd_card_stream_account(us / blocks);
+    }
+}
+
+// Seal one queued buffer and write it to the active backend
+static void sd_card_io_write(struct sd_io_buffer *buf)
+{
+    const struct session_block_header *header = (const struct session_block_header *)buf->data;
+    bool block = header->count > 0;
+
+    if (block)
+    {
+        session_block_seal(buf->data);
+    }
+
+    k_sem_take(&m_sem_sd_oper_ongoing, K_FOREVER);
+
+    if (sd_raw_active())
+    {
+        if (block)
+        {
+            sd_card_raw_write_locked(buf->data);
+        }
+        if (buf->sync || buf->close)
+        {
+            size_t lost;
+
+            sd_raw_flush(&lost);
+            sd_card_raw_lost_pending(lost);
+            stream_raw_pending = 0;
+        }
+        if (buf->close)
+        {
+            stream_header_due = true;
+        }
+    }
+    else
+    {
+        if (block)
+        {
+            sd_card_stream_flush_locked(buf->data);
+        }
+        if (buf->close)
+        {
+            sd_card_stream_close_locked();
+        }
+        else if (buf->sync && stream_open && stream_unsynced > 0)
+        {
+            sd_card_stream_sync_locked();
+        }
+    }
+
+    k_sem_give(&m_sem_sd_oper_ongoing);
+}
+
+void sd_card_io_thread(void *arg1, void *arg2, void *arg3)
+{
+    struct sd_card_stream_stats stats;
+    uint32_t reported_segments = 0;
+    struct sd_io_buffer *buf;
+
+    while (1)
+    {
+        k_msgq_get(&sd_io_full, &buf, K_FOREVER);
+        sd_card_io_write(buf);
+        k_msgq_put(&sd_io_free, &buf, K_FOREVER);
+
+        // Report write latency once per segment
+        sd_card_get_stream_stats(&stats);
+        if (stats.segments != reported_segments && stats.writes > 0)
+        {
+            LOG_INF("SD writes: %u, last %u us, max %u us, mean %u us, max sync %u us, %u queued", stats.writes,
+                    stats.write_last_us, stats.write_max_us, (uint32_t)(stats.write_total_us / stats.writes),
+                    stats.sync_max_us, k_msgq_num_used_get(&sd_io_full));
+            reported_segments = stats.segments;
+        }
+    }
+}
+
+// Take a free buffer with an empty block to fill, waits only while every buffer is queued for the card
+static struct session_block_header *sd_card_stream_take(void)
+{
+    if (stream_fill == NULL)
+    {
+        k_msgq_get(&sd_io_free, &stream_fill, K_FOREVER);
+        ((struct session_block_header *)stream_fill->data)->count = 0;
+    }
+    return (struct session_block_header *)stream_fill->data;
+}
+
+// Hand the buffer being filled to the I/O thread, flagged, and take a free one. Writer thread only.
+static void sd_card_stream_submit(bool sync, bool close)
+{
+    sd_card_stream_take();
+    stream_fill->sync = sync;
+    stream_fill->close = close;
+    k_msgq_put(&sd_io_full, &stream_fill, K_FOREVER);
+    stream_fill = NULL;
+}
+
+int sd_card_stream_write(const NeuralData *samples, size_t count)
+{
+    if (!sd_init_success)
+    {
+        return -ENODEV;
+    }
+
+    while (count > 0)
+    {
+        struct session_block_header *header = sd_card_stream_take();
+        size_t n;
+
+        if (stream_sequence > 0 && samples->index <= stream_last.index)
+        {
+            // A restarted index means intan_configure() ran. The segment is closed, even when the
+            // last block already went out, so the next one's header carries the new config.
+            sd_card_stream_submit(false, true);
+            header = sd_card_stream_take();
+        }
+        else if (header->count > 0 && !session_run_continues(&stream_last, samples))
+        {
+            // A gap or new flags end the block
+            sd_card_stream_submit(false, false);
+            continue;
+        }
+        if (header->count == 0)
+        {
+            *header = (struct session_block_header){
+                .magic = SESSION_MAGIC_BLOCK,
+                .sequence = stream_sequence++,
+                .first_index = samples->index,
+                .timestamp = samples->timestamp,
+                .flags = samples->flags,
+            };
+        }
+
+        n = MIN(session_run_length(samples, count), SESSION_BLOCK_RECORDS - header->count);
+        session_copy_records(&stream_fill->data[sizeof(*header) + header->count * SESSION_RECORD_SIZE], samples, n);
+        header->count += n;
+        stream_last = samples[n - 1];
+        samples += n;
+        count -= n;
+        if (header->count == SESSION_BLOCK_RECORDS)
+        {
+            sd_card_stream_submit(false, false);
+        }
+    }
+    return 0;
+}
+
+int sd_card_stream_sync(void)
+{
+    if (!sd_init_success)
+    {
+        return -ENODEV;
+    }
+
+    sd_card_stream_submit(true, false);
+    return 0;
+}
+
+int sd_card_stream_close(void)
+{
+    if (!sd_init_success)
+    {
+        return -ENODEV;
+    }
+
+    sd_card_stream_submit(false, true);
+    return 0;
+}
+
+void sd_card_get_stream_stats(struct sd_card_stream_stats *stats)
+{
+    k_spinlock_key_t key = k_spin_lock(&stream_stats_lock);
+
+    *stats = stream_stats;
+    k_spin_unlock(&stream_stats_lock, key);
+}
+
+#if defined(CONFIG_APP_SD_BENCHMARK)
+#define SD_BENCH_WRITES 32
+
+// Time SD_BENCH_WRITES whole-block writes to a new file, appended as the file grows against written into
+// space preallocated by f_expand(), the allocation included. Same data and write size in both runs, so
+// the difference is the FAT work of growing the file cluster by cluster.
+static void sd_card_benchmark(void)
+{
+    static const char *const names[] = {"append", "preallocated"};
+    char path[PATH_MAX_LEN + 1];
+    struct fs_file_t file;
+    int ret;
+
+    snprintf(path, sizeof(path), "%s/bench.bin", current_data_folder);
+    for (size_t m = 0; m < ARRAY_SIZE(names); m++)
+    {
+        uint32_t alloc_us = 0;
+        uint32_t write_us = 0;
+        uint32_t max_us = 0;
+
+        fs_file_t_init(&file);
+        ret = fs_open(&file, path, FS_O_CREATE | FS_O_WRITE);
+        if (ret == 0 && m == 1)
+        {
+            uint32_t start = k_cycle_get_32();
+
+            ret = f_expand((FIL *)file.filep, SD_BENCH_WRITES * SESSION_BLOCK_SIZE, 1) == FR_OK ? 0 : -ENOSPC;
+            alloc_us = sd_card_elapsed_us(start);
+        }
+        for (int i = 0; i < SD_BENCH_WRITES && ret == 0; i++)
+        {
+            uint32_t start = k_cycle_get_32();
+            uint32_t us;
+
+            ret = fs_write(&file, sd_io_buffers[0].data, SESSION_BLOCK_SIZE) == SESSION_BLOCK_SIZE ? 0 : -EIO;
+            us = sd_card_elapsed_us(start);
+            write_us += us;
+            max_us = MAX(max_us, us);
+        }
+        if (ret == 0)
+        {
+            ret = fs_close(&file);
+        }
+        else
+        {
+            fs_close(&file);
+        }
+        fs_unlink(path);
+        if (ret)
+        {
+            LOG_WRN("SD write benchmark failed (%d)", ret);
+            return;
+        }
+        LOG_INF("SD %s: %d x %d byte writes, allocation %u us, mean %u us, max %u us, %u bytes/ms overall",
+                names[m], SD_BENCH_WRITES, SESSION_BLOCK_SIZE, alloc_us, write_us / SD_BENCH_WRITES, max_us,
+                (uint32_t)((uint64_t)SD_BENCH_WRITES * SESSION_BLOCK_SIZE * USEC_PER_MSEC /
+                           MAX(alloc_us + write_us, 1)));
+    }
+}
+#endif
+
 int sd_card_open_read_close(char const *const filename, char *const buf, size_t *size)
 {
     int ret;
@@ -470,6 +1008,403 @@ int find_highest_session_number(void)
     return highest_session;
 }
 
+// Last data_N.bin of a session folder and its size, -ENOENT when the folder holds none
+static int sd_card_last_segment(const char *folder, uint32_t *segment, size_t *size)
+{
+    struct fs_dir_t dirp;
+    struct fs_dirent entry;
+    bool found = false;
+    unsigned int n;
+    int ret;
+
+    fs_dir_t_init(&dirp);
+    ret = fs_opendir(&dirp, folder);
+    if (ret)
+    {
+        return ret;
+    }
+    while (fs_readdir(&dirp, &entry) == 0 && entry.name[0] != 0)
+    {
+        if (entry.type == FS_DIR_ENTRY_FILE && sscanf(entry.name, "data_%u.bin", &n) == 1 &&
+            (!found || n > *segment))
+        {
+            *segment = n;
+            *size = entry.size;
+            found = true;
+        }
+    }
+    fs_closedir(&dirp);
+    return found ? 0 : -ENOENT;
+}
+
+/*
+ * Boot-time recovery of a session cut off by a reset. Closed segments are truncated to their
+ * blocks, so only the last one can be in doubt: left open, it keeps its preallocated size, and
+ * past the last block written it holds whatever the clusters held before. Its blocks are walked from the header while each is intact (CRC), continues the block
+ * sequence and moves the sample index forward; the file is truncated after the last such block
+ * and a line is appended to SD_RECOVERY_MARKER in the session folder.
+ */
+static int sd_card_recover_session(uint32_t session)
+{
+    // The staging buffers are not handed to the I/O thread before sd_card_init() is done with them
+    uint8_t *block = sd_io_buffers[0].data;
+    const struct session_block_header *header = (const struct session_block_header *)block;
+    char folder[PATH_MAX_LEN + 1];
+    struct fs_file_t file;
+    uint32_t segment;
+    uint32_t blocks = 0;
+    uint32_t first_sequence = 0;
+    uint32_t next_sequence = 0;
+    uint32_t next_index = 0;
+    size_t size;
+    size_t kept = 0;
+    int ret;
+
+    snprintf(folder, sizeof(folder), "%s/f_session_%u", sd_root_path, session);
+    ret = sd_card_last_segment(folder, &segment, &size);
+    if (ret)
+    {
+        return ret == -ENOENT ? 0 : ret;
+    }
+    // Closed cleanly: a header and whole blocks, short of the preallocated size
+    if (size < SD_SEGMENT_SIZE && size >= SESSION_HEADER_SIZE && (size - SESSION_HEADER_SIZE) % SESSION_BLOCK_SIZE == 0)
+    {
+        return 0;
+    }
+
+    snprintf(abs_path_name, sizeof(abs_path_name), "%s/data_%u.bin", folder, segment);
+    fs_file_t_init(&file);
+    ret = fs_open(&file, abs_path_name, FS_O_RDWR);
+    if (ret)
+    {
+        return ret;
+    }
+
+    if (fs_read(&file, block, SESSION_HEADER_SIZE) == SESSION_HEADER_SIZE &&
+        session_file_header_valid((const struct session_file_header *)block))
+    {
+        kept = SESSION_HEADER_SIZE;
+        while (kept + SESSION_BLOCK_SIZE <= size && fs_read(&file, block, SESSION_BLOCK_SIZE) == SESSION_BLOCK_SIZE &&
+               session_block_valid(block) && (blocks == 0 || (header->sequence == next_sequence &&
+                                                              (int32_t)(header->first_index - next_index) >= 0)))
+        {
+            if (blocks == 0)
+            {
+                first_sequence = header->sequence;
+            }
+            next_sequence = header->sequence + 1;
+            next_index = header->first_index + header->count;
+            kept += SESSION_BLOCK_SIZE;
+            blocks++;
+        }
+    }
+
+    if (kept == size)
+    {
+        // Ended exactly on a full segment
+        return fs_close(&file);
+    }
+    ret = fs_truncate(&file, kept);
+    fs_close(&file);
+    if (ret)
+    {
+        LOG_ERR("Trimming %s failed (err %d)", abs_path_name, ret);
+        return ret;
+    }
+    LOG_WRN("Recovered session %u: %s keeps %u blocks, %zu bytes trimmed", session, abs_path_name, blocks,
+            size - kept);
+
+    // Recovery marker, one line per trimmed segment
+    char line[128];
+    int len;
+    if (blocks > 0)
+    {
+        len = snprintf(line, sizeof(line), "data_%u.bin: %u blocks kept (sequence %u-%u, samples to %u), %zu bytes trimmed\n",
+                       segment, blocks, first_sequence, next_sequence - 1, next_index - 1, size - kept);
+    }
+    else
+    {
+        len = snprintf(line, sizeof(line), "data_%u.bin: no intact blocks, %zu bytes trimmed\n", segment, size - kept);
+    }
+    snprintf(abs_path_name, sizeof(abs_path_name), "%s/%s", folder, SD_RECOVERY_MARKER);
+    fs_file_t_init(&file);
+    ret = fs_open(&file, abs_path_name, FS_O_CREATE | FS_O_WRITE | FS_O_APPEND);
+    if (ret)
+    {
+        return ret;
+    }
+    ret = fs_write(&file, line, len);
+    fs_close(&file);
+    return ret == len ? 0 : -EIO;
+}
+
+// MBR partition table: four 16 byte entries from offset 446, then the 0x55AA signature
+#define MBR_PARTITION_TABLE 446
+#define MBR_PARTITION_ENTRY 16
+#define MBR_PARTITION_TYPE_GPT 0xEE
+#define MBR_BOOT_INACTIVE 0x00
+#define MBR_BOOT_ACTIVE 0x80
+
+// Boot-time sector reads, sd_card_init() only
+static uint8_t sd_sector[SD_RAW_SECTOR_SIZE] __aligned(4);
+
+// A FAT12/16, FAT32 or exFAT boot sector: an x86 jump, then the filesystem name where that variant keeps it.
+// It ends in 0x55AA too, and its boot code overlaps where a partition table would be.
+static bool sd_card_is_boot_sector(const uint8_t *sector)
+{
+    if (!(sector[0] == 0xEB && sector[2] == 0x90) && sector[0] != 0xE9)
+    {
+        return false;
+    }
+    return memcmp(&sector[3], "EXFAT   ", 8) == 0 || memcmp(&sector[54], "FAT", 3) == 0 ||
+           memcmp(&sector[82], "FAT", 3) == 0;
+}
+
+// The sd_raw region: an MBR partition of type SD_RAW_PARTITION_TYPE, from its first block boundary to its
+// end. The raw log only ever writes where the card was partitioned for it. -ENOENT without such a
+// partition or without an MBR, -EINVAL for a partition table that does not hold together.
+static int sd_card_raw_partition(const char *disk, uint32_t sector_count, uint32_t *first_sector,
+                                 uint32_t *region_sectors)
+{
+    uint8_t *mbr = sd_sector;
+    uint32_t starts[4];
+    uint32_t counts[4];
+    int raw = -1;
+    int ret;
+
+    ret = disk_access_read(disk, mbr, 0, 1);
+    if (ret)
+    {
+        return ret;
+    }
+    if (mbr[510] != 0x55 || mbr[511] != 0xAA || sd_card_is_boot_sector(mbr))
+    {
+        // Blank, or a volume on the whole card
+        return -ENOENT;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        const uint8_t *entry = &mbr[MBR_PARTITION_TABLE + i * MBR_PARTITION_ENTRY];
+
+        starts[i] = sys_get_le32(&entry[8]);
+        counts[i] = sys_get_le32(&entry[12]);
+        if (entry[0] != MBR_BOOT_INACTIVE && entry[0] != MBR_BOOT_ACTIVE)
+        {
+            return -EINVAL;
+        }
+        if (entry[4] == MBR_PARTITION_TYPE_GPT)
+        {
+            return -ENOTSUP;
+        }
+        if (entry[4] == 0)
+        {
+            counts[i] = 0;
+            continue;
+        }
+        // Written as a difference, start + count can wrap
+        if (starts[i] == 0 || counts[i] == 0 || starts[i] >= sector_count || counts[i] > sector_count - starts[i])
+        {
+            return -EINVAL;
+        }
+        if (entry[4] == SD_RAW_PARTITION_TYPE)
+        {
+            if (raw >= 0)
+            {
+                return -EINVAL;
+            }
+            raw = i;
+        }
+    }
+    if (raw < 0)
+    {
+        return -ENOENT;
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        if (i != raw && counts[i] > 0 && starts[i] < starts[raw] + counts[raw] && starts[raw] < starts[i] + counts[i])
+        {
+            return -EINVAL;
+        }
+    }
+
+    uint32_t pad = (SD_RAW_BLOCK_SECTORS - starts[raw] % SD_RAW_BLOCK_SECTORS) % SD_RAW_BLOCK_SECTORS;
+    if (pad >= counts[raw])
+    {
+        return -ENOSPC;
+    }
+    *first_sector = starts[raw] + pad;
+    *region_sectors = counts[raw] - pad;
+    return 0;
+}
+
+// Serial number FAT or exFAT gave the volume when it was formatted, in the boot sector of the
+// first partition or of the whole card
+// MBR partition types a FAT or exFAT volume is created with
+static bool sd_card_is_fat_type(uint8_t type)
+{
+    switch (type)
+    {
+    case 0x01: // FAT12
+    case 0x04: // FAT16 below 32 MB
+    case 0x06: // FAT16
+    case 0x07: // exFAT
+    case 0x0B: // FAT32 CHS
+    case 0x0C: // FAT32 LBA
+    case 0x0E: // FAT16 LBA
+        return true;
+    default:
+        return false;
+    }
+}
+
+static int sd_card_volume_serial(const char *disk, uint32_t *serial)
+{
+    int ret;
+
+    ret = disk_access_read(disk, sd_sector, 0, 1);
+    if (ret)
+    {
+        return ret;
+    }
+    if (sd_sector[510] != 0x55 || sd_sector[511] != 0xAA)
+    {
+        return -ENOENT;
+    }
+    // A partition table: read the boot sector of the first FAT or exFAT partition. Empty slots and the
+    // raw log partition, whose superblock changes every session, are skipped.
+    if (!sd_card_is_boot_sector(sd_sector))
+    {
+        uint32_t start = 0;
+
+        for (int i = 0; i < 4 && start == 0; i++)
+        {
+            const uint8_t *entry = &sd_sector[MBR_PARTITION_TABLE + i * MBR_PARTITION_ENTRY];
+
+            if (entry[4] != SD_RAW_PARTITION_TYPE && sd_card_is_fat_type(entry[4]))
+            {
+                start = sys_get_le32(&entry[8]);
+            }
+        }
+        if (start == 0)
+        {
+            return -ENOENT;
+        }
+
+        ret = disk_access_read(disk, sd_sector, start, 1);
+        if (ret)
+        {
+            return ret;
+        }
+        if (!sd_card_is_boot_sector(sd_sector))
+        {
+            return -ENOENT;
+        }
+    }
+
+    if (memcmp(&sd_sector[3], "EXFAT   ", 8) == 0)
+    {
+        *serial = sys_get_le32(&sd_sector[100]);
+    }
+    else if (memcmp(&sd_sector[82], "FAT32   ", 8) == 0)
+    {
+        *serial = sys_get_le32(&sd_sector[67]);
+    }
+    else
+    {
+        *serial = sys_get_le32(&sd_sector[39]); // FAT12/16
+    }
+    return 0;
+}
+
+// Session counter persisted in settings ("sd/session"), with the identity of the card it counts
+// folders on ("sd/card"). A card swapped or reformatted since gets a directory scan instead.
+struct sd_card_identity
+{
+    uint32_t sector_count;
+    uint32_t volume_serial;
+};
+
+static uint32_t stored_session;
+static struct sd_card_identity stored_card;
+static uint8_t stored_keys; // BIT(0) session, BIT(1) card loaded
+
+static int sd_card_settings_load(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg, void *param)
+{
+    if (settings_name_steq(key, "session", NULL) && len == sizeof(stored_session) &&
+        read_cb(cb_arg, &stored_session, len) == len)
+    {
+        stored_keys |= BIT(0);
+    }
+    else if (settings_name_steq(key, "card", NULL) && len == sizeof(stored_card) &&
+             read_cb(cb_arg, &stored_card, len) == len)
+    {
+        stored_keys |= BIT(1);
+    }
+    return 0;
+}
+
+// Highest session number on the card: the stored counter when it belongs to this card, a root directory scan otherwise
+static int sd_card_last_session(const struct sd_card_identity *card, bool *settings_ok)
+{
+    int ret = settings_subsys_init();
+
+    if (ret == 0)
+    {
+        ret = settings_load_subtree_direct("sd", sd_card_settings_load, NULL);
+    }
+    *settings_ok = ret == 0;
+    if (ret)
+    {
+        LOG_WRN("Settings unavailable (err %d), scanning for the session number", ret);
+    }
+    else if (stored_keys == (BIT(0) | BIT(1)) && memcmp(&stored_card, card, sizeof(*card)) == 0)
+    {
+        LOG_INF("Last session %u from settings", stored_session);
+        return stored_session;
+    }
+    else
+    {
+        LOG_INF("Card %08x not the stored one, scanning for the session number", card->volume_serial);
+    }
+    return find_highest_session_number();
+}
+
+static void sd_card_save_session(uint32_t session, const struct sd_card_identity *card)
+{
+    // NVS skips writes of an unchanged value, the card identity costs flash only when it changes
+    if (settings_save_one("sd/session", &session, sizeof(session)) != 0 ||
+        settings_save_one("sd/card", card, sizeof(*card)) != 0)
+    {
+        LOG_WRN("Saving the session counter failed, the next boot scans");
+    }
+}
+
+// Poll until the card answers and reports ready, in place of a fixed power-up delay
+static int sd_card_wait_ready(const char *disk)
+{
+    int64_t deadline = k_uptime_get() + SD_READY_TIMEOUT_MS;
+    int ret;
+
+    while (1)
+    {
+        ret = disk_access_init(disk);
+        if (ret == 0)
+        {
+            ret = disk_access_status(disk);
+            if (ret == DISK_STATUS_OK)
+            {
+                return 0;
+            }
+        }
+        if (k_uptime_get() >= deadline)
+        {
+            return ret ? ret : -ETIMEDOUT;
+        }
+        k_sleep(K_MSEC(SD_READY_POLL_MS));
+    }
+}
+
 int sd_card_init(void)
 {
     int ret;
@@ -477,35 +1412,26 @@ int sd_card_init(void)
     uint64_t sd_card_size_bytes;
     uint32_t sector_count;
     size_t sector_size;
+    int64_t init_start = k_uptime_get();
 
     // INITIALIZE SD CARD =============================================================================================
+#if DT_NODE_HAS_STATUS(DT_NODELABEL(spi3), okay)
     // Check if the SD device is available
     if (!device_is_ready(DEVICE_DT_GET(DT_NODELABEL(spi3))))
     {
         LOG_ERR("SD device is not ready");
         return -ENODEV;
     }
-    k_sleep(K_MSEC(1000));
+#endif
 
-    // Try to initialize disk access =============================================================================================
-    ret = disk_access_init(sd_dev);
+    // Initialize disk access, retried while the card powers up =====================================================
+    ret = sd_card_wait_ready(sd_dev);
     if (ret != 0)
     {
-        LOG_ERR("disk_access_init failed (err %d)", ret);
-        return ret;
-    }
-    LOG_INF("disk_access_init successful: %d", ret);
-    k_sleep(K_MSEC(200));
-
-    // Check disk status =============================================================================================
-    ret = disk_access_status(sd_dev);
-    if (ret != DISK_STATUS_OK)
-    {
-        LOG_ERR("disk_access_status failed (status %d)", ret);
+        LOG_ERR("SD card not ready after %d ms (err %d)", SD_READY_TIMEOUT_MS, ret);
         return ret;
     }
-    LOG_INF("disk_access_status successful: %d", ret);
-    k_sleep(K_MSEC(200));
+    LOG_INF("SD card ready after %lld ms", k_uptime_get() - init_start);
 
     // Try to get sector count =============================================================================================
     ret = disk_access_ioctl(sd_dev, DISK_IOCTL_GET_SECTOR_COUNT, &sector_count);
@@ -524,7 +1450,6 @@ int sd_card_init(void)
     LOG_INF("Sector size: %d bytes", sector_size);
     sd_card_size_bytes = (uint64_t)sector_count * sector_size;
     LOG_INF("SD card volume size: %d MB", (uint32_t)(sd_card_size_bytes >> 20));
-    k_sleep(K_MSEC(200));
 
     // Try to mount the filesystem =============================================================================================
     mnt_pt.mnt_point = sd_root_path; // add the sd_root_path to the mnt_pt struct
@@ -535,8 +1460,6 @@ int sd_card_init(void)
         return ret;
     }
     LOG_INF("SD card initialized and mounted successfully");
-    // Add a longer delay after mounting
-    k_sleep(K_MSEC(500));
 
     // Verify the mount point =============================================================================================
     struct fs_statvfs stats;
@@ -547,7 +1470,6 @@ int sd_card_init(void)
         return ret;
     }
     LOG_INF("Filesystem mounted at %s is accessible", mnt_pt.mnt_point);
-    k_sleep(K_MSEC(100));
 
     // LIST FILES AND FIND THE HIGHEST SESSION NUMBER =============================================================
     // char list_buf[4096];
@@ -560,14 +1482,30 @@ int sd_card_init(void)
     // }
     // LOG_INF("Files in root directory:\n%s", list_buf);
 
-    // Find the highest existing session number
-    int highest_session = find_highest_session_number();
+    // Find the highest existing session number, from settings when this is the card they were saved for
+    struct sd_card_identity card = {.sector_count = sector_count};
+    bool settings_ok;
+    if (sd_card_volume_serial(sd_dev, &card.volume_serial) != 0)
+    {
+        card.volume_serial = 0;
+    }
+    int highest_session = sd_card_last_session(&card, &settings_ok);
     if (highest_session < 0)
     {
         LOG_ERR("Failed to determine highest session number");
         highest_session = 0; // Handle error (maybe set a default value)
     }
 
+    // Trim the previous session if a reset cut it off
+    if (highest_session > 0)
+    {
+        ret = sd_card_recover_session(highest_session);
+        if (ret)
+        {
+            LOG_WRN("Recovery of session %d failed (err %d)", highest_session, ret);
+        }
+    }
+
     // Create a new folder for this session
     uint32_t new_session = highest_session + 1;
     snprintf(current_data_folder, sizeof(current_data_folder),
@@ -575,6 +1513,16 @@ int sd_card_init(void)
 
     LOG_INF("Attempting to create directory: %s", current_data_folder);
     ret = create_directory(current_data_folder);
+    if (ret == -EEXIST)
+    {
+        // Sessions were added under the same card identity after the counter was saved, fall back to the scan
+        highest_session = find_highest_session_number();
+        new_session = MAX(highest_session, 0) + 1;
+        snprintf(current_data_folder, sizeof(current_data_folder),
+                 "%s/f_session_%u", sd_root_path, new_session);
+        ret = create_directory(current_data_folder);
+    }
+    stream_session = new_session;
 
     if (ret == 0)
     {
@@ -585,20 +1533,51 @@ int sd_card_init(void)
         LOG_ERR("Failed to create directory %s, error: %d", current_data_folder, ret);
         return ret;
     }
+    if (settings_ok)
+    {
+        sd_card_save_session(new_session, &card);
+    }
+
+#if defined(CONFIG_APP_SD_BENCHMARK)
+    sd_card_benchmark();
+#endif
+
+    for (size_t i = 0; i < SD_IO_BUFFERS; i++)
+    {
+        struct sd_io_buffer *buf = &sd_io_buffers[i];
+
+        k_msgq_put(&sd_io_free, &buf, K_NO_WAIT);
+    }
+
+    // Record to the raw log when the card has a partition set aside for it, files otherwise
+    uint32_t raw_first;
+    uint32_t raw_sectors;
+    ret = sector_size == SD_RAW_SECTOR_SIZE ? sd_card_raw_partition(sd_dev, sector_count, &raw_first, &raw_sectors)
+                                            : -ENOTSUP;
+    if (ret != 0 && ret != -ENOENT)
+    {
+        LOG_WRN("Not using a raw log partition (err %d)", ret);
+    }
+    if (ret == 0 && sd_raw_init(sd_dev, raw_first, raw_sectors) == 0)
+    {
+        LOG_INF("Recording to the raw log partition, %u sectors from sector %u", raw_sectors, raw_first);
+        stream_header_due = true;
+    }
+    else
+    {
+        LOG_INF("Recording to files in %s", current_data_folder);
+    }
 
     sd_init_success = true; // indicate SD card is initialized for other funcs
+    LOG_INF("SD card ready to record %lld ms after init, %lld ms after boot", k_uptime_get() - init_start,
+            k_uptime_get());
     return 0;
 }
 
-// Static buffers to reduce stack usage
-static NeuralData data_buffer[MAX_NEURAL_DATA_PER_WRITE];
-static char filename[PATH_MAX_LEN + 1];
-
 void sd_card_writer_thread(void *arg1, void *arg2, void *arg3)
 {
     fifo_buffer_t *fifo_buffer = (fifo_buffer_t *)arg1;
-    static uint32_t file_counter = 0;
-    size_t data_count = 0;
+    fifo_consumer_t *consumer = (fifo_consumer_t *)arg2;
 
     // Wait for SD card initialization
     while (!sd_init_success)
@@ -609,42 +1588,45 @@ void sd_card_writer_thread(void *arg1, void *arg2, void *arg3)
 
     while (1)
     {
-        // Wait for data to be available
-        int ret = k_sem_take(&fifo_buffer->data_available, K_MSEC(40));
-        if (ret != 0)
+        // Wakes with a full write ready, or after SD_FLUSH_TIMEOUT_MS with whatever is left
+        int ret = fifo_buffer_wait(fifo_buffer, consumer, K_MSEC(SD_FLUSH_TIMEOUT_MS));
+        if (ret < 0)
         {
+            // Nothing new, make what was appended durable
+            sd_card_stream_sync();
             continue;
         }
 
-        LOG_INF("Data sem taken, reading from FIFO buffer");
-
-        // Read data from FIFO buffer
-        size_t read_count = read_from_fifo_buffer(fifo_buffer, &data_buffer[data_count], MAX_NEURAL_DATA_PER_WRITE - data_count);
-        data_count += read_count;
-
-        LOG_INF("Read %zu NeuralData structs from FIFO buffer now in data_count", read_count);
-        LOG_INF("Should we write: %d", (data_count == MAX_NEURAL_DATA_PER_WRITE));
-
-        // Write to SD card if buffer is full or we've read all available data
-        if (data_count == MAX_NEURAL_DATA_PER_WRITE || (read_count == 0 && data_count > 0))
+        // Append from the FIFO slots, or from the spill log when the writer fell behind, up to
+        // MAX_NEURAL_DATA_PER_WRITE structs per wakeup. A span that wraps round the end of the ring,
+        // or a batch that crosses between ring and log, goes in as several appends; the stream
+        // packs them into whole blocks.
+        fifo_read_span_t span;
+        size_t data_count = 0;
+        size_t written = 0;
+        size_t count;
+
+        while (data_count < MAX_NEURAL_DATA_PER_WRITE &&
+               (count = spill_read(fifo_buffer, consumer, MAX_NEURAL_DATA_PER_WRITE - data_count, &span)) > 0)
         {
-            snprintf(filename, PATH_MAX_LEN, "%s/data_%u.bin", current_data_folder, file_counter++);
-
-            size_t bytes_to_write = data_count * sizeof(NeuralData);
-            LOG_INF("About to write %zu bytes to file: %s", bytes_to_write, filename);
-            int ret = sd_card_open_write_close(filename, data_buffer, &bytes_to_write); // TODO LOOK INTO THIS FUNCTION
-            if (ret != 0)
-            {
-                LOG_ERR("Failed to write to SD card, err: %d", ret);
-            }
-            else
+            for (size_t run = 0; run < ARRAY_SIZE(span.data) && span.count[run] > 0; run++)
             {
-                LOG_INF("Wrote %zu NeuralData structs (%zu bytes) to %s", data_count, bytes_to_write, filename);
+                ret = sd_card_stream_write(span.data[run], span.count[run]);
+                if (ret != 0)
+                {
+                    LOG_ERR("Failed to write to SD card, err: %d", ret);
+                    break;
+                }
+                written += span.count[run];
             }
 
-            data_count = 0;
+            // The samples are handed back either way, a failed write must not stall acquisition
+            spill_release(fifo_buffer, consumer, count);
+            data_count += count;
+        }
+        if (written < data_count)
+        {
+            data_stats_add(DATA_STAT_SD_DROPPED, data_count - written);
         }
-
-        k_sleep(K_MSEC(15)); // Small delay to prevent tight looping
     }
 }
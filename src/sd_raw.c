@@ -0,0 +1,281 @@
+// sd_raw.c
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/storage/disk_access.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/logging/log.h>
+#include "../inc/sd_raw.h"
+
+LOG_MODULE_REGISTER(sd_raw, LOG_LEVEL_INF);
+
+#define SD_RAW_BLOCK_SIZE (SD_RAW_BLOCK_SECTORS * SD_RAW_SECTOR_SIZE)
+#define SD_RAW_BLOCK_PAYLOAD (SD_RAW_BLOCK_SIZE - sizeof(struct sd_raw_block_header))
+
+BUILD_ASSERT(sizeof(struct sd_raw_superblock) <= SD_RAW_SECTOR_SIZE, "Superblock must fit a sector");
+BUILD_ASSERT(sizeof(struct sd_raw_checkpoint) <= SD_RAW_SECTOR_SIZE, "Checkpoint must fit a sector");
+BUILD_ASSERT(SD_RAW_BLOCK_PAYLOAD <= UINT16_MAX, "Block payload must fit its count");
+
+// Only touched by the SD writer, under the SD card semaphore
+static const char *raw_disk;
+static uint32_t raw_first;         // First sector of the region
+static uint32_t raw_blocks;        // Data block slots
+static uint32_t raw_session;
+static uint32_t raw_sequence;      // Next block to be written
+static uint32_t raw_offset;        // Bytes of the session in written blocks
+static size_t raw_fill;            // Bytes in the block being built
+static bool raw_active;
+static uint8_t raw_block[SD_RAW_BLOCK_SIZE] __aligned(4);
+static uint8_t raw_sector[SD_RAW_SECTOR_SIZE] __aligned(4);
+
+static uint32_t sd_raw_block_sector(uint32_t sequence)
+{
+    return raw_first + SD_RAW_META_SECTORS + (sequence % raw_blocks) * SD_RAW_BLOCK_SECTORS;
+}
+
+static int sd_raw_write_sector(uint32_t sector, const void *record, size_t size)
+{
+    memset(raw_sector, 0, sizeof(raw_sector));
+    memcpy(raw_sector, record, size);
+    return disk_access_write(raw_disk, raw_sector, sector, 1);
+}
+
+static int sd_raw_write_checkpoint(void)
+{
+    struct sd_raw_checkpoint checkpoint = {
+        .magic = SD_RAW_MAGIC_CHECKPOINT,
+        .session = raw_session,
+        .sequence = raw_sequence,
+    };
+    uint32_t slot = (raw_sequence / SD_RAW_CHECKPOINT_INTERVAL) % SD_RAW_CHECKPOINT_SLOTS;
+
+    checkpoint.crc = crc32_ieee((const uint8_t *)&checkpoint, offsetof(struct sd_raw_checkpoint, crc));
+    return sd_raw_write_sector(raw_first + 1 + slot, &checkpoint, sizeof(checkpoint));
+}
+
+// Whether the data block slot of sequence holds that block, reads its header only
+static bool sd_raw_block_valid(uint32_t sequence)
+{
+    const struct sd_raw_block_header *header = (const struct sd_raw_block_header *)raw_sector;
+
+    if (disk_access_read(raw_disk, raw_sector, sd_raw_block_sector(sequence), 1) != 0)
+    {
+        return false;
+    }
+    return header->magic == SD_RAW_MAGIC_BLOCK && header->sequence == sequence &&
+           header->count <= SD_RAW_BLOCK_PAYLOAD;
+}
+
+// Next sequence number after the log's last block: newest checkpoint, then forward while the slots match
+static uint32_t sd_raw_find_end(void)
+{
+    const struct sd_raw_checkpoint *checkpoint = (const struct sd_raw_checkpoint *)raw_sector;
+    uint32_t sequence = 0;
+    bool found = false;
+
+    for (uint32_t slot = 0; slot < SD_RAW_CHECKPOINT_SLOTS; slot++)
+    {
+        if (disk_access_read(raw_disk, raw_sector, raw_first + 1 + slot, 1) != 0 ||
+            checkpoint->magic != SD_RAW_MAGIC_CHECKPOINT ||
+            checkpoint->crc != crc32_ieee(raw_sector, offsetof(struct sd_raw_checkpoint, crc)))
+        {
+            continue;
+        }
+        if (!found || (int32_t)(checkpoint->sequence - sequence) > 0)
+        {
+            sequence = checkpoint->sequence;
+            found = true;
+        }
+    }
+
+    for (uint32_t scanned = 0; scanned < raw_blocks && sd_raw_block_valid(sequence); scanned++)
+    {
+        sequence++;
+    }
+    return sequence;
+}
+
+int sd_raw_init(const char *disk, uint32_t first_sector, uint32_t sector_count)
+{
+    struct sd_raw_superblock super;
+    const struct sd_raw_superblock *stored = (const struct sd_raw_superblock *)raw_sector;
+    bool formatted;
+    int ret;
+
+    if (sector_count < SD_RAW_META_SECTORS + SD_RAW_MIN_BLOCKS * SD_RAW_BLOCK_SECTORS)
+    {
+        return -ENOSPC;
+    }
+
+    raw_disk = disk;
+    raw_first = first_sector;
+    raw_blocks = (sector_count - SD_RAW_META_SECTORS) / SD_RAW_BLOCK_SECTORS;
+
+    super = (struct sd_raw_superblock){
+        .magic = SD_RAW_MAGIC_SUPER,
+        .version = SD_RAW_VERSION,
+        .sector_size = SD_RAW_SECTOR_SIZE,
+        .region_sectors = SD_RAW_META_SECTORS + raw_blocks * SD_RAW_BLOCK_SECTORS,
+        .block_sectors = SD_RAW_BLOCK_SECTORS,
+    };
+
+    ret = disk_access_read(raw_disk, raw_sector, raw_first, 1);
+    if (ret)
+    {
+        LOG_ERR("Raw log superblock read failed (err %d)", ret);
+        return ret;
+    }
+
+    // A log with another version or geometry is started over, its blocks would not decode
+    formatted = stored->magic == SD_RAW_MAGIC_SUPER && stored->version == SD_RAW_VERSION &&
+                stored->crc == crc32_ieee(raw_sector, offsetof(struct sd_raw_superblock, crc)) &&
+                stored->sector_size == super.sector_size && stored->region_sectors == super.region_sectors &&
+                stored->block_sectors == super.block_sectors;
+    if (formatted)
+    {
+        super.session = stored->session;
+        raw_sequence = sd_raw_find_end();
+    }
+    else
+    {
+        LOG_WRN("No raw log found, formatting %u blocks", raw_blocks);
+        super.session = 0;
+        raw_sequence = 0;
+    }
+
+    super.session++;
+    super.crc = crc32_ieee((const uint8_t *)&super, offsetof(struct sd_raw_superblock, crc));
+    raw_session = super.session;
+    raw_offset = 0;
+    raw_fill = 0;
+
+    // Superblock first, then a checkpoint, so the next boot finds the session's start even if nothing follows
+    ret = sd_raw_write_sector(raw_first, &super, sizeof(super));
+    if (ret == 0)
+    {
+        ret = sd_raw_write_checkpoint();
+    }
+    if (ret)
+    {
+        LOG_ERR("Raw log metadata write failed (err %d)", ret);
+        return ret;
+    }
+
+    raw_active = true;
+    LOG_INF("Raw log: session %u from block %u, %u blocks of %zu bytes at sector %u", raw_session, raw_sequence,
+            raw_blocks, SD_RAW_BLOCK_PAYLOAD, raw_first);
+    return 0;
+}
+
+bool sd_raw_active(void)
+{
+    return raw_active;
+}
+
+uint32_t sd_raw_session(void)
+{
+    return raw_session;
+}
+
+// Seal the block being built and write it to its slot
+static int sd_raw_write_block(void)
+{
+    struct sd_raw_block_header *header = (struct sd_raw_block_header *)raw_block;
+    uint32_t crc;
+    int ret;
+
+    *header = (struct sd_raw_block_header){
+        .magic = SD_RAW_MAGIC_BLOCK,
+        .session = raw_session,
+        .sequence = raw_sequence,
+        .offset = raw_offset,
+        .count = raw_fill,
+    };
+    memset(&raw_block[sizeof(*header) + raw_fill], 0, SD_RAW_BLOCK_PAYLOAD - raw_fill);
+    crc = crc32_ieee(raw_block, sizeof(*header));
+    header->crc = crc32_ieee_update(crc, &raw_block[sizeof(*header)], raw_fill);
+
+    ret = disk_access_write(raw_disk, raw_block, sd_raw_block_sector(raw_sequence), SD_RAW_BLOCK_SECTORS);
+    if (ret)
+    {
+        // The slot is retried with the next block, a partly written one fails its CRC
+        LOG_ERR("Raw log block %u write failed (err %d)", raw_sequence, ret);
+    }
+    else
+    {
+        raw_sequence++;
+        if (raw_sequence % SD_RAW_CHECKPOINT_INTERVAL == 0 && sd_raw_write_checkpoint() != 0)
+        {
+            LOG_WRN("Raw log checkpoint write failed");
+        }
+    }
+    raw_offset += raw_fill;
+    raw_fill = 0;
+    return ret;
+}
+
+int sd_raw_write(const char *data, size_t size, size_t *lost, size_t *lost_buffered)
+{
+    size_t buffered = raw_fill; // Bytes of earlier calls in the block being filled
+    int blocks = 0;
+
+    *lost = 0;
+    *lost_buffered = 0;
+    if (!raw_active)
+    {
+        return -ENODEV;
+    }
+
+    while (size > 0)
+    {
+        size_t n = MIN(size, SD_RAW_BLOCK_PAYLOAD - raw_fill);
+
+        memcpy(&raw_block[sizeof(struct sd_raw_block_header) + raw_fill], data, n);
+        raw_fill += n;
+        data += n;
+        size -= n;
+        if (raw_fill == SD_RAW_BLOCK_PAYLOAD)
+        {
+            if (sd_raw_write_block() != 0)
+            {
+                *lost += SD_RAW_BLOCK_PAYLOAD - buffered;
+                *lost_buffered += buffered;
+            }
+            buffered = 0;
+            blocks++;
+        }
+    }
+    return blocks;
+}
+
+int sd_raw_flush(size_t *lost)
+{
+    int ret = 0;
+
+    *lost = 0;
+    if (!raw_active)
+    {
+        return -ENODEV;
+    }
+
+    if (raw_fill > 0)
+    {
+        size_t fill = raw_fill;
+
+        ret = sd_raw_write_block();
+        if (ret == 0)
+        {
+            ret = sd_raw_write_checkpoint();
+        }
+        else
+        {
+            *lost = fill;
+        }
+    }
+    if (ret == 0)
+    {
+        ret = disk_access_ioctl(raw_disk, DISK_IOCTL_CTRL_SYNC, NULL);
+    }
+    return ret;
+}
@@ -0,0 +1,94 @@
+// session_file.c
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/crc.h>
+#include <app_version.h>
+#include "../inc/session_file.h"
+#include "../inc/intan.h"
+
+void session_file_header_init(struct session_file_header *header, uint32_t session, uint32_t segment)
+{
+    struct intan_acq_config config;
+
+    intan_get_config(&config);
+    memset(header, 0, sizeof(*header));
+    header->magic = SESSION_MAGIC_HEADER;
+    header->version = SESSION_FILE_VERSION;
+    header->header_size = SESSION_HEADER_SIZE;
+    strncpy(header->firmware, APP_VERSION_STRING, sizeof(header->firmware) - 1);
+    header->session = session;
+    header->segment = segment;
+    header->block_size = SESSION_BLOCK_SIZE;
+    header->sample_rate_hz = config.sample_rate_hz;
+    header->channel_mask = config.channel_mask;
+    header->channels = MAX_CHANNELS;
+    header->record_size = SESSION_RECORD_SIZE;
+    header->chips = RHD_CHIP_COUNT;
+    header->register_count = INTAN_REGISTER_COUNT;
+    header->start_ns = intan_sample_time_ns(0);
+    header->uptime_ms = k_uptime_get();
+    for (size_t c = 0; c < RHD_CHIP_COUNT; c++)
+    {
+        // Chips that failed to initialize, or no chips at all with fake data, leave zeros
+        intan_get_registers(c, header->registers[c]);
+    }
+    header->crc = crc32_ieee((const uint8_t *)header, offsetof(struct session_file_header, crc));
+}
+
+bool session_run_continues(const NeuralData *previous, const NeuralData *sample)
+{
+    return sample->index == previous->index + 1 && sample->flags == previous->flags;
+}
+
+size_t session_run_length(const NeuralData *samples, size_t count)
+{
+    size_t n = MIN(count, 1);
+
+    while (n < count && session_run_continues(&samples[n - 1], &samples[n]))
+    {
+        n++;
+    }
+    return n;
+}
+
+void session_copy_records(uint8_t *dst, const NeuralData *samples, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(&dst[i * SESSION_RECORD_SIZE], samples[i].channel_data, SESSION_RECORD_SIZE);
+    }
+}
+
+void session_block_seal(uint8_t *block)
+{
+    struct session_block_header *header = (struct session_block_header *)block;
+    size_t used = sizeof(*header) + header->count * SESSION_RECORD_SIZE;
+
+    memset(&block[used], 0, SESSION_BLOCK_SIZE - used);
+    header->crc = 0;
+    header->crc = crc32_ieee(block, SESSION_BLOCK_SIZE);
+}
+
+bool session_file_header_valid(const struct session_file_header *header)
+{
+    return header->magic == SESSION_MAGIC_HEADER && header->version == SESSION_FILE_VERSION &&
+           header->header_size == SESSION_HEADER_SIZE && header->block_size == SESSION_BLOCK_SIZE &&
+           header->crc == crc32_ieee((const uint8_t *)header, offsetof(struct session_file_header, crc));
+}
+
+bool session_block_valid(uint8_t *block)
+{
+    struct session_block_header *header = (struct session_block_header *)block;
+    uint32_t crc = header->crc;
+    bool valid;
+
+    if (header->magic != SESSION_MAGIC_BLOCK || header->count == 0 || header->count > SESSION_BLOCK_RECORDS)
+    {
+        return false;
+    }
+    header->crc = 0;
+    valid = crc32_ieee(block, SESSION_BLOCK_SIZE) == crc;
+    header->crc = crc;
+    return valid;
+}
@@ -0,0 +1,445 @@
+// spill.c
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/flash.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/logging/log.h>
+#include "../inc/spill.h"
+#include "../inc/data_stats.h"
+
+LOG_MODULE_REGISTER(spill, LOG_LEVEL_INF);
+
+K_THREAD_STACK_DEFINE(spill_stack, SPILL_THREAD_STACK_SIZE);
+struct k_thread spill_thread_data;
+
+#if FIXED_PARTITION_EXISTS(spill_partition)
+
+#define SPILL_SECTOR_SIZE 4096
+#define SPILL_MAGIC 0x4C4C5053 // "SPLL"
+// Spill once the SD writer holds three quarters of the ring, and keep going down to a quarter
+#define SPILL_OVERFLOW_WATERMARK (FIFO_BUFFER_SIZE * 3 / 4)
+#define SPILL_LOW_WATERMARK (FIFO_BUFFER_SIZE / 4)
+// Pause between background sector erases while idle
+#define SPILL_ERASE_INTERVAL_MS 10
+#define SPILL_BLANK_CHECK_SIZE 256
+
+// Written last, a sector without a valid header was never completed
+struct spill_sector_header
+{
+    uint32_t magic;
+    uint32_t first_index; // FIFO index of the first sample
+    uint16_t count;
+    uint16_t sample_size;
+    uint32_t reserved;
+};
+
+#define SPILL_SECTOR_SAMPLES ((SPILL_SECTOR_SIZE - sizeof(struct spill_sector_header)) / sizeof(NeuralData))
+
+BUILD_ASSERT(sizeof(struct spill_sector_header) % 4 == 0 && sizeof(NeuralData) % 4 == 0,
+             "QSPI programs whole words");
+BUILD_ASSERT(SPILL_SECTOR_SAMPLES <= SPILL_LOW_WATERMARK, "A sector must fit in what is left after spilling");
+
+static const struct flash_area *spill_area;
+static size_t sector_count;
+
+// Log state, shared by the spill thread and the SD writer under spill_lock. Sector counters run
+// free and are taken modulo sector_count on flash: read <= write <= erased <= read + sector_count.
+static K_MUTEX_DEFINE(spill_lock);
+static K_CONDVAR_DEFINE(spill_cond);
+static struct
+{
+    bool active;            // SD reads stop at start until the log has drained
+    bool writing;           // A sector from end on is being written
+    bool draining;          // The SD writer holds samples of the staging buffer
+    uint32_t start;         // FIFO index of the oldest logged sample
+    uint32_t end;           // FIFO index after the newest logged sample
+    uint32_t held_end;      // FIFO index after the ring samples the SD writer holds
+    uint32_t read_sector;
+    uint32_t write_sector;
+    uint32_t erased_sector;
+    size_t read_offset;     // Samples of read_sector already handed to the SD writer
+} spill_log;
+
+static NeuralData staging[SPILL_SECTOR_SAMPLES];
+
+static off_t spill_sector_offset(uint32_t sector)
+{
+    return (off_t)(sector % sector_count) * SPILL_SECTOR_SIZE;
+}
+
+int spill_init(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer)
+{
+    struct flash_pages_info info;
+    int ret;
+
+    ret = flash_area_open(FIXED_PARTITION_ID(spill_partition), &spill_area);
+    if (ret)
+    {
+        LOG_ERR("Spill partition open failed (err %d)", ret);
+        spill_area = NULL;
+        return ret;
+    }
+    if (!device_is_ready(flash_area_get_device(spill_area)))
+    {
+        LOG_ERR("Spill flash device is not ready");
+        spill_area = NULL;
+        return -ENODEV;
+    }
+    ret = flash_get_page_info_by_offs(flash_area_get_device(spill_area), spill_area->fa_off, &info);
+    if (ret || info.size != SPILL_SECTOR_SIZE)
+    {
+        LOG_ERR("Spill partition needs %d byte erase sectors", SPILL_SECTOR_SIZE);
+        spill_area = NULL;
+        return -ENOTSUP;
+    }
+
+    sector_count = spill_area->fa_size / SPILL_SECTOR_SIZE;
+    spill_log.held_end = fifo_buffer_head(consumer);
+    fifo_buffer_set_overflow_watermark(consumer, SPILL_OVERFLOW_WATERMARK);
+
+    LOG_INF("Spill log: %zu sectors of %zu samples", sector_count, SPILL_SECTOR_SAMPLES);
+    return 0;
+}
+
+static bool spill_log_full(void)
+{
+    bool full;
+
+    k_mutex_lock(&spill_lock, K_FOREVER);
+    full = spill_log.erased_sector - spill_log.read_sector >= sector_count &&
+           spill_log.write_sector == spill_log.erased_sector;
+    k_mutex_unlock(&spill_lock);
+    return full;
+}
+
+// A sector still blank from an earlier erase needs no second one, reading it is much faster
+static bool spill_sector_blank(off_t offset)
+{
+    uint8_t chunk[SPILL_BLANK_CHECK_SIZE];
+    uint8_t erased = flash_area_erased_val(spill_area);
+
+    for (size_t pos = 0; pos < SPILL_SECTOR_SIZE; pos += sizeof(chunk))
+    {
+        if (flash_area_read(spill_area, offset + pos, chunk, sizeof(chunk)) != 0)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < sizeof(chunk); i++)
+        {
+            if (chunk[i] != erased)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Erase one freed sector ahead of the log. Returns 1 while more are waiting, 0 or a negative errno.
+static int spill_erase_ahead(void)
+{
+    uint32_t sector;
+    bool more;
+    int ret = 0;
+
+    k_mutex_lock(&spill_lock, K_FOREVER);
+    if (spill_log.erased_sector - spill_log.read_sector >= sector_count)
+    {
+        k_mutex_unlock(&spill_lock);
+        return 0;
+    }
+    sector = spill_log.erased_sector;
+    k_mutex_unlock(&spill_lock);
+
+    // Only this thread writes or erases, and the sector holds no logged samples
+    if (!spill_sector_blank(spill_sector_offset(sector)))
+    {
+        ret = flash_area_erase(spill_area, spill_sector_offset(sector), SPILL_SECTOR_SIZE);
+    }
+
+    k_mutex_lock(&spill_lock, K_FOREVER);
+    if (ret == 0 && spill_log.erased_sector == sector)
+    {
+        spill_log.erased_sector++;
+    }
+    more = spill_log.erased_sector - spill_log.read_sector < sector_count;
+    k_mutex_unlock(&spill_lock);
+
+    if (ret)
+    {
+        LOG_ERR("Spill sector erase failed (err %d)", ret);
+        return ret;
+    }
+    return more ? 1 : 0;
+}
+
+// Copy the oldest unlogged sector's worth of ring samples to flash and free their slots
+static int spill_sector(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer)
+{
+    struct spill_sector_header header = {
+        .magic = SPILL_MAGIC,
+        .count = SPILL_SECTOR_SAMPLES,
+        .sample_size = sizeof(NeuralData),
+    };
+    fifo_read_span_t span;
+    off_t offset;
+    int ret = 0;
+
+    k_mutex_lock(&spill_lock, K_FOREVER);
+    if (spill_log.write_sector == spill_log.erased_sector)
+    {
+        // Log full, or the background erase has not caught up
+        k_mutex_unlock(&spill_lock);
+        return -ENOSPC;
+    }
+    if (!spill_log.active)
+    {
+        // Start after the samples the SD writer holds, it writes those from the ring first. Their slots
+        // and everything after them stay with the SD writer until its head gets to start.
+        spill_log.start = spill_log.held_end;
+        spill_log.end = spill_log.held_end;
+        spill_log.active = true;
+    }
+    header.first_index = spill_log.end;
+    offset = spill_sector_offset(spill_log.write_sector);
+    spill_log.writing = true;
+    k_mutex_unlock(&spill_lock);
+
+    // The samples from end on are still in the ring, the producer waits for the spill cursor
+    if (fifo_buffer_peek_at(fifo_buffer, header.first_index, SPILL_SECTOR_SAMPLES, &span) < SPILL_SECTOR_SAMPLES)
+    {
+        ret = -EAGAIN;
+    }
+    else
+    {
+        off_t pos = offset + sizeof(header);
+
+        for (size_t run = 0; run < ARRAY_SIZE(span.data) && span.count[run] > 0 && ret == 0; run++)
+        {
+            ret = flash_area_write(spill_area, pos, span.data[run], span.count[run] * sizeof(NeuralData));
+            pos += span.count[run] * sizeof(NeuralData);
+        }
+        if (ret == 0)
+        {
+            ret = flash_area_write(spill_area, offset, &header, sizeof(header));
+        }
+    }
+
+    k_mutex_lock(&spill_lock, K_FOREVER);
+    spill_log.writing = false;
+    if (ret == 0)
+    {
+        spill_log.write_sector++;
+        spill_log.end += SPILL_SECTOR_SAMPLES;
+        fifo_buffer_set_spilled(consumer, spill_log.start, spill_log.end);
+    }
+    else
+    {
+        if (ret != -EAGAIN)
+        {
+            // Partly programmed, erase it again before reuse
+            spill_log.erased_sector = spill_log.write_sector;
+        }
+        if (spill_log.start == spill_log.end)
+        {
+            spill_log.active = false;
+        }
+    }
+    k_condvar_broadcast(&spill_cond);
+    k_mutex_unlock(&spill_lock);
+
+    if (ret && ret != -EAGAIN)
+    {
+        LOG_ERR("Spill sector write failed (err %d)", ret);
+    }
+    return ret;
+}
+
+void spill_thread(void *arg1, void *arg2, void *arg3)
+{
+    fifo_buffer_t *fifo_buffer = (fifo_buffer_t *)arg1;
+    fifo_consumer_t *consumer = (fifo_consumer_t *)arg2;
+    struct k_poll_event event;
+
+    if (spill_area == NULL)
+    {
+        return;
+    }
+
+    while (1)
+    {
+        k_poll_event_init(&event, K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &consumer->overflow);
+        // Reset before looking at the fill, a crossing after the check leaves the signal raised
+        k_poll_signal_reset(&consumer->overflow);
+        if (fifo_buffer_ring_fill(fifo_buffer, consumer) < SPILL_OVERFLOW_WATERMARK)
+        {
+            // Idle: erase freed sectors one at a time, then sleep until the next overflow
+            k_poll(&event, 1, spill_erase_ahead() > 0 ? K_MSEC(SPILL_ERASE_INTERVAL_MS) : K_FOREVER);
+            continue;
+        }
+
+        LOG_WRN("SD writer behind, spilling to flash");
+        while (fifo_buffer_ring_fill(fifo_buffer, consumer) > SPILL_LOW_WATERMARK)
+        {
+            int ret = spill_sector(fifo_buffer, consumer);
+            if (ret == -ENOSPC && !spill_log_full())
+            {
+                // Out of erased sectors: erase one inline, the ring fills meanwhile
+                ret = spill_erase_ahead();
+            }
+            if (ret < 0)
+            {
+                break;
+            }
+        }
+        if (fifo_buffer_ring_fill(fifo_buffer, consumer) >= SPILL_OVERFLOW_WATERMARK)
+        {
+            // Log full or the SD writer holds the rest, the overflow signal will not fire again
+            k_sleep(K_MSEC(SPILL_ERASE_INTERVAL_MS));
+        }
+    }
+}
+
+// Move the read cursor past n logged samples. Their ring slots went back when they were logged,
+// this only moves head on.
+static void spill_advance(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, size_t n)
+{
+    spill_log.start += n;
+    spill_log.read_offset += n;
+    if (spill_log.read_offset == SPILL_SECTOR_SAMPLES)
+    {
+        spill_log.read_offset = 0;
+        spill_log.read_sector++;
+    }
+    fifo_buffer_release(fifo_buffer, consumer, n);
+}
+
+// Read up to max logged samples of the oldest sector into the staging buffer. Samples that cannot be
+// read are skipped, counted as SD drops, and 0 is returned.
+static size_t spill_drain(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, size_t max, fifo_read_span_t *span)
+{
+    struct spill_sector_header header;
+    off_t offset = spill_sector_offset(spill_log.read_sector);
+    size_t n = MIN(max, SPILL_SECTOR_SAMPLES - spill_log.read_offset);
+    int ret = 0;
+
+    if (spill_log.read_offset == 0)
+    {
+        ret = flash_area_read(spill_area, offset, &header, sizeof(header));
+        if (ret == 0 && (header.magic != SPILL_MAGIC || header.first_index != spill_log.start ||
+                         header.sample_size != sizeof(NeuralData)))
+        {
+            ret = -EIO;
+        }
+        if (ret)
+        {
+            // Nothing in the sector can be trusted
+            n = SPILL_SECTOR_SAMPLES;
+        }
+    }
+    if (ret == 0)
+    {
+        ret = flash_area_read(spill_area, offset + sizeof(header) + spill_log.read_offset * sizeof(NeuralData), staging,
+                              n * sizeof(NeuralData));
+    }
+    if (ret)
+    {
+        LOG_ERR("Spill sector read failed (err %d), %zu samples lost", ret, n);
+        data_stats_add(DATA_STAT_SD_DROPPED, n);
+        spill_advance(fifo_buffer, consumer, n);
+        return 0;
+    }
+
+    span->data[0] = staging;
+    span->data[1] = staging;
+    span->count[0] = n;
+    span->count[1] = 0;
+    spill_log.draining = true;
+    return n;
+}
+
+size_t spill_read(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, size_t max, fifo_read_span_t *span)
+{
+    uint32_t head;
+    size_t n;
+
+    if (spill_area == NULL)
+    {
+        return fifo_buffer_peek(fifo_buffer, consumer, max, span);
+    }
+
+    k_mutex_lock(&spill_lock, K_FOREVER);
+    head = fifo_buffer_head(consumer);
+    while (spill_log.active && head == spill_log.end)
+    {
+        if (!spill_log.writing)
+        {
+            // Drained, back to reading the ring
+            spill_log.active = false;
+            break;
+        }
+        // The next samples are in the sector being written
+        k_condvar_wait(&spill_cond, &spill_lock, K_FOREVER);
+    }
+
+    if (spill_log.active && head == spill_log.start)
+    {
+        n = spill_drain(fifo_buffer, consumer, max, span);
+    }
+    else
+    {
+        n = fifo_buffer_peek(fifo_buffer, consumer, spill_log.active ? MIN(max, spill_log.start - head) : max, span);
+        spill_log.held_end = head + n;
+    }
+    k_mutex_unlock(&spill_lock);
+
+    return n;
+}
+
+void spill_release(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, size_t n)
+{
+    if (spill_area == NULL)
+    {
+        fifo_buffer_release(fifo_buffer, consumer, n);
+        return;
+    }
+
+    k_mutex_lock(&spill_lock, K_FOREVER);
+    if (spill_log.draining)
+    {
+        spill_log.draining = false;
+        spill_advance(fifo_buffer, consumer, n);
+    }
+    else
+    {
+        fifo_buffer_release(fifo_buffer, consumer, n);
+    }
+    spill_log.held_end = fifo_buffer_head(consumer);
+    k_mutex_unlock(&spill_lock);
+}
+
+#else
+
+int spill_init(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer)
+{
+    return -ENOTSUP;
+}
+
+void spill_thread(void *arg1, void *arg2, void *arg3)
+{
+}
+
+size_t spill_read(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, size_t max, fifo_read_span_t *span)
+{
+    return fifo_buffer_peek(fifo_buffer, consumer, max, span);
+}
+
+void spill_release(fifo_buffer_t *fifo_buffer, fifo_consumer_t *consumer, size_t n)
+{
+    fifo_buffer_release(fifo_buffer, consumer, n);
+}
+
+#endif // FIXED_PARTITION_EXISTS(spill_partition)
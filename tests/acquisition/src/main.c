@@ -0,0 +1,194 @@
+// tests/acquisition/src/main.c
+// Per-mode acquisition benchmark: throughput, sample latency and frame handler cost at each rate.
+// Every run prints one BENCH line, collect them with: grep BENCH handler.log
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+#include "../inc/intan.h"
+#include "../inc/fifo_buffer.h"
+#include "../inc/data_stats.h"
+#include "../inc/device_status.h"
+
+// Length of each measured run
+#define BENCH_RUN_MS 2000
+// Every mode must sustain this rate without a gap or a drop
+#define BENCH_LOSSLESS_HZ 1000
+// The acquisition thread starts sampling 3 s after it starts
+#define BENCH_START_TIMEOUT_MS 5000
+
+static const uint32_t bench_rates_hz[] = {1000, 2000, 5000};
+static const char *const bench_mode_names[INTAN_MODE_COUNT] = {"per_word", "frame", "hw_timed"};
+
+struct bench_result
+{
+    uint32_t samples;    // Samples of this run received
+    uint32_t gaps;       // Places the index jumped
+    uint32_t missing;    // Indices skipped over by the gaps
+    uint32_t backwards;  // Indices not above the previous one
+    int64_t latency_sum_ns;
+    int64_t latency_max_ns;
+};
+
+// The intan driver updates the battery and temperature fields
+DeviceStatus device_status;
+
+static fifo_buffer_t fifo_buffer;
+static fifo_consumer_t consumer;
+static uint32_t last_index;
+static bool have_last;
+
+// Discard everything already in the ring, remembering the last index seen
+static void bench_drain(void)
+{
+    fifo_read_span_t span;
+    size_t n;
+
+    while ((n = fifo_buffer_peek(&fifo_buffer, &consumer, FIFO_BUFFER_SIZE, &span)) > 0)
+    {
+        const NeuralData *last = span.count[1] > 0 ? &span.data[1][span.count[1] - 1]
+                                                   : &span.data[0][span.count[0] - 1];
+        last_index = last->index;
+        have_last = true;
+        fifo_buffer_release(&fifo_buffer, &consumer, n);
+    }
+}
+
+static void bench_sample(struct bench_result *result, uint32_t index, int64_t now_ns, bool *started)
+{
+    // Samples of the previous run can still come through after intan_configure() returns,
+    // the new run starts where the index goes back
+    if (!*started)
+    {
+        if (have_last && index > last_index)
+        {
+            last_index = index;
+            return;
+        }
+        *started = true;
+    }
+    else if (index != last_index + 1)
+    {
+        if ((int32_t)(index - last_index) > 0)
+        {
+            result->gaps++;
+            result->missing += index - last_index - 1;
+        }
+        else
+        {
+            result->backwards++;
+        }
+    }
+
+    int64_t latency_ns = now_ns - intan_sample_time_ns(index);
+
+    result->latency_sum_ns += latency_ns;
+    result->latency_max_ns = MAX(result->latency_max_ns, latency_ns);
+    result->samples++;
+    last_index = index;
+    have_last = true;
+}
+
+static void bench_run(uint32_t rate_hz, struct bench_result *result)
+{
+    struct intan_acq_config config = {
+        .sample_rate_hz = rate_hz,
+        .channel_mask = intan_available_channels(),
+    };
+    bool started = false;
+
+    bench_drain();
+    zassert_ok(intan_configure(&config), "configure %u Hz", rate_hz);
+    intan_reset_timing_stats();
+
+    int64_t end = k_uptime_get() + BENCH_RUN_MS;
+    while (k_uptime_get() < end)
+    {
+        if (fifo_buffer_wait(&fifo_buffer, &consumer, K_MSEC(100)) <= 0)
+        {
+            continue;
+        }
+
+        // Latency is measured when the consumer gets the sample, as the SD writer would
+        int64_t now_ns = k_ticks_to_ns_floor64(k_uptime_ticks());
+        fifo_read_span_t span;
+        size_t n = fifo_buffer_peek(&fifo_buffer, &consumer, FIFO_BUFFER_SIZE, &span);
+
+        for (int run = 0; run < 2; run++)
+        {
+            for (size_t i = 0; i < span.count[run]; i++)
+            {
+                bench_sample(result, span.data[run][i].index, now_ns, &started);
+            }
+        }
+        fifo_buffer_release(&fifo_buffer, &consumer, n);
+    }
+}
+
+static void *acquisition_setup(void)
+{
+    zassert_ok(init_fifo_buffer(&fifo_buffer));
+    // Woken on every commit, so latency is not inflated by batching
+    zassert_ok(fifo_buffer_add_consumer(&fifo_buffer, &consumer, FIFO_OVERFLOW_BLOCK, 1, 1));
+    zassert_ok(intan_init(&fifo_buffer));
+
+    k_thread_create(&intan_thread_data, intan_stack, INTAN_THREAD_STACK_SIZE, intan_thread, &fifo_buffer, NULL,
+                    NULL, 0, 0, K_NO_WAIT);
+
+    zassert_true(fifo_buffer_wait(&fifo_buffer, &consumer, K_MSEC(BENCH_START_TIMEOUT_MS)) > 0,
+                 "Acquisition did not start");
+    return NULL;
+}
+
+ZTEST(acquisition, test_mode_benchmark)
+{
+    for (int mode = 0; mode < INTAN_MODE_COUNT; mode++)
+    {
+        int ret = intan_set_mode(mode);
+
+        if (ret == -ENOTSUP)
+        {
+            TC_PRINT("BENCH mode=%s not supported on this board\n", bench_mode_names[mode]);
+            continue;
+        }
+        zassert_ok(ret, "set mode %s", bench_mode_names[mode]);
+
+        for (size_t r = 0; r < ARRAY_SIZE(bench_rates_hz); r++)
+        {
+            uint32_t rate_hz = bench_rates_hz[r];
+            struct bench_result result = {0};
+            struct intan_timing_stats timing;
+            struct data_stats before, after;
+
+            data_stats_get(&before);
+            bench_run(rate_hz, &result);
+            data_stats_get(&after);
+            intan_get_timing_stats(&timing);
+
+            uint32_t dropped = after.fifo_dropped - before.fifo_dropped;
+            uint32_t late = after.late - before.late;
+            uint32_t latency_mean_us = result.samples ? (uint32_t)(result.latency_sum_ns / result.samples / 1000) : 0;
+
+            // The mode actually in use, the hardware-timed stream falls back to the acquisition clock
+            TC_PRINT("BENCH mode=%s active=%s rate_hz=%u samples=%u expected=%u gaps=%u missing=%u dropped=%u "
+                     "late=%u latency_mean_us=%u latency_max_us=%u handler_max_us=%u coalesced=%u overrun=%u\n",
+                     bench_mode_names[mode], bench_mode_names[intan_get_mode()], rate_hz, result.samples,
+                     rate_hz * BENCH_RUN_MS / 1000, result.gaps, result.missing, dropped, late, latency_mean_us,
+                     (uint32_t)(result.latency_max_ns / 1000), timing.handler_max_ns / 1000, timing.coalesced_ticks,
+                     timing.overrun_ticks);
+
+            zassert_true(result.samples > 0, "%s at %u Hz: no samples", bench_mode_names[mode], rate_hz);
+            zassert_equal(result.backwards, 0, "%s at %u Hz: index went back", bench_mode_names[mode], rate_hz);
+            if (rate_hz <= BENCH_LOSSLESS_HZ)
+            {
+                zassert_equal(result.missing, 0, "%s at %u Hz: %u samples missing", bench_mode_names[mode], rate_hz,
+                              result.missing);
+                zassert_equal(dropped, 0, "%s at %u Hz: %u samples dropped", bench_mode_names[mode], rate_hz,
+                              dropped);
+            }
+        }
+    }
+}
+
+ZTEST_SUITE(acquisition, NULL, acquisition_setup, NULL, NULL, NULL);
@@ -0,0 +1,65 @@
+// legacy_fifo.c
+// Locking and copy loops as in the original fifo_buffer.c, without its fill logging
+
+#include <errno.h>
+#include "legacy_fifo.h"
+
+int legacy_fifo_init(legacy_fifo_t *fifo)
+{
+    if (fifo == NULL)
+    {
+        return -EINVAL;
+    }
+
+    fifo->head = 0;
+    fifo->tail = 0;
+    fifo->size = 0;
+
+    return k_mutex_init(&fifo->mutex);
+}
+
+size_t legacy_fifo_read(legacy_fifo_t *fifo, NeuralData *data, size_t max_size)
+{
+    size_t structs_read = 0;
+
+    if (k_mutex_lock(&fifo->mutex, K_NO_WAIT) != 0)
+    {
+        return 0;
+    }
+
+    while (structs_read < max_size && fifo->size > 0)
+    {
+        *data = fifo->buffer[fifo->head];
+        fifo->head = (fifo->head + 1) % FIFO_BUFFER_SIZE;
+        fifo->size--;
+        data++;
+        structs_read++;
+    }
+
+    k_mutex_unlock(&fifo->mutex);
+
+    return structs_read;
+}
+
+size_t legacy_fifo_write(legacy_fifo_t *fifo, const NeuralData *data, size_t size)
+{
+    size_t structs_written = 0;
+
+    if (k_mutex_lock(&fifo->mutex, K_NO_WAIT) != 0)
+    {
+        return 0;
+    }
+
+    while (structs_written < size && fifo->size < FIFO_BUFFER_SIZE)
+    {
+        fifo->buffer[fifo->tail] = *data;
+        fifo->tail = (fifo->tail + 1) % FIFO_BUFFER_SIZE;
+        fifo->size++;
+        data++;
+        structs_written++;
+    }
+
+    k_mutex_unlock(&fifo->mutex);
+
+    return structs_written;
+}
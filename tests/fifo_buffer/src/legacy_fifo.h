@@ -0,0 +1,27 @@
+// legacy_fifo.h
+// The mutex-guarded FIFO the lock-free ring replaced, kept as the baseline for the stress test
+
+#ifndef LEGACY_FIFO_H
+#define LEGACY_FIFO_H
+
+#include <stddef.h>
+#include <zephyr/kernel.h>
+#include "../inc/neural_data.h"
+#include "../inc/fifo_buffer.h"
+
+// Same capacity as the lock-free ring so only the locking differs
+typedef struct
+{
+    NeuralData buffer[FIFO_BUFFER_SIZE];
+    size_t head;
+    size_t tail;
+    size_t size;
+    struct k_mutex mutex;
+} legacy_fifo_t;
+
+int legacy_fifo_init(legacy_fifo_t *fifo);
+// Both sides give up and return 0 when the other holds the lock, as the original did
+size_t legacy_fifo_read(legacy_fifo_t *fifo, NeuralData *data, size_t max_size);
+size_t legacy_fifo_write(legacy_fifo_t *fifo, const NeuralData *data, size_t size);
+
+#endif // LEGACY_FIFO_H
@@ -0,0 +1,207 @@
+// tests/fifo_buffer/src/main.c
+// Producer/consumer stress test: the same load on the lock-free ring and on the mutex FIFO it
+// replaced, counting the samples each one drops. Collect the results with: grep STRESS handler.log
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+#include "../inc/fifo_buffer.h"
+#include "../inc/neural_data.h"
+#include "legacy_fifo.h"
+
+// Acquisition-like load: blocks of 8 samples at 2 kHz
+#define STRESS_RATE_HZ 2000
+#define STRESS_BLOCK 8
+#define STRESS_RUN_MS 5000
+// SD-like consumer: a batch per read, then a write stall every so often that still fits in the ring
+#define STRESS_READ_MAX 64
+#define STRESS_WRITE_US_PER_ITEM 20
+#define STRESS_STALL_PERIOD_MS 1000
+#define STRESS_STALL_MS 150
+BUILD_ASSERT(STRESS_RATE_HZ * STRESS_STALL_MS / 1000 + STRESS_READ_MAX < FIFO_BUFFER_SIZE,
+             "The consumer stall must fit in the ring");
+
+#define STRESS_PRODUCER_PRIORITY K_PRIO_PREEMPT(1)
+#define STRESS_CONSUMER_PRIORITY K_PRIO_PREEMPT(5)
+#define STRESS_STACK_SIZE 2048
+
+struct stress_fifo
+{
+    const char *name;
+    size_t (*write)(const NeuralData *data, size_t size);
+    size_t (*read)(NeuralData *data, size_t max_size);
+};
+
+struct stress_result
+{
+    uint32_t produced; // Samples offered to the FIFO
+    uint32_t dropped;  // Samples the FIFO refused
+    uint32_t received; // Samples the consumer read
+    uint32_t missing;  // Indices the consumer never saw
+    uint32_t corrupt;  // Samples whose payload does not match their index
+};
+
+K_THREAD_STACK_DEFINE(producer_stack, STRESS_STACK_SIZE);
+K_THREAD_STACK_DEFINE(consumer_stack, STRESS_STACK_SIZE);
+static struct k_thread producer_thread_data;
+static struct k_thread consumer_thread_data;
+static K_SEM_DEFINE(producer_tick, 0, 1);
+static atomic_t stopping;
+
+static fifo_buffer_t ring;
+static fifo_consumer_t ring_consumer;
+static legacy_fifo_t legacy;
+
+static size_t ring_write(const NeuralData *data, size_t size)
+{
+    return write_to_fifo_buffer(&ring, data, size);
+}
+
+static size_t ring_read(NeuralData *data, size_t max_size)
+{
+    return read_from_fifo_buffer(&ring, &ring_consumer, data, max_size);
+}
+
+static size_t legacy_write(const NeuralData *data, size_t size)
+{
+    return legacy_fifo_write(&legacy, data, size);
+}
+
+static size_t legacy_read(NeuralData *data, size_t max_size)
+{
+    return legacy_fifo_read(&legacy, data, max_size);
+}
+
+static void producer_timer_expiry(struct k_timer *timer)
+{
+    k_sem_give(&producer_tick);
+}
+
+static K_TIMER_DEFINE(producer_timer, producer_timer_expiry, NULL);
+
+static void producer_thread(void *arg1, void *arg2, void *arg3)
+{
+    const struct stress_fifo *fifo = arg1;
+    struct stress_result *result = arg2;
+    NeuralData block[STRESS_BLOCK] = {0};
+    uint32_t index = 0;
+
+    while (!atomic_get(&stopping))
+    {
+        if (k_sem_take(&producer_tick, K_MSEC(100)) != 0)
+        {
+            continue;
+        }
+
+        for (size_t i = 0; i < STRESS_BLOCK; i++)
+        {
+            block[i].index = index;
+            block[i].channel_data[0] = (uint16_t)index;
+            index++;
+        }
+
+        size_t written = fifo->write(block, STRESS_BLOCK);
+
+        result->produced += STRESS_BLOCK;
+        result->dropped += STRESS_BLOCK - written;
+        // Refused samples keep their indices, the consumer sees them as missing
+        if (written < STRESS_BLOCK)
+        {
+            index = block[STRESS_BLOCK - 1].index + 1;
+        }
+    }
+}
+
+static void consumer_thread(void *arg1, void *arg2, void *arg3)
+{
+    const struct stress_fifo *fifo = arg1;
+    struct stress_result *result = arg2;
+    static NeuralData batch[STRESS_READ_MAX];
+    uint32_t expected = 0;
+    int64_t next_stall = k_uptime_get() + STRESS_STALL_PERIOD_MS;
+    size_t n;
+
+    // Keep reading after the producer stops until the FIFO is empty
+    while ((n = fifo->read(batch, STRESS_READ_MAX)) > 0 || !atomic_get(&stopping))
+    {
+        if (n == 0)
+        {
+            k_sleep(K_MSEC(1));
+            continue;
+        }
+
+        for (size_t i = 0; i < n; i++)
+        {
+            uint32_t index = batch[i].index;
+
+            if (index != expected)
+            {
+                result->missing += index - expected;
+            }
+            if (batch[i].channel_data[0] != (uint16_t)index)
+            {
+                result->corrupt++;
+            }
+            expected = index + 1;
+        }
+        result->received += n;
+
+        // Write cost, spinning like a blocking SPI transfer
+        k_busy_wait(n * STRESS_WRITE_US_PER_ITEM);
+        if (k_uptime_get() >= next_stall)
+        {
+            k_busy_wait(STRESS_STALL_MS * USEC_PER_MSEC);
+            next_stall += STRESS_STALL_PERIOD_MS;
+        }
+    }
+}
+
+static void stress_run(const struct stress_fifo *fifo, struct stress_result *result)
+{
+    atomic_clear(&stopping);
+    k_sem_reset(&producer_tick);
+
+    k_thread_create(&consumer_thread_data, consumer_stack, K_THREAD_STACK_SIZEOF(consumer_stack), consumer_thread,
+                    (void *)fifo, result, NULL, STRESS_CONSUMER_PRIORITY, 0, K_NO_WAIT);
+    k_thread_create(&producer_thread_data, producer_stack, K_THREAD_STACK_SIZEOF(producer_stack), producer_thread,
+                    (void *)fifo, result, NULL, STRESS_PRODUCER_PRIORITY, 0, K_NO_WAIT);
+
+    k_timer_start(&producer_timer, K_USEC(USEC_PER_SEC * STRESS_BLOCK / STRESS_RATE_HZ),
+                  K_USEC(USEC_PER_SEC * STRESS_BLOCK / STRESS_RATE_HZ));
+    k_sleep(K_MSEC(STRESS_RUN_MS));
+    k_timer_stop(&producer_timer);
+
+    atomic_set(&stopping, 1);
+    zassert_ok(k_thread_join(&producer_thread_data, K_SECONDS(1)));
+    zassert_ok(k_thread_join(&consumer_thread_data, K_SECONDS(5)));
+
+    TC_PRINT("STRESS fifo=%s produced=%u dropped=%u received=%u missing=%u corrupt=%u\n", fifo->name,
+             result->produced, result->dropped, result->received, result->missing, result->corrupt);
+
+    // Every sample is either received or counted as a drop at the producer
+    zassert_equal(result->received + result->dropped, result->produced, "%s lost samples silently", fifo->name);
+    zassert_equal(result->missing, result->dropped, "%s drops do not match the index gaps", fifo->name);
+    zassert_equal(result->corrupt, 0, "%s handed out torn samples", fifo->name);
+}
+
+ZTEST(fifo_buffer, test_stress_against_mutex_fifo)
+{
+    static const struct stress_fifo ring_fifo = {"lock_free", ring_write, ring_read};
+    static const struct stress_fifo legacy_fifo = {"mutex", legacy_write, legacy_read};
+    struct stress_result ring_result = {0};
+    struct stress_result legacy_result = {0};
+
+    zassert_ok(init_fifo_buffer(&ring));
+    zassert_ok(fifo_buffer_add_consumer(&ring, &ring_consumer, FIFO_OVERFLOW_BLOCK, 1, STRESS_READ_MAX));
+    zassert_ok(legacy_fifo_init(&legacy));
+
+    stress_run(&legacy_fifo, &legacy_result);
+    stress_run(&ring_fifo, &ring_result);
+
+    // The stall fits in the ring, so the only thing left to drop samples is lock contention
+    zassert_equal(ring_result.dropped, 0, "Lock-free ring dropped %u samples", ring_result.dropped);
+    zassert_true(ring_result.dropped <= legacy_result.dropped);
+}
+
+ZTEST_SUITE(fifo_buffer, NULL, NULL, NULL, NULL, NULL);
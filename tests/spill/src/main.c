@@ -0,0 +1,203 @@
+// tests/spill/src/main.c
+// Stalls an SD-writer-like consumer at 2 kHz so the spill tier takes over, then drains the log and
+// checks every index arrives once, in order and intact.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+#include "../inc/fifo_buffer.h"
+#include "../inc/spill.h"
+#include "../inc/data_stats.h"
+
+// Acquisition-like load: blocks of 8 samples at 2 kHz
+#define SPILL_TEST_RATE_HZ 2000
+#define SPILL_TEST_BLOCK 8
+// Samples per read, as the SD writer
+#define SPILL_TEST_READ_MAX 128
+// Long enough to overrun the ring several times, short enough for the log
+#define SPILL_TEST_STALL_MS 1000
+// Consumer holding a ring span mid-write for longer than the ring lasts
+#define SPILL_TEST_HOLD_MS 400
+#define SPILL_TEST_CATCH_UP_MS 1000
+BUILD_ASSERT(SPILL_TEST_RATE_HZ * SPILL_TEST_STALL_MS / 1000 > 2 * FIFO_BUFFER_SIZE, "The stall must need the spill tier");
+
+#define SPILL_TEST_PRODUCER_PRIORITY K_PRIO_PREEMPT(1)
+#define SPILL_TEST_SPILL_PRIORITY K_PRIO_PREEMPT(2)
+#define SPILL_TEST_STACK_SIZE 2048
+
+struct spill_test_result
+{
+    uint32_t received; // Samples the consumer read
+    uint32_t expected; // Next index in order
+    uint32_t missing;  // Indices skipped over
+    uint32_t corrupt;  // Samples whose payload does not match their index
+};
+
+K_THREAD_STACK_DEFINE(producer_stack, SPILL_TEST_STACK_SIZE);
+static struct k_thread producer_thread_data;
+static K_SEM_DEFINE(producer_tick, 0, 1);
+static atomic_t stopping;
+static atomic_t produced;
+static atomic_t dropped;
+
+static fifo_buffer_t fifo_buffer;
+static fifo_consumer_t consumer;
+static struct spill_test_result result;
+
+static void producer_timer_expiry(struct k_timer *timer)
+{
+    k_sem_give(&producer_tick);
+}
+
+static K_TIMER_DEFINE(producer_timer, producer_timer_expiry, NULL);
+
+static void producer_thread(void *arg1, void *arg2, void *arg3)
+{
+    NeuralData block[SPILL_TEST_BLOCK] = {0};
+    uint32_t index = 0;
+
+    while (!atomic_get(&stopping))
+    {
+        if (k_sem_take(&producer_tick, K_MSEC(100)) != 0)
+        {
+            continue;
+        }
+
+        for (size_t i = 0; i < SPILL_TEST_BLOCK; i++)
+        {
+            block[i].index = index;
+            block[i].channel_data[0] = (uint16_t)index;
+            block[i].channel_data[1] = (uint16_t)(index >> 16);
+            index++;
+        }
+
+        // Refused samples keep their indices, the consumer sees them as missing
+        size_t written = write_to_fifo_buffer(&fifo_buffer, block, SPILL_TEST_BLOCK);
+        atomic_add(&produced, SPILL_TEST_BLOCK);
+        atomic_add(&dropped, SPILL_TEST_BLOCK - written);
+    }
+}
+
+static bool spill_test_intact(const NeuralData *sample)
+{
+    return sample->channel_data[0] == (uint16_t)sample->index &&
+           sample->channel_data[1] == (uint16_t)(sample->index >> 16);
+}
+
+static void spill_test_check(const fifo_read_span_t *span)
+{
+    for (size_t run = 0; run < ARRAY_SIZE(span->data); run++)
+    {
+        for (size_t i = 0; i < span->count[run]; i++)
+        {
+            const NeuralData *sample = &span->data[run][i];
+
+            if (sample->index != result.expected)
+            {
+                result.missing += sample->index - result.expected;
+            }
+            if (!spill_test_intact(sample))
+            {
+                result.corrupt++;
+            }
+            result.expected = sample->index + 1;
+            result.received++;
+        }
+    }
+}
+
+// Read like the SD writer for duration_ms, through the spill tier
+static void spill_test_consume(uint32_t duration_ms)
+{
+    int64_t end = k_uptime_get() + duration_ms;
+    fifo_read_span_t span;
+    size_t n;
+
+    do
+    {
+        if (fifo_buffer_wait(&fifo_buffer, &consumer, K_MSEC(50)) < 0)
+        {
+            continue;
+        }
+        while ((n = spill_read(&fifo_buffer, &consumer, SPILL_TEST_READ_MAX, &span)) > 0)
+        {
+            spill_test_check(&span);
+            spill_release(&fifo_buffer, &consumer, n);
+        }
+    } while (k_uptime_get() < end);
+}
+
+static void *spill_test_setup(void)
+{
+    zassert_ok(init_fifo_buffer(&fifo_buffer));
+    zassert_ok(fifo_buffer_add_consumer(&fifo_buffer, &consumer, FIFO_OVERFLOW_BLOCK, 1, SPILL_TEST_READ_MAX));
+    zassert_ok(spill_init(&fifo_buffer, &consumer));
+
+    k_thread_create(&spill_thread_data, spill_stack, SPILL_THREAD_STACK_SIZE, spill_thread, &fifo_buffer, &consumer,
+                    NULL, SPILL_TEST_SPILL_PRIORITY, 0, K_NO_WAIT);
+    k_thread_create(&producer_thread_data, producer_stack, K_THREAD_STACK_SIZEOF(producer_stack), producer_thread,
+                    NULL, NULL, NULL, SPILL_TEST_PRODUCER_PRIORITY, 0, K_NO_WAIT);
+    k_timer_start(&producer_timer, K_USEC(USEC_PER_SEC * SPILL_TEST_BLOCK / SPILL_TEST_RATE_HZ),
+                  K_USEC(USEC_PER_SEC * SPILL_TEST_BLOCK / SPILL_TEST_RATE_HZ));
+    return NULL;
+}
+
+// Runs first: the consumer stops reading altogether, the spill tier keeps the producer going
+ZTEST(spill, test_1_stall_is_lossless)
+{
+    struct data_stats stats;
+
+    spill_test_consume(SPILL_TEST_CATCH_UP_MS);
+    k_sleep(K_MSEC(SPILL_TEST_STALL_MS));
+    spill_test_consume(SPILL_TEST_CATCH_UP_MS);
+
+    data_stats_get(&stats);
+    TC_PRINT("stall: produced=%ld dropped=%ld received=%u missing=%u corrupt=%u high_watermark=%u\n",
+             atomic_get(&produced), atomic_get(&dropped), result.received, result.missing, result.corrupt,
+             stats.fifo_high_watermark);
+
+    zassert_equal(atomic_get(&dropped), 0, "Producer dropped samples during a spillable stall");
+    zassert_equal(result.missing, 0, "Indices missing after the drain");
+    zassert_equal(result.corrupt, 0, "Samples overwritten");
+    zassert_equal(stats.sd_dropped, 0, "Logged samples could not be read back");
+    // Everything produced up to a block ago has been read
+    zassert_true(result.received + SPILL_TEST_READ_MAX + SPILL_TEST_BLOCK >= atomic_get(&produced));
+}
+
+// The consumer holds a ring span, as the SD writer does while its write is queued, for longer than the
+// ring lasts. The spill tier must not hand those slots to the producer: it drops, and says so, instead.
+ZTEST(spill, test_2_held_span_is_not_overwritten)
+{
+    fifo_read_span_t span;
+    size_t n;
+
+    spill_test_consume(SPILL_TEST_CATCH_UP_MS);
+    uint32_t dropped_before = atomic_get(&dropped);
+
+    n = spill_read(&fifo_buffer, &consumer, SPILL_TEST_READ_MAX, &span);
+    zassert_true(n > 0);
+    k_sleep(K_MSEC(SPILL_TEST_HOLD_MS));
+
+    uint32_t corrupt_before = result.corrupt;
+    spill_test_check(&span);
+    zassert_equal(result.corrupt, corrupt_before, "Held samples were overwritten");
+    spill_release(&fifo_buffer, &consumer, n);
+
+    spill_test_consume(SPILL_TEST_CATCH_UP_MS);
+    atomic_set(&stopping, 1);
+    k_timer_stop(&producer_timer);
+    zassert_ok(k_thread_join(&producer_thread_data, K_SECONDS(1)));
+    spill_test_consume(SPILL_TEST_CATCH_UP_MS);
+
+    TC_PRINT("hold: produced=%ld dropped=%ld (%u while held) received=%u missing=%u corrupt=%u\n",
+             atomic_get(&produced), atomic_get(&dropped), (uint32_t)atomic_get(&dropped) - dropped_before,
+             result.received, result.missing, result.corrupt);
+
+    // Every sample is either read once or counted as dropped
+    zassert_equal(result.missing, atomic_get(&dropped));
+    zassert_equal(result.received + atomic_get(&dropped), atomic_get(&produced));
+    zassert_equal(result.corrupt, 0);
+}
+
+ZTEST_SUITE(spill, NULL, spill_test_setup, NULL, NULL, NULL);